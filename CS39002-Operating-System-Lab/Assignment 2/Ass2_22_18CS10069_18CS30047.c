@@ -4,34 +4,143 @@
 #include "unistd.h"
 #include "sys/wait.h"
 #include "fcntl.h"
+#include "signal.h"
+#include "spawn.h"
+#include "errno.h"
+#include "sys/stat.h"
+#include "poll.h"
 
 #define BUF_SIZE 128
-#define BUILT_INS 3
+#define BUILT_INS 8
+#define HASH_SIZE 64
 
-int readCommand(char* line);
-char** splitPipes(char* line,int *pipeProcesses);
-char** splitCommand(char* command,int *noOfTokens);
-int execute(char** args,int noOfArgs);
-int shellExecute(char** args,int noOfArgs,int in_fd,int out_fd);
+//state of one process of a job
+#define PROC_RUNNING 0
+#define PROC_STOPPED 1
+#define PROC_DONE 2
+//state of a job, from the states of its processes
+#define JOB_RUNNING 0
+#define JOB_STOPPED 1
+#define JOB_DONE 2
+
+//memory for parsing one command line: the stages and argv
+//arrays of a line are carved out of it one after the other
+//and all of them are freed at once by resetting used to 0
+typedef struct Arena
+{
+    char* buf;
+    size_t size;
+    size_t used;
+} Arena;
+
+//one command of a pipeline, every string points into the line
+typedef struct Stage
+{
+    char** argv;   //NULL terminated, for execvp
+    int argc;
+    char* inFile;  //file after <, NULL if none
+    char* outFile; //file after >, NULL if none
+} Stage;
+
+//one parsed command line: N stages connected by N-1 pipes
+typedef struct Pipeline
+{
+    Stage* stages;
+    int noOfStages;
+    int background;//line ended with &
+} Pipeline;
+
+//a command found in PATH, kept in pathTable by its name
+typedef struct PathEntry
+{
+    char* name;
+    char* path;
+    int hits;//times the path was used
+    struct PathEntry* next;
+} PathEntry;
+
+//the processes started for one command line, in one process group
+typedef struct Job
+{
+    int id;         //number shown as [id], used by fg %id
+    pid_t pgid;
+    pid_t* pids;
+    int* states;    //PROC_ state of every process
+    int noOfPids;
+    int background; //started with & or sent to the background by bg
+    int changed;    //finished or stopped since last reported
+    char* command;  //command line, for jobs
+    struct Job* next;
+} Job;
+
+int readCommand(char** line,int* bufsize);
+void* arenaAlloc(Arena* arena,size_t bytes);
+void arenaReset(Arena* arena,size_t bytes);
+int parseLine(char* line,Arena* arena,Pipeline* pipeline);
+int execute(Pipeline* pipeline);
+int shellExecute(Pipeline* pipeline);
+pid_t launchProcess(Stage* stage,int in_fd,int out_fd,pid_t pgid);
+void initShell();
+void onSigchld(int sig);
+int readChar();
+char* describe(Pipeline* pipeline);
+Job* addJob(Pipeline* pipeline,pid_t* pids,int noOfPids,pid_t pgid);
+void removeJob(Job* job);
+int jobState(Job* job);
+Job* findJob(char* spec);
+void updateProcess(pid_t pid,int status);
+void reapChildren();
+void notifyJobs();
+void waitForJob(Job* job);
+void continueJob(Job* job);
+char* findCommand(char* name);
+void forgetCommand(char* name);
+void forgetCommands();
 int executeCd(char** args);
 int executeExit(char** args);
 int executeHelp(char** args);
+int executeHash(char** args);
+int executeJobs(char** args);
+int executeFg(char** args);
+int executeBg(char** args);
+int executeWait(char** args);
 void printError(char* errMsg);
 
 //built-in commands for parent process
 char* builtIns[] = {
     "cd",
     "exit",
-    "help"
+    "help",
+    "hash",
+    "jobs",
+    "fg",
+    "bg",
+    "wait"
 };
 
 //functions to execute for built-in commands
 int (*builtInFuncs[])(char**)={
     &executeCd,
     &executeExit,
-    &executeHelp
+    &executeHelp,
+    &executeHash,
+    &executeJobs,
+    &executeFg,
+    &executeBg,
+    &executeWait
 };
 
+extern char** environ;
+
+//command name -> full path, so that PATH is not searched again
+//for every command, emptied by hash -r or when PATH changes
+PathEntry* pathTable[HASH_SIZE];
+char* hashedPath = NULL;//PATH the table was filled from
+
+Job* jobs = NULL;   //job table, in order of id
+int interactive = 0;//input is a terminal, there is job control on it
+int sigPipe[2];     //written by the SIGCHLD handler
+
 //print Error message in shell
 void printError(char* errMsg)
 {
@@ -41,104 +150,67 @@ void printError(char* errMsg)
 int main()
 {
     int status;//status code
-    char* line;
-    int pipeProcesses=0;//no of commands separated by pipes
-    char** pipeCommands;//N commands separated by N-1 pipes
-    char** args;        //args to pass for execution
-    int noOfTokens;     //no of tokens in one command
+    char* line = NULL;//kept and reused for every line
+    int bufsize = 0;  //size of line
+    Arena arena = {NULL, 0, 0};//parsing memory, reused for every line
+    Pipeline pipeline;//parsed line
+    initShell();
     do
     {
-        line = (char*)malloc(sizeof(char)*BUF_SIZE);
+        notifyJobs();
         printf("\n>>> ");
-        status = readCommand(line);
-        //split line into commands which are separated by |
-        pipeCommands = splitPipes(line,&pipeProcesses);
-        if(pipeProcesses==1)
-        {
-            //split command into tokens
-            args = splitCommand(line,&noOfTokens);
-            if(args!=NULL&&noOfTokens>0)
-                status = execute(args,noOfTokens);
-        }
-        else if(pipeProcesses>1)
-        {
-            int i, in_fd = 0;int pipeError=0;
-            int FD[2];//store the read and write file descripters
-            for(i = 0; i < pipeProcesses - 1; i++)
-            {
-                if(pipe(FD)==-1)
-                {
-                    pipeError=1;
-                    printError("Error: Error in piping\n");
-                    break;
-                }
-                else
-                {
-                    args = splitCommand(pipeCommands[i], &noOfTokens);
-                    //execute pipe process and write to FD[1]
-                    if(noOfTokens>0)
-                    {
-                        status = shellExecute(args, noOfTokens, in_fd, FD[1]);
-                    }
-                    else
-                    {
-                        pipeError=1;
-                        printError("Error: Syntax error\n");
-                        break;
-                    }
-                    close(FD[1]);
-                    //set the in file descriptor for next command as FD[0]
-                    in_fd = FD[0];
-                }
-            }
-            if(!pipeError)
-            {
-                args = splitCommand(pipeCommands[i], &noOfTokens);
-                if(noOfTokens>0)
-                {
-                    status = shellExecute(args, noOfTokens, in_fd, 1); 
-                } 
-                else
-                {
-                    pipeError=1;
-                    printError("Error: Syntax error\n");
-                    break;
-                }  
-            }
-        }
-        free(line);
-        free(args);
-        fflush(stdin);
+        fflush(stdout);
+        status = readCommand(&line,&bufsize);
+        if(status!=EXIT_SUCCESS)
+            break;
+        //split line into stages, arguments and redirections
+        if(parseLine(line,&arena,&pipeline)==0&&pipeline.noOfStages>0)
+            status = execute(&pipeline);
         fflush(stdout);
     } while (status==EXIT_SUCCESS);
     //loop runs as long as status is EXIT_SUCCESS
+    free(line);
+    free(arena.buf);
 }
-//read one line of command from shell
-int readCommand(char* line)
+//read one line of command from shell into *line,
+//which grows as needed and is kept for the next line
+//returns EXIT_FAILURE at the end of the input
+int readCommand(char** line,int* bufsize)
 {
-    char c;
+    int c;
     int position = 0;
-    //maximum length of command line
-    int bufsize = BUF_SIZE;
-    
+    if(*line == NULL)
+    {
+        *bufsize = BUF_SIZE;
+        *line = (char*)malloc(*bufsize);
+        if(*line == NULL)
+        {
+            printError("Error: failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     while(1)
     {
-        c = getchar();
+        c = readChar();
+        //nothing more to read, leave the shell
+        if(c == EOF && position == 0)
+            return EXIT_FAILURE;
         //read till EOF or newline encountered
         if(c == EOF || c == '\n')
         {
-            line[position] = '\0';
+            (*line)[position] = '\0';
             return EXIT_SUCCESS;
         }
-        line[position] = c;
+        (*line)[position] = c;
         position++;
 
-        if(position >= bufsize)
+        if(position >= *bufsize)
         {
             //reallocate memory if length of command exceeds bufsize
-            bufsize+=BUF_SIZE;
-            line = (char*)realloc(line, bufsize);
-            if(line == NULL)
+            *bufsize *= 2;
+            *line = (char*)realloc(*line, *bufsize);
+            if(*line == NULL)
             {
                 printError("Error: failed to allocate memory\n");
                 exit(EXIT_FAILURE);
@@ -146,309 +218,733 @@ int readCommand(char* line)
         }
     }
 }
-//split one line into piped commands
-//pipeProcesses stores no of piped processes
-char** splitPipes(char* line,int* pipeProcesses)
+//empty the arena and make sure it holds at least bytes
+void arenaReset(Arena* arena,size_t bytes)
 {
-	*pipeProcesses = 0;
-	int bufsize=BUF_SIZE;
-    //commands is an array of pipe separated commands
-	char** commands=(char**)malloc(sizeof(char*) * BUF_SIZE);
-    int lineLength = strlen(line);
-    if(commands==NULL)
+    arena->used = 0;
+    if(arena->size >= bytes)
+        return;
+    free(arena->buf);
+    arena->buf = (char*)malloc(bytes);
+    if(arena->buf == NULL)
     {
         printError("Error: failed to allocate memory\n");
         exit(EXIT_FAILURE);
     }
-    for(int i=0;i<bufsize;i++)
+    arena->size = bytes;
+}
+//take bytes from the arena, aligned for any pointer
+void* arenaAlloc(Arena* arena,size_t bytes)
+{
+    bytes = (bytes + 15) & ~(size_t)15;
+    if(arena->used + bytes > arena->size)
     {
-        commands[i]=(char*)malloc(sizeof(char)*lineLength);
-        if(commands[i]==NULL)
-        {
-            printError("Error: failed to allocate memory\n");
-            exit(EXIT_FAILURE);
-        }
+        printError("Error: failed to allocate memory\n");
+        exit(EXIT_FAILURE);
     }
-    int j=0;int commandIndex=0;
-    unsigned char p = '|';//pipe character
-    unsigned char lapo = '\'';//left apostrophe
-    unsigned char dapo = '\"';//double apostrophe
-    for(int i=0;i<lineLength; )
+    void* p = arena->buf + arena->used;
+    arena->used += bytes;
+    return p;
+}
+//check for whitespace or carriage return or end of line
+int isSpace(char c)
+{
+    return c==' '||c=='\t'||c=='\r'||c=='\a'||c=='\n';
+}
+//split line into stages separated by |, each with its arguments
+//and < > redirections, and note a final &
+//words are terminated and unquoted in place in line, only the
+//Stage and argv arrays are taken from the arena
+//returns 0 on success and -1 on a syntax error
+int parseLine(char* line,Arena* arena,Pipeline* pipeline)
+{
+    int lineLength = strlen(line);
+    //a line of n characters has at most n words and n+1 stages,
+    //every stage taking one more argv slot for its NULL
+    arenaReset(arena, (lineLength + 1) * sizeof(Stage) + (2 * lineLength + 2) * sizeof(char*) + 32);
+    pipeline->stages = (Stage*)arenaAlloc(arena, (lineLength + 1) * sizeof(Stage));
+    char** slots = (char**)arenaAlloc(arena, (2 * lineLength + 2) * sizeof(char*));
+    int noOfSlots = 0;
+    pipeline->noOfStages = 0;
+    pipeline->background = 0;
+
+    Stage* stage = &pipeline->stages[0];
+    stage->argv = slots;
+    stage->argc = 0;
+    stage->inFile = stage->outFile = NULL;
+    char redirect = 0;//< or > still waiting for its file
+    char held = 0;    //| < > or & that ended a word and was overwritten by its '\0'
+    char* r = line;   //read position
+    while(1)
     {
-        //if double quote encountered loop till next double quote
-        if(line[i]==dapo)
+        char c;
+        if(held)
         {
-            commands[commandIndex][j]=line[i];
-            i++;j++;
-            while(line[i]!=dapo&&i<lineLength)
-            {
-                commands[commandIndex][j]=line[i];
-                i++;j++;
-            }
-            commands[commandIndex][j]=line[i];
-            j++;i++;
-        }//if single quote encountered loop till next single quote
-        else if(line[i]==lapo)
+            c = held;
+            held = 0;
+        }
+        else
+        {
+            while(isSpace(*r))
+                r++;
+            c = *r;
+        }
+        if(c=='\0')
+            break;
+        //& may only end the line
+        if(pipeline->background)
         {
-            commands[commandIndex][j]=line[i];
-            i++;j++;
-            while(line[i]!=lapo&&i<lineLength)
+            printError("Error: Syntax error\n");
+            return -1;
+        }
+        if(c=='|')
+        {
+            //pipe after an empty command or a missing file
+            if(redirect||stage->argc==0)
             {
-                commands[commandIndex][j]=line[i];
-                i++;j++;
+                printError("Error: Syntax error\n");
+                return -1;
             }
-            commands[commandIndex][j]=line[i];
-            j++;i++;
-        }//if pipe encountered increase commandIndex
-        else if(line[i]==p)
+            slots[noOfSlots++] = NULL;
+            pipeline->noOfStages++;
+            stage = &pipeline->stages[pipeline->noOfStages];
+            stage->argv = slots + noOfSlots;
+            stage->argc = 0;
+            stage->inFile = stage->outFile = NULL;
+            r++;
+            continue;
+        }
+        if(c=='<'||c=='>'||c=='&')
         {
-            if(strlen(commands[commandIndex])<=0)
+            if(redirect)
             {
-                fprintf(stderr,"Error: Syntax error\n");
-                *pipeProcesses=0;
-                return NULL;
+                printError("Error: Syntax error\n");
+                return -1;
             }
-            commandIndex++;
-            if(commandIndex>=bufsize)
+            if(c=='&')
+                pipeline->background = 1;
+            else
+                redirect = c;
+            r++;
+            continue;
+        }
+        //a word: runs till unquoted whitespace or | < > &
+        //removing quotes only ever moves it to the left, so w never passes r
+        char* word = r;
+        char* w = r;//write position
+        while(*r!='\0'&&!isSpace(*r)&&*r!='|'&&*r!='<'&&*r!='>'&&*r!='&')
+        {
+            if(*r=='\"'||*r=='\'')
             {
-                bufsize+=BUF_SIZE;
-                commands=(char**)realloc(commands,sizeof(char*)*bufsize);
-                if(commands==NULL)
+                char quote = *r;
+                //argument in double quotes can't be passed to awk command
+                if(quote=='\"'&&stage->argc>0&&strncmp(stage->argv[stage->argc-1],"awk",3)==0)
+                {
+                    printError("Error: Syntax error\n");
+                    return -1;
+                }
+                r++;
+                while(*r!='\0'&&*r!=quote)
+                    *w++ = *r++;
+                if(*r!=quote)
                 {
-                    printError("Error: failed to allocate memory\n");
-                    exit(EXIT_FAILURE);
+                    printError("Error: Syntax error\n");
+                    return -1;
                 }
+                r++;
             }
-            i++;j=0;
-        }//if any other character just add it to currrent command
+            else
+                *w++ = *r++;
+        }
+        c = *r;
+        *w = '\0';
+        if(c!='\0')
+        {
+            if(isSpace(c))
+                r++;
+            else
+                held = c;
+        }
+        if(redirect=='<')
+            stage->inFile = word;
+        else if(redirect=='>')
+            stage->outFile = word;
         else
         {
-            commands[commandIndex][j]=line[i];
-            i++;j++;
+            slots[noOfSlots++] = word;
+            stage->argc++;
         }
+        redirect = 0;
     }
-
-    *pipeProcesses=commandIndex+1;
-	commands[*pipeProcesses]=NULL;
-	return commands;
-}
-//split command into tokens 
-//which will be used as arguments for calling execvp
-char** splitCommand(char* command,int *noOfTokens)
-{
-    *noOfTokens = 0;
-    int isTokenAwk;
-    int bufsize=BUF_SIZE;
-    int commandLength = strlen(command);
-    //tokens is an array of tokens in the command
-    char** tokens=(char**)malloc(sizeof(char*) * BUF_SIZE);
-    if(tokens==NULL)
+    if(stage->argc==0)
     {
-        printError("Error: failed to allocate memory\n");
-        exit(EXIT_FAILURE);
+        //an empty line is fine, a line ending in | < > or & is not
+        if(pipeline->noOfStages==0&&!redirect&&!pipeline->background&&!stage->inFile&&!stage->outFile)
+            return 0;
+        printError("Error: Syntax error\n");
+        return -1;
     }
-    for(int i = 0; i < BUF_SIZE; i++)
+    if(redirect)
     {
-        tokens[i] = (char*)malloc(sizeof(char) * commandLength);
-        if(tokens[i]==NULL)
-        {
-            printError("Error: failed to allocate memory\n");
-            exit(EXIT_FAILURE);
-        }
+        printError("Error: Syntax error\n");
+        return -1;
     }
-    int i, j, commIndex = 0;
-    int len = strlen(command);
-    for(i = 0; i < len; )
+    slots[noOfSlots++] = NULL;
+    pipeline->noOfStages++;
+    return 0;
+}
+//take a parsed command line
+//and execute it in shell
+int execute(Pipeline* pipeline)
+{
+    char** args = pipeline->stages[0].argv;
+    //compare command with a built-in command
+    //need to execute separately
+    if(pipeline->noOfStages==1)
     {
-        unsigned char sp = ' ';//space
-        unsigned char n = '\n';//newline
-        unsigned char lapo = '\'';//left apostrophe
-        //if any whitespace or carriage return or end of line encountered then increase noOfTokens
-        if(command[i]== sp ||command[i]=='\t'||command[i]=='\r'||command[i]=='\a'||command[i]== n)
+        for(int i=0;i<BUILT_INS;i++)
         {
-            if(strlen(tokens[(*noOfTokens)]) > 0)
+            if(strcmp(builtIns[i],args[0])==0)
             {
-                (*noOfTokens)++;
+                return (*builtInFuncs[i])(args);
             }
-            commIndex = 0;
-            i++;
-        }//if double quote encountered read till next double quote
-        else if(command[i]=='\"')
+        }
+    }
+    //if no built-in command call shellExecute
+    return shellExecute(pipeline);
+}
+//execute N commands connected by N-1 pipes
+//every stage is forked first, into one process group,
+//so that all of them run at the same time, then all are waited for
+int shellExecute(Pipeline* pipeline)
+{
+    int noOfStages = pipeline->noOfStages;
+    pid_t* pids = (pid_t*)malloc(sizeof(pid_t)*noOfStages);
+    if(pids==NULL)
+    {
+        printError("Error: failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    int i, launched = 0;
+    int in_fd = 0, out_fd;
+    int FD[2];//store the read and write file descripters
+    pid_t pgid = 0;//pid of the first stage, leader of the group
+    for(i = 0; i < noOfStages; i++)
+    {
+        out_fd = 1;
+        if(i < noOfStages - 1)
         {
-            //argument in double quotes can't be passed to awk command
-            if(tokens[(*noOfTokens) - 1][0] == 'a' && tokens[(*noOfTokens) - 1][1] == 'w' && tokens[(*noOfTokens) - 1][2] == 'k')
-            {   
-                fprintf(stderr,"Error: Syntax error\n");
-                return NULL;
-            }
-            commIndex = 0;
-            j = i+1;
-            while(j < len && command[j] != '\"')
+            if(pipe(FD)==-1)
             {
-                tokens[(*noOfTokens)][commIndex] = command[j];
-                commIndex++;
-                j++;
+                printError("Error: Error in piping\n");
+                break;
             }
-            if(strlen(tokens[(*noOfTokens)]) > 0)
-            {
-                (*noOfTokens)++;
-            }
-            commIndex = 0;
-            i = j+1;
-        }//if single quote encountered read till next single quote
-        else if(command[i]==lapo)
+            //a stage must not inherit pipe ends it does not use, else
+            //its reader never sees EOF or its writer never gets SIGPIPE
+            fcntl(FD[0], F_SETFD, FD_CLOEXEC);
+            fcntl(FD[1], F_SETFD, FD_CLOEXEC);
+            out_fd = FD[1];
+        }
+        //a stage that cannot start is left out, its neighbours see EOF or SIGPIPE
+        pids[launched] = launchProcess(&pipeline->stages[i], in_fd, out_fd, pgid);
+        if(pids[launched]!=-1)
         {
-            commIndex = 0;
-            j = i+1;
-            while(j < len && command[j] != lapo)
-            {
-                tokens[(*noOfTokens)][commIndex] = command[j];
-                commIndex++;
-                j++; 
-            }
-            if(strlen(tokens[(*noOfTokens)]) > 0)
-            {
-                (*noOfTokens)++;
-            }
-            commIndex = 0;
-            i = j+1;
-        }//any other character encountered add to current tokens index   
+            if(pgid==0)
+                pgid = pids[launched];
+            launched++;
+        }
+        //the ends now belong to the stages, the shell closes its copies
+        if(in_fd!=0)
+            close(in_fd);
+        if(out_fd!=1)
+            close(out_fd);
+        in_fd = (i < noOfStages - 1) ? FD[0] : 0;
+    }
+    if(in_fd!=0)
+        close(in_fd);
+    if(launched==0)
+    {
+        free(pids);
+        return EXIT_SUCCESS;
+    }
+    //wait for the whole pipeline unless it ends with &
+    Job* job = addJob(pipeline, pids, launched, pgid);
+    if(!pipeline->background)
+        waitForJob(job);
+    else if(interactive)
+        printf("[%d] %d\n", job->id, (int)pgid);
+    return EXIT_SUCCESS;
+}
+//start the command of stage with stdin on in_fd and stdout on out_fd,
+//in process group pgid (its own group if 0) when there is job control,
+//and return its pid without waiting for it, or -1 if it could not be started
+//posix_spawn runs the child on the shell's memory until it execs (vfork),
+//so no page tables are copied however large the shell has grown
+pid_t launchProcess(Stage* stage,int in_fd,int out_fd,pid_t pgid)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    posix_spawn_file_actions_init(&actions);
+    //move in_fd to 0 and out_fd to 1, the < and > files go over them
+    if(in_fd!=0)
+        posix_spawn_file_actions_adddup2(&actions,in_fd,STDIN_FILENO);
+    if(out_fd!=1)
+        posix_spawn_file_actions_adddup2(&actions,out_fd,STDOUT_FILENO);
+    if(stage->inFile!=NULL)
+        posix_spawn_file_actions_addopen(&actions,STDIN_FILENO,stage->inFile,O_RDONLY,0);
+    if(stage->outFile!=NULL)
+        posix_spawn_file_actions_addopen(&actions,STDOUT_FILENO,stage->outFile,O_CREAT | O_TRUNC | O_WRONLY,0666);
+    //join the group and undo what only the shell ignores, without job
+    //control the stages stay in the shell's group, so that Ctrl+C from
+    //the terminal the shell was started on still reaches them
+    posix_spawnattr_init(&attr);
+    short flags = POSIX_SPAWN_SETSIGDEF;
+    if(interactive)
+    {
+        posix_spawnattr_setpgroup(&attr,pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    sigemptyset(&defaults);
+    sigaddset(&defaults,SIGTTOU);
+    sigaddset(&defaults,SIGTSTP);
+    sigaddset(&defaults,SIGTTIN);
+    posix_spawnattr_setsigdefault(&attr,&defaults);
+    posix_spawnattr_setflags(&attr,flags);
+
+    pid_t pid = -1;
+    int err = ENOENT;
+    char* path = findCommand(stage->argv[0]);
+    if(path!=NULL)
+    {
+        err = posix_spawn(&pid,path,&actions,&attr,stage->argv,environ);
+        //the remembered file may be gone, search PATH once more
+        if(err==ENOENT&&path!=stage->argv[0]&&access(path,X_OK)!=0)
+        {
+            forgetCommand(stage->argv[0]);
+            path = findCommand(stage->argv[0]);
+            if(path!=NULL)
+                err = posix_spawn(&pid,path,&actions,&attr,stage->argv,environ);
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if(path==NULL)
+    {
+        fprintf(stderr,"Error: failed to execute command\n");
+        return -1;
+    }
+    if(err!=0)
+    {
+        if(stage->inFile!=NULL&&access(stage->inFile,R_OK)!=0)
+            fprintf(stderr,"Error: cannot open %s\n",stage->inFile);
         else
+            fprintf(stderr,"Error: cannot run %s: %s\n",stage->argv[0],strerror(err));
+        return -1;
+    }
+    return pid;
+}
+//number of the pathTable list holding name
+unsigned int hashName(char* name)
+{
+    unsigned int h = 5381;
+    while(*name)
+        h = h * 33 + (unsigned char)*name++;
+    return h % HASH_SIZE;
+}
+//full path of command name: name itself if it has a /, else the
+//first executable file called name in a directory of PATH, NULL if none
+//found paths are remembered in pathTable until PATH changes or hash -r
+char* findCommand(char* name)
+{
+    if(strchr(name,'/')!=NULL)
+        return name;
+    char* path = getenv("PATH");
+    if(path==NULL)
+        path = "/bin:/usr/bin";
+    if(hashedPath==NULL||strcmp(hashedPath,path)!=0)
+    {
+        forgetCommands();
+        hashedPath = strdup(path);
+    }
+    unsigned int h = hashName(name);
+    for(PathEntry* entry = pathTable[h]; entry != NULL; entry = entry->next)
+    {
+        if(strcmp(entry->name,name)==0)
         {
-            tokens[(*noOfTokens)][commIndex] = command[i];
-            commIndex++;
-            if(i == len - 1)
+            entry->hits++;
+            return entry->path;
+        }
+    }
+    //search the directories of PATH in order, like execvp
+    int nameLength = strlen(name);
+    char* dir = path;
+    while(1)
+    {
+        char* end = strchr(dir,':');
+        int dirLength = end ? end - dir : (int)strlen(dir);
+        char* full = (char*)malloc(dirLength + nameLength + 3);
+        if(full==NULL)
+        {
+            printError("Error: failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        //an empty directory in PATH is the current one
+        if(dirLength==0)
+            sprintf(full,"./%s",name);
+        else
+            sprintf(full,"%.*s/%s",dirLength,dir,name);
+        struct stat st;
+        if(stat(full,&st)==0&&S_ISREG(st.st_mode)&&access(full,X_OK)==0)
+        {
+            //a path relative to the current directory is not remembered,
+            //it changes meaning with cd
+            if(full[0]!='/')
             {
-                if(strlen(tokens[(*noOfTokens)]) > 0)
-                {
-                    (*noOfTokens)++;
-                }
+                free(full);
+                return name;
             }
-            i++;
-        }//reallocate memory if noOfTokens exceed current bufsize
-        if((*noOfTokens)>=bufsize)
-        {
-            bufsize+=BUF_SIZE;
-            tokens=(char**)realloc(tokens,sizeof(char*)*bufsize);
-            if(tokens==NULL)
+            PathEntry* entry = (PathEntry*)malloc(sizeof(PathEntry));
+            if(entry==NULL)
             {
                 printError("Error: failed to allocate memory\n");
                 exit(EXIT_FAILURE);
             }
-        }   
+            entry->name = strdup(name);
+            entry->path = full;
+            entry->hits = 1;
+            entry->next = pathTable[h];
+            pathTable[h] = entry;
+            return full;
+        }
+        free(full);
+        if(end==NULL)
+            return NULL;
+        dir = end + 1;
     }
-    return tokens;
 }
-//take a command along with its arguments in args
-//and execute it in shell
-int execute(char** args,int noOfArgs)
+//drop the remembered path of command name
+void forgetCommand(char* name)
 {
-    if(args[0]==NULL)//exit if no command
-        return EXIT_SUCCESS;
-    else
+    PathEntry** link = &pathTable[hashName(name)];
+    while(*link!=NULL)
     {
-        //compare command with a built-in command
-        //need to execute separately
-        for(int i=0;i<BUILT_INS;i++)
+        PathEntry* entry = *link;
+        if(strcmp(entry->name,name)==0)
         {
-            if(strcmp(builtIns[i],args[0])==0)
-            {
-                return (*builtInFuncs[i])(args);
-            }
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
         }
-        //if no built-in command call shellExecute
-        return shellExecute(args, noOfArgs, 0, 1);
+        link = &entry->next;
     }
 }
-//execute one command taking command in args
-//and input file descriptor in in_fd, output file descriptor in out_fd
-int shellExecute(char** args,int noOfArgs,int in_fd,int out_fd)
+//drop all remembered paths
+void forgetCommands()
 {
-    pid_t pid, wpid;
-    int status;
-    pid = fork();//create a child process
-    char* arg;
-    if(pid==0)//Child Process
+    for(int i=0;i<HASH_SIZE;i++)
     {
-        //move in_fd to 0(redirect stdin to in_fd)
-        if(in_fd!=0)
+        while(pathTable[i]!=NULL)
         {
-            dup2(in_fd,0);
-            close(in_fd);
+            PathEntry* entry = pathTable[i];
+            pathTable[i] = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
         }
-        //move out_fd to 1(redirect stdout to out_fd)
-        if(out_fd!=1)
+    }
+    free(hashedPath);
+    hashedPath = NULL;
+}
+//put the shell in the foreground of the terminal in a process group
+//of its own, and have SIGCHLD wake up readChar through sigPipe
+void initShell()
+{
+    interactive = isatty(STDIN_FILENO);
+    if(interactive)
+    {
+        //started in the background: wait until we are given the terminal
+        while(tcgetpgrp(STDIN_FILENO)!=getpgrp())
+            kill(-getpgrp(),SIGTTIN);
+        //Ctrl+Z and reading the terminal are for the jobs, not the shell
+        signal(SIGTSTP,SIG_IGN);
+        signal(SIGTTIN,SIG_IGN);
+        setpgid(0,0);
+        tcsetpgrp(STDIN_FILENO,getpgrp());
+    }
+    //the shell takes the terminal back from finished process groups
+    signal(SIGTTOU,SIG_IGN);
+    if(pipe(sigPipe)==-1)
+    {
+        printError("Error: Error in piping\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int i=0;i<2;i++)
+    {
+        fcntl(sigPipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(sigPipe[i], F_SETFL, O_NONBLOCK);
+    }
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler = onSigchld;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD,&sa,NULL);
+}
+//SIGCHLD handler, only wakes up the shell: the job table
+//is changed outside of signal handlers by reapChildren
+void onSigchld(int sig)
+{
+    int savedErrno = errno;
+    char c = 0;
+    if(write(sigPipe[1],&c,1)==-1)
+    {
+        //pipe full, the shell is already going to reap
+    }
+    errno = savedErrno;
+}
+//next character of the input or EOF, reaping the children
+//that finish or stop while the shell waits for input
+int readChar()
+{
+    static char inBuf[BUF_SIZE * 32];
+    static int inPos = 0, inLen = 0;
+    while(inPos == inLen)
+    {
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {sigPipe[0], POLLIN, 0}};
+        if(poll(fds, 2, -1) == -1)
         {
-            dup2(out_fd,1);
-            close(out_fd);
+            if(errno == EINTR)
+                continue;
+            return EOF;
         }
-        int mainCommand = 0;int firstSymbolFound=0;
-        //mainCommand is the command before any < > or & character
-        //firstSymbolFound is flag to check if any < > or & symbol is found or not
-        for(int i=0;i<noOfArgs;i++)
+        if(fds[1].revents & POLLIN)
         {
-            arg=args[i];
-            if(!firstSymbolFound)
-            {
-                if(strcmp(arg,"&")==0||strcmp(arg,"<")==0||strcmp(arg,">")==0)
-                {
-                    mainCommand=i;//mainCommand length is i
-                    firstSymbolFound=1;//first < > or & symbol has been found
-                }
-            }
-            if(strcmp(arg,">")==0)//output redirection
-            {
-                //open file to write
-                int redirect_out_fd = open(args[i+1],O_CREAT | O_TRUNC | O_WRONLY, 0666);
-                //redirect stdout to redirect_out_fd
-                dup2(redirect_out_fd,STDOUT_FILENO);
-            }
-            if(strcmp(arg,"<")==0)
-            {
-                //open file to read from
-                int redirect_in_fd = open(args[i+1],O_RDONLY);
-                //redirect stdin to redirect_in_fd
-                dup2(redirect_in_fd,STDIN_FILENO);
-            }
+            char drain[64];
+            while(read(sigPipe[0], drain, sizeof(drain)) > 0)
+                ;
+            reapChildren();
         }
-        if(!firstSymbolFound)
-            mainCommand=noOfArgs;
-        char** args2 = (char**)malloc(sizeof(char*)*(mainCommand+1));
-        if(args2==NULL)
+        if(fds[0].revents & (POLLIN | POLLHUP | POLLERR))
         {
-            fprintf(stderr,"Error: failed to allocate memory\n");
-            exit(EXIT_FAILURE);
+            int n = read(STDIN_FILENO, inBuf, sizeof(inBuf));
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return EOF;
+            inPos = 0;
+            inLen = n;
         }
-        int i;
-        for(i=0;i<mainCommand;i++)
+    }
+    return (unsigned char)inBuf[inPos++];
+}
+//command line of a job as it is shown by jobs, fg and bg
+char* describe(Pipeline* pipeline)
+{
+    int length = 1;
+    for(int i=0;i<pipeline->noOfStages;i++)
+    {
+        Stage* stage = &pipeline->stages[i];
+        for(int j=0;j<stage->argc;j++)
+            length += strlen(stage->argv[j]) + 1;
+        if(stage->inFile!=NULL)
+            length += strlen(stage->inFile) + 3;
+        if(stage->outFile!=NULL)
+            length += strlen(stage->outFile) + 3;
+        length += 3;
+    }
+    char* command = (char*)malloc(length);
+    if(command==NULL)
+    {
+        printError("Error: failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    char* p = command;
+    for(int i=0;i<pipeline->noOfStages;i++)
+    {
+        Stage* stage = &pipeline->stages[i];
+        if(i>0)
+            p += sprintf(p," | ");
+        for(int j=0;j<stage->argc;j++)
+            p += sprintf(p,j ? " %s" : "%s",stage->argv[j]);
+        if(stage->inFile!=NULL)
+            p += sprintf(p," < %s",stage->inFile);
+        if(stage->outFile!=NULL)
+            p += sprintf(p," > %s",stage->outFile);
+    }
+    return command;
+}
+//enter the launched processes of pipeline in the job table,
+//the job takes over pids
+Job* addJob(Pipeline* pipeline,pid_t* pids,int noOfPids,pid_t pgid)
+{
+    Job* job = (Job*)malloc(sizeof(Job));
+    int* states = (int*)calloc(noOfPids,sizeof(int));
+    if(job==NULL||states==NULL)
+    {
+        printError("Error: failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    Job** last = &jobs;
+    int id = 1;
+    while(*last!=NULL)
+    {
+        id = (*last)->id + 1;
+        last = &(*last)->next;
+    }
+    job->id = id;
+    job->pgid = pgid;
+    job->pids = pids;
+    job->states = states;
+    job->noOfPids = noOfPids;
+    job->background = pipeline->background;
+    job->changed = 0;
+    job->command = describe(pipeline);
+    job->next = NULL;
+    *last = job;
+    return job;
+}
+//take job out of the table and free it
+void removeJob(Job* job)
+{
+    Job** link = &jobs;
+    while(*link!=job)
+        link = &(*link)->next;
+    *link = job->next;
+    free(job->pids);
+    free(job->states);
+    free(job->command);
+    free(job);
+}
+//JOB_DONE when all processes of job have finished, JOB_STOPPED
+//when any of them is stopped and JOB_RUNNING otherwise
+int jobState(Job* job)
+{
+    int done = 1;
+    for(int i=0;i<job->noOfPids;i++)
+    {
+        if(job->states[i]==PROC_STOPPED)
+            return JOB_STOPPED;
+        if(job->states[i]!=PROC_DONE)
+            done = 0;
+    }
+    return done ? JOB_DONE : JOB_RUNNING;
+}
+//job given as %n or n, the latest job if spec is NULL
+Job* findJob(char* spec)
+{
+    Job* found = NULL;
+    int id = -1;
+    if(spec!=NULL)
+        id = atoi(spec[0]=='%' ? spec + 1 : spec);
+    for(Job* job = jobs; job != NULL; job = job->next)
+    {
+        if(id==-1||job->id==id)
+            found = job;
+    }
+    return found;
+}
+//record what waitpid reported about process pid
+void updateProcess(pid_t pid,int status)
+{
+    for(Job* job = jobs; job != NULL; job = job->next)
+    {
+        for(int i=0;i<job->noOfPids;i++)
         {
-            args2[i]=args[i];
+            if(job->pids[i]==pid)
+            {
+                int before = jobState(job);
+                job->states[i] = WIFSTOPPED(status) ? PROC_STOPPED : PROC_DONE;
+                int after = jobState(job);
+                //done and stopped jobs are reported at the next prompt
+                if(after!=before&&after!=JOB_RUNNING)
+                    job->changed = 1;
+                return;
+            }
         }
-        args2[i]=NULL;
-        //execute the command by allocating child process address space & pid 
-        //to new process by using execvp
-        if(execvp(args2[0],args2)==-1)
+    }
+}
+//collect every child that has finished or stopped, so that
+//no zombies are left however many background jobs are started
+void reapChildren()
+{
+    int status;
+    pid_t pid;
+    while((pid = waitpid(-1,&status,WNOHANG | WUNTRACED))>0)
+        updateProcess(pid,status);
+}
+//report jobs that finished or stopped since the last prompt
+//and remove the finished ones
+void notifyJobs()
+{
+    reapChildren();
+    Job* job = jobs;
+    while(job!=NULL)
+    {
+        Job* next = job->next;
+        if(job->changed)
         {
-            fprintf(stderr,"Error: failed to execute command\n");
-            exit(EXIT_FAILURE);
+            int state = jobState(job);
+            if(interactive)
+                printf("[%d]  %s\t\t%s\n",job->id,state==JOB_DONE ? "Done" : "Stopped",job->command);
+            job->changed = 0;
+            if(state==JOB_DONE)
+                removeJob(job);
         }
-    }//error in forking
-    else if(pid<0)
-    {
-        fprintf(stderr,"Error: error in forking\n");
-        exit(EXIT_FAILURE);
+        job = next;
     }
-    else//parent process
+}
+//hand the terminal to job, wait until all its processes have finished
+//or it is stopped, and take the terminal back
+//a finished job leaves the table, a stopped one stays in it
+void waitForJob(Job* job)
+{
+    int status;
+    pid_t pid;
+    job->background = 0;
+    if(interactive)
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    while(jobState(job)==JOB_RUNNING)
     {
-        //wait for completion of child process unless last character is &
-        if(strcmp(args[noOfArgs-1],"&")!=0)
+        //other jobs finishing meanwhile are recorded as well
+        pid = waitpid(-1,&status,WUNTRACED);
+        if(pid==-1)
         {
-            do{
-                wpid = waitpid(pid,&status,WUNTRACED);
-            }while(!WIFEXITED(status) && !WIFSIGNALED(status));
+            if(errno==EINTR)
+                continue;
+            break;
         }
+        updateProcess(pid,status);
+    }
+    if(interactive)
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    if(jobState(job)==JOB_STOPPED)
+    {
+        printf("\n[%d]  Stopped\t\t%s\n",job->id,job->command);
+        job->changed = 0;
+    }
+    else
+        removeJob(job);
+}
+//let the stopped processes of job run again
+void continueJob(Job* job)
+{
+    for(int i=0;i<job->noOfPids;i++)
+    {
+        if(job->states[i]==PROC_STOPPED)
+            job->states[i] = PROC_RUNNING;
+    }
+    job->changed = 0;
+    if(interactive)
+        kill(-job->pgid,SIGCONT);
+    else
+    {
+        //no group of its own, it shares the shell's
+        for(int i=0;i<job->noOfPids;i++)
+            kill(job->pids[i],SIGCONT);
     }
-    return EXIT_SUCCESS;
 }
 //change directory
 int executeCd(char** args)
@@ -483,4 +979,115 @@ int executeHelp(char** args)
 int executeExit(char** args)
 {
     return 1;
+}
+//list the remembered command paths, or forget them with hash -r
+int executeHash(char** args)
+{
+    if(args[1]!=NULL)
+    {
+        if(strcmp(args[1],"-r")==0)
+            forgetCommands();
+        else
+            printError("Error: usage: hash [-r]\n");
+        return EXIT_SUCCESS;
+    }
+    printf("hits\tcommand\n");
+    for(int i=0;i<HASH_SIZE;i++)
+    {
+        for(PathEntry* entry = pathTable[i]; entry != NULL; entry = entry->next)
+            printf("%4d\t%s\n",entry->hits,entry->path);
+    }
+    return EXIT_SUCCESS;
+}
+//list the jobs with their state, finished ones are then removed
+int executeJobs(char** args)
+{
+    char* states[] = {"Running", "Stopped", "Done"};
+    reapChildren();
+    Job* job = jobs;
+    while(job!=NULL)
+    {
+        Job* next = job->next;
+        int state = jobState(job);
+        printf("[%d]  %s\t\t%s%s\n",job->id,states[state],job->command,
+               state==JOB_RUNNING&&job->background ? " &" : "");
+        job->changed = 0;
+        if(state==JOB_DONE)
+            removeJob(job);
+        job = next;
+    }
+    return EXIT_SUCCESS;
+}
+//bring a job (the latest if none given) to the foreground and wait for it
+int executeFg(char** args)
+{
+    reapChildren();
+    Job* job = findJob(args[1]);
+    if(job==NULL||jobState(job)==JOB_DONE)
+    {
+        printError("Error: no such job\n");
+        return EXIT_SUCCESS;
+    }
+    printf("%s\n",job->command);
+    fflush(stdout);
+    if(interactive)
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    continueJob(job);
+    waitForJob(job);
+    return EXIT_SUCCESS;
+}
+//let a stopped job (the latest if none given) go on in the background
+int executeBg(char** args)
+{
+    reapChildren();
+    Job* job = findJob(args[1]);
+    if(job==NULL||jobState(job)==JOB_DONE)
+    {
+        printError("Error: no such job\n");
+        return EXIT_SUCCESS;
+    }
+    job->background = 1;
+    continueJob(job);
+    printf("[%d]  %s &\n",job->id,job->command);
+    return EXIT_SUCCESS;
+}
+//wait for a job, or for all running jobs if none given
+//the jobs waited for leave the table without a Done message
+int executeWait(char** args)
+{
+    Job* target = NULL;
+    if(args[1]!=NULL&&(target = findJob(args[1]))==NULL)
+    {
+        printError("Error: no such job\n");
+        return EXIT_SUCCESS;
+    }
+    while(1)
+    {
+        int running = 0;
+        for(Job* job = jobs; job != NULL; job = job->next)
+        {
+            if((target==NULL||job==target)&&jobState(job)==JOB_RUNNING)
+                running = 1;
+        }
+        if(!running)
+            break;
+        int status;
+        pid_t pid = waitpid(-1,&status,WUNTRACED);
+        if(pid==-1)
+        {
+            if(errno==EINTR)
+                continue;
+            break;
+        }
+        updateProcess(pid,status);
+    }
+    Job* job = jobs;
+    while(job!=NULL)
+    {
+        Job* next = job->next;
+        if((target==NULL||job==target)&&jobState(job)==JOB_DONE)
+            removeJob(job);
+        job = next;
+    }
+    return EXIT_SUCCESS;
 }
\ No newline at end of file
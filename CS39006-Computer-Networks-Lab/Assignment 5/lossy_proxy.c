@@ -0,0 +1,484 @@
+/**
+ *
+ *       Network Assignment-5
+ *
+ *     *--------------------------------*
+ *     *   Lossy UDP proxy for testing  *
+ *     *   the word protocol            *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @application: PROXY
+ *      @file:        lossy_proxy.c
+ *
+ *      How to run:
+ *      -----------
+ *      $ gcc lossy_proxy.c -o lossy_proxy
+ *      $ ./lossy_proxy [-l <loss %>] [-d <delay ms>] [-j <jitter ms>]
+ *                      [-o <reorder %>] [-r <rate>] [-Q <queue bytes>]
+ *                      [-p <port>] [-s <server port>] [-S <seed>]
+ *      $ ./wordclient -p 9090 ...
+ *
+ *      Sits between wordclient and wordserver on this
+ *      machine: datagrams to <port> (default 9090) go
+ *      on to the server at <server port> (default 8080)
+ *      and the replies come back.  Every client gets
+ *      its own socket towards the server, so the server
+ *      still sees one address per client.
+ *
+ *      Each direction is a link of its own (see LINKS)
+ *      on which a datagram is
+ *
+ *        -l  dropped with probability <loss %>
+ *        -r  sent at <rate> bytes/s (suffix k, m or g)
+ *            behind the datagrams before it, and
+ *            dropped when more than <queue bytes>
+ *            (default 256k) are waiting for that
+ *        -d  delivered <delay> ms later, give or take
+ *        -j  up to <jitter> ms but never before the
+ *            datagram in front of it, and
+ *        -o  with probability <reorder %> held back
+ *            2 ms more (REORDER_HOLD), to be overtaken.
+ *
+ *      Ctrl + C prints what was forwarded and dropped.
+ */
+
+#define _GNU_SOURCE
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define PROXY_PORT 9090
+#define SERVER_PORT 8080
+#define MAX_CLIENTS 1024
+#define FLOW_IDLE 60 // seconds before a client's socket is closed
+#define MAX_DGRAM 65536
+#define MAX_QUEUED 65536    // datagrams waiting for delivery
+#define QUEUE_BYTES (256 << 10)
+#define REORDER_HOLD 0.002  // seconds
+
+//----------- UTILITY FUNCTIONS ------------
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double loss = 0;    // probability of dropping a datagram
+double delay = 0;   // seconds
+double jitter = 0;  // seconds, either way
+double reorder = 0; // probability of holding a datagram back
+double rate = 0;    // bytes per second, 0 = unlimited
+long queue_bytes = QUEUE_BYTES;
+
+int dropped()
+{
+    return loss > 0 && drand48() < loss;
+}
+
+double parse_rate(const char *s)
+{
+    /**
+     * 500000, 500k, 12.5m, 1g
+     */
+    char *unit;
+    double r = strtod(s, &unit);
+    return r * (*unit == 'k' ? 1e3 : *unit == 'm' ? 1e6 : *unit == 'g' ? 1e9 : 1);
+}
+
+//----------- FLOWS ------------
+
+/**
+ * One flow per client address: the socket that is
+ * connected to the server on its behalf. pfds[0] is
+ * the proxy socket,  pfds[i + 1]  the socket of
+ * flows[i], so one poll() covers all of them.
+ */
+
+struct flow
+{
+    struct sockaddr_in client;
+    int fd;
+    double last_active;
+};
+
+struct flow flows[MAX_CLIENTS];
+struct pollfd pfds[MAX_CLIENTS + 1];
+int nflows = 0;
+
+volatile sig_atomic_t stop = 0;
+
+void on_sigint(int sig)
+{
+    stop = 1;
+}
+
+int flow_for(const struct sockaddr_in *client, const struct sockaddr_in *server)
+{
+    /**
+     * Index of the flow of the client, opening
+     * a new one (or reusing the one idle for the
+     * longest if all are taken) on first sight
+     */
+    int oldest = 0;
+    for (int i = 0; i < nflows; i++)
+    {
+        if (flows[i].client.sin_addr.s_addr == client->sin_addr.s_addr &&
+            flows[i].client.sin_port == client->sin_port)
+            return i;
+        if (flows[i].last_active < flows[oldest].last_active)
+            oldest = i;
+    }
+
+    int i = oldest;
+    if (nflows < MAX_CLIENTS)
+        i = nflows++;
+    else
+        close(flows[i].fd);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || connect(fd, (const struct sockaddr *)server, sizeof(*server)) < 0)
+    {
+        perror("\033[0;31mCould not open a socket to the server\033[0m\n");
+        exit(EXIT_FAILURE);
+    }
+    int rcvbuf = 4 << 20; // a whole window of replies, the proxy adds no loss of its own
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    flows[i].client = *client;
+    flows[i].fd = fd;
+    pfds[i + 1].fd = fd;
+    pfds[i + 1].events = POLLIN;
+    return i;
+}
+
+void flows_expire()
+{
+    double t = now();
+    for (int i = 0; i < nflows; i++)
+    {
+        if (t - flows[i].last_active < FLOW_IDLE)
+            continue;
+        close(flows[i].fd);
+        flows[i] = flows[--nflows];
+        pfds[i + 1] = pfds[nflows + 1];
+        i--;
+    }
+}
+
+//----------- LINKS ------------
+
+/**
+ * A datagram that is not lost waits in a heap
+ * ordered by the time it is due, ties broken by
+ * arrival, so without jitter the order is kept.
+ *
+ * The rate limit works like the queue in front of
+ * a slow link: free_at is when the link has sent
+ * everything accepted so far. A datagram leaves at
+ * max(now, free_at) + len / rate and is dropped if
+ * the backlog  (free_at - now) * rate  would go
+ * past queue_bytes. Delay, jitter and the reorder
+ * hold are added after that. Jitter alone keeps the
+ * order, like queueing on a real path does, only
+ * the datagrams held back by -o are overtaken.
+ */
+
+struct link
+{
+    const char *name;
+    double free_at;
+    double last_due;   // of the last datagram not held back
+    long forwarded, lost, overflow, reordered;
+};
+
+struct packet
+{
+    double due;
+    long seq;
+    int to_server;             // else to the client
+    struct sockaddr_in client;
+    int len;
+    char *data;
+};
+
+struct link up = {"To the server:  "}, down = {"To the clients: "};
+struct packet *heap;
+int queued = 0;
+long arrivals = 0;
+
+int packet_before(const struct packet *a, const struct packet *b)
+{
+    return a->due < b->due || (a->due == b->due && a->seq < b->seq);
+}
+
+void heap_push(struct packet p)
+{
+    int i = queued++;
+    while (i && packet_before(&p, &heap[(i - 1) / 2]))
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = p;
+}
+
+struct packet heap_pop()
+{
+    struct packet top = heap[0], last = heap[--queued];
+    int i = 0;
+    while (1)
+    {
+        int c = 2 * i + 1;
+        if (c >= queued)
+            break;
+        if (c + 1 < queued && packet_before(&heap[c + 1], &heap[c]))
+            c++;
+        if (!packet_before(&heap[c], &last))
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    if (queued)
+        heap[i] = last;
+    return top;
+}
+
+void link_send(struct link *l, int to_server, const struct sockaddr_in *client,
+               const char *buf, int len)
+{
+    /**
+     * Put a datagram on the link, or drop it
+     */
+    double t = now(), leave = t;
+    if (dropped())
+    {
+        l->lost++;
+        return;
+    }
+    if (rate > 0)
+    {
+        double start = l->free_at > t ? l->free_at : t;
+        if ((start - t) * rate + len > queue_bytes)
+        {
+            l->overflow++;
+            return;
+        }
+        l->free_at = start + len / rate;
+        leave = l->free_at;
+    }
+    if (queued == MAX_QUEUED)
+    {
+        l->overflow++;
+        return;
+    }
+
+    struct packet p;
+    p.due = leave + delay;
+    if (jitter > 0)
+        p.due += (2 * drand48() - 1) * jitter;
+    if (p.due < leave)
+        p.due = leave;
+    if (p.due < l->last_due)
+        p.due = l->last_due;
+    if (reorder > 0 && drand48() < reorder)
+    {
+        p.due += REORDER_HOLD;
+        l->reordered++;
+    }
+    else
+        l->last_due = p.due;
+    p.seq = arrivals++;
+    p.to_server = to_server;
+    p.client = *client;
+    p.len = len;
+    p.data = malloc(len);
+    memcpy(p.data, buf, len);
+    heap_push(p);
+}
+
+double deliver(int sockfd, const struct sockaddr_in *server)
+{
+    /**
+     * Send every datagram that is due and return
+     * the seconds until the next one, -1 if none
+     */
+    double t = now();
+    while (queued && heap[0].due <= t)
+    {
+        struct packet p = heap_pop();
+        if (p.to_server)
+        {
+            int i = flow_for(&p.client, server);
+            if (send(flows[i].fd, p.data, p.len, 0) >= 0)
+                up.forwarded++;
+        }
+        else if (sendto(sockfd, p.data, p.len, 0, (const struct sockaddr *)&p.client,
+                        sizeof(p.client)) >= 0)
+            down.forwarded++;
+        free(p.data);
+    }
+    return queued ? heap[0].due - t : -1;
+}
+
+void link_report(const struct link *l)
+{
+    printf("\033[0;33m%s %ld forwarded, %ld lost, %ld over the queue, %ld held back\033[0m\n",
+           l->name, l->forwarded, l->lost, l->overflow, l->reordered);
+}
+
+/**         DRIVER CODE         **/
+int main(int argc, char *argv[])
+{
+    int port = PROXY_PORT, server_port = SERVER_PORT;
+    long seed = time(NULL);
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-l") && i + 1 < argc)
+            loss = atof(argv[++i]) / 100;
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+            delay = atof(argv[++i]) / 1000;
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            jitter = atof(argv[++i]) / 1000;
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            reorder = atof(argv[++i]) / 100;
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            rate = parse_rate(argv[++i]);
+        else if (!strcmp(argv[i], "-Q") && i + 1 < argc)
+            queue_bytes = (long)parse_rate(argv[++i]);
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+            port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            server_port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-S") && i + 1 < argc)
+            seed = atol(argv[++i]);
+        else
+        {
+            printf("Usage: %s [-l <loss %%>] [-d <delay ms>] [-j <jitter ms>] [-o <reorder %%>]\n"
+                   "       [-r <rate>] [-Q <queue bytes>] [-p <port>] [-s <server port>] [-S <seed>]\n",
+                   argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    srand48(seed);
+
+    struct sockaddr_in addr, server;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(server_port);
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0)
+    {
+        perror("\033[0;31mSocket creation failed!!\033[0m\n");
+        exit(EXIT_FAILURE);
+    }
+    int rcvbuf = 4 << 20;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (bind(sockfd, (const struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("\033[0;32mBinding the socket Failed!!\033[0m\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigint;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("\033[0;32mProxy on port %d for the server on port %d: %.2f%% loss, %.1f ms delay, "
+           "%.1f ms jitter, %.2f%% reordered, ",
+           port, server_port, loss * 100, delay * 1e3, jitter * 1e3, reorder * 100);
+    if (rate > 0)
+        printf("%.0f bytes/s with a %ld byte queue\033[0m\n\n", rate, queue_bytes);
+    else
+        printf("no rate limit\033[0m\n\n");
+    heap = malloc(MAX_QUEUED * sizeof(struct packet));
+    prctl(PR_SET_TIMERSLACK, 1); // wake up on time, not up to 50 us late
+
+    /**
+     * Client -> server on the proxy socket,
+     * server -> client on the flow sockets.
+     * poll() sleeps until the next datagram
+     * is due at the latest
+     */
+    static char buf[MAX_DGRAM];
+    pfds[0].fd = sockfd;
+    pfds[0].events = POLLIN;
+    double next_expire = now() + 1;
+    while (!stop)
+    {
+        double wait = deliver(sockfd, &server);
+        if (wait < 0 || wait > 1)
+            wait = 1;
+        struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+        if (ppoll(pfds, nflows + 1, &ts, NULL) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("\033[0;31mpoll failed!!\033[0m\n");
+            break;
+        }
+
+        if (pfds[0].revents & POLLIN)
+        {
+            struct sockaddr_in client;
+            socklen_t sz = sizeof(client);
+            int len;
+            while ((len = recvfrom(sockfd, buf, sizeof(buf), MSG_DONTWAIT,
+                                   (struct sockaddr *)&client, &sz)) >= 0)
+            {
+                int i = flow_for(&client, &server);
+                flows[i].last_active = now();
+                link_send(&up, 1, &client, buf, len);
+                sz = sizeof(client);
+            }
+        }
+
+        for (int i = 0; i < nflows; i++)
+        {
+            if (!(pfds[i + 1].revents & POLLIN))
+                continue;
+            int len;
+            while ((len = recv(flows[i].fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0)
+            {
+                flows[i].last_active = now();
+                link_send(&down, 0, &flows[i].client, buf, len);
+            }
+        }
+
+        if (now() >= next_expire)
+        {
+            flows_expire();
+            next_expire = now() + 1;
+        }
+    }
+
+    printf("\n");
+    link_report(&up);
+    link_report(&down);
+    close(sockfd);
+    return 0;
+}
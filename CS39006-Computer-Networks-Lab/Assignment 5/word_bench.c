@@ -0,0 +1,570 @@
+/**
+ *
+ *       Network Assignment-5
+ *
+ *     *--------------------------------*
+ *     *   Word protocol benchmark      *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @application: BENCHMARK
+ *      @file:        word_bench.c
+ *
+ *      How to run (from this directory):
+ *      -----------
+ *      $ gcc -O2 word_bench.c -o word_bench
+ *      $ ./word_bench [-c <condition,...>] [-m stream,window,word] [-W <words>]
+ *                     [-n <runs>] [-w <work dir>] [-o <results.csv>] [-t <timeout>]
+ *
+ *      wordserver, wordclient and lossy_proxy are built
+ *      into <work dir>/bin and the server is started on
+ *      loopback in a directory with a file of <words>
+ *      random words (default 20000). For every network
+ *      condition (see conditions[]) the proxy is started
+ *      with its options and the client fetches the file
+ *      through it n times (default 3) in every mode.
+ *      Every run is checked against the words of the
+ *      file and appended as one line to the CSV file:
+ *
+ *          condition,proxy,mode,words,run,seconds,
+ *          words_ok,goodput_kb_s,ok
+ *
+ *      words_ok counts the words written before the
+ *      first wrong or missing one, goodput is their
+ *      bytes over the time taken. A run that does not
+ *      finish in <timeout> seconds (default 30) is
+ *      killed and counts as failed. A table of the
+ *      median time and goodput follows at the end.
+ *      The time is the client's own, from the first
+ *      word asked for to END written, so the LINGER
+ *      of stream mode after END does not count and
+ *      the modes compare. Window and word mode do not resend
+ *      lost requests, so loss fails them, but every
+ *      mode has to get through delay, jitter and
+ *      reordering: a failure there is a bug.
+ *      A new condition is one more line in conditions[].
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SERVER_PORT 8080
+#define PROXY_PORT 9090
+#define MAX_RUNS 64
+#define MAX_ARGS 32
+
+//---------------- NETWORK CONDITIONS --------------
+
+struct condition
+{
+    const char *name;
+    const char *proxy; // lossy_proxy options, NULL: no proxy
+};
+
+struct condition conditions[] = {
+    /*
+     * direct is the baseline without the proxy, proxy
+     * the cost of the extra hop on its own
+     */
+    {"direct", NULL},
+    {"proxy", ""},
+    {"loss-1", "-l 1"},
+    {"loss-5", "-l 5"},
+    {"delay-10", "-d 10"},
+    {"jitter", "-d 10 -j 5"},
+    {"reorder-2", "-d 2 -o 2"},
+    {"rate-10m", "-r 10m"},
+    {"rate-2m", "-r 2m -Q 64k"},
+    {"wan", "-l 0.5 -d 20 -j 5 -r 20m"},
+};
+
+#define NCONDITIONS (int)(sizeof(conditions) / sizeof(conditions[0]))
+
+const char *modes[] = {"stream", "window", "word"};
+
+#define NMODES (int)(sizeof(modes) / sizeof(modes[0]))
+
+//---------------- UTILITY FUNCTIONS ---------------
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void quiet_stdio()
+{
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(null);
+}
+
+int in_list(const char *list, const char *name)
+{
+    /*
+     * name is one of the comma separated list,
+     * a NULL list takes everything
+     */
+    if (!list)
+        return 1;
+    char l[1024], key[128];
+    snprintf(l, sizeof(l), ",%s,", list);
+    snprintf(key, sizeof(key), ",%s,", name);
+    return strstr(l, key) != NULL;
+}
+
+char *read_file(const char *path, long *len)
+{
+    FILE *f = fopen(path, "rb");
+    *len = 0;
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    char *buf = malloc(*len + 1);
+    if (fread(buf, 1, *len, f) != (size_t)*len)
+        *len = 0;
+    buf[*len] = '\0';
+    fclose(f);
+    return buf;
+}
+
+double median(double *v, int n)
+{
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && v[j] < v[j - 1]; j--)
+        {
+            double t = v[j];
+            v[j] = v[j - 1];
+            v[j - 1] = t;
+        }
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+//---------------- TEST FILE -----------------------
+
+int generate(const char *path, const char *expected, long words)
+{
+    /*
+     * HELLO, random words between random white
+     * space, END. expected gets the words one per
+     * line, as wordclient writes them
+     */
+    FILE *f = fopen(path, "w"), *e = fopen(expected, "w");
+    if (!f || !e)
+        return -1;
+    const char *seps[] = {" ", "\n", "\t", "  ", "\r\n"};
+    unsigned int seed = 7;
+    fprintf(f, "HELLO\n");
+    for (long i = 0; i < words; i++)
+    {
+        char word[16];
+        int len = 1 + rand_r(&seed) % 12;
+        for (int k = 0; k < len; k++)
+            word[k] = 'a' + rand_r(&seed) % 26;
+        word[len] = '\0';
+        fprintf(f, "%s%s", word, seps[rand_r(&seed) % 5]);
+        fprintf(e, "%s\n", word);
+    }
+    fprintf(f, "\nEND\n");
+    fclose(f);
+    fclose(e);
+    return 0;
+}
+
+long words_ok(const char *out, const char *expected, long *bytes)
+{
+    /*
+     * Words of out that match expected, up to the
+     * first difference, and their bytes
+     */
+    long lo, le, words = 0;
+    char *o = read_file(out, &lo), *e = read_file(expected, &le);
+    *bytes = 0;
+    if (o && e)
+        for (long i = 0; i < lo && i < le && o[i] == e[i]; i++)
+            if (o[i] == '\n')
+            {
+                words++;
+                *bytes = i + 1;
+            }
+    free(o);
+    free(e);
+    return words;
+}
+
+//---------------- SERVER AND PROXY ----------------
+
+int probe(int port, double timeout)
+{
+    /*
+     * Ask for a file that is not there and wait
+     * for FILE_NOT_FOUND, retrying in case the
+     * proxy loses the request or the reply
+     */
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval tv = {0, 50000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char buf[64];
+    int ok = 0;
+    for (double end = now() + timeout; !ok && now() < end;)
+    {
+        sendto(sock, "word_bench.probe", 16, 0, (struct sockaddr *)&addr, sizeof(addr));
+        ok = recv(sock, buf, sizeof(buf), 0) > 0;
+    }
+    close(sock);
+    return ok;
+}
+
+pid_t start(const char *bin, const char *dir, const char *args, long seed, int port)
+{
+    /*
+     * Run bin in dir with args (split at spaces,
+     * plus -S <seed> for the proxy) and wait until
+     * it answers on port
+     */
+    char copy[1024], seed_str[32], *argv[MAX_ARGS], *save;
+    int argc = 0;
+    argv[argc++] = (char *)bin;
+    snprintf(copy, sizeof(copy), "%s", args);
+    for (char *tok = strtok_r(copy, " ", &save); tok && argc < MAX_ARGS - 3; tok = strtok_r(NULL, " ", &save))
+        argv[argc++] = tok;
+    if (seed >= 0)
+    {
+        snprintf(seed_str, sizeof(seed_str), "%ld", seed);
+        argv[argc++] = "-S";
+        argv[argc++] = seed_str;
+    }
+    argv[argc] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGKILL); // do not outlive the benchmark
+        if (chdir(dir) < 0)
+            _exit(127);
+        quiet_stdio();
+        execv(bin, argv);
+        _exit(127);
+    }
+    if (probe(port, 5) && waitpid(pid, NULL, WNOHANG) == 0)
+        return pid;
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+void stop(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+//---------------- CLIENT --------------------------
+
+double run_client(const char *bin, const char *dir, const char *mode, int port,
+                  double timeout, int *done)
+{
+    /*
+     * One fetch of words.txt. The time is the
+     * client's own, from the first word asked
+     * for to END written (the LINGER of stream mode is
+     * not part of it), read from the summary it
+     * prints to client.log. A client that has
+     * none is timed from fork() to its exit, it
+     * is killed after timeout seconds
+     */
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+
+    double t0 = now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        if (chdir(dir) < 0)
+            _exit(127);
+        quiet_stdio();
+        int log = open("client.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log >= 0)
+        {
+            dup2(log, STDOUT_FILENO);
+            close(log);
+        }
+        execl(bin, bin, "-q", "-m", mode, "-p", port_str, "words.txt", (char *)NULL);
+        _exit(127);
+    }
+
+    *done = 0;
+    while (!*done)
+    {
+        double left = timeout - (now() - t0);
+        struct timespec ts = {(time_t)left, (long)((left - (time_t)left) * 1e9)};
+        if (left <= 0 || (sigtimedwait(&chld, NULL, &ts) < 0 && errno == EAGAIN))
+        {
+            kill(pid, SIGKILL);
+            break;
+        }
+        *done = waitpid(pid, NULL, WNOHANG) == pid;
+    }
+    double seconds = now() - t0;
+    if (!*done)
+        waitpid(pid, NULL, 0);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    char path[4200];
+    snprintf(path, sizeof(path), "%s/client.log", dir);
+    long len;
+    char *log = read_file(path, &len), *at;
+    double own;
+    if (*done && log && (at = strstr(log, " words in ")) && sscanf(at, " words in %lf s", &own) == 1)
+        seconds = own;
+    free(log);
+    return seconds;
+}
+
+//---------------- BUILDING ------------------------
+
+int build(const char *src, const char *out)
+{
+    char cmd[8192];
+    snprintf(cmd, sizeof(cmd), "gcc -O2 \"%s\" -o \"%s\" -lm -pthread", src, out);
+    if (system(cmd) != 0)
+    {
+        printf("\033[1;31mBuild failed: %s\033[0m\n", cmd);
+        return -1;
+    }
+    return 0;
+}
+
+/**         DRIVER CODE         **/
+
+int main(int argc, char *argv[])
+{
+    const char *cond_arg = NULL, *modes_arg = NULL;
+    const char *work = "/tmp/word_bench", *csv = "word_bench.csv";
+    long words = 20000;
+    int runs = 3;
+    double timeout = 30;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:m:W:n:w:o:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            cond_arg = optarg;
+            break;
+        case 'm':
+            modes_arg = optarg;
+            break;
+        case 'W':
+            words = atol(optarg);
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        case 'w':
+            work = optarg;
+            break;
+        case 'o':
+            csv = optarg;
+            break;
+        case 't':
+            timeout = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c conditions] [-m modes] [-W words] [-n runs] [-w dir] [-o csv] [-t timeout]\n", argv[0]);
+            return 1;
+        }
+    }
+    runs = runs < 1 ? 1 : runs > MAX_RUNS ? MAX_RUNS : runs;
+
+    /*
+     * Work directory: data/ is served, client/ is
+     * where the client writes, bin/ the builds
+     */
+    char data[4096], client_dir[4096], bin_dir[4096], path[4200], expected[4200], output[4200];
+    char server_bin[4300], client_bin[4300], proxy_bin[4300];
+    mkdir(work, 0755);
+    snprintf(data, sizeof(data), "%s/data", work);
+    snprintf(client_dir, sizeof(client_dir), "%s/client", work);
+    snprintf(bin_dir, sizeof(bin_dir), "%s/bin", work);
+    mkdir(data, 0755);
+    mkdir(client_dir, 0755);
+    mkdir(bin_dir, 0755);
+    snprintf(path, sizeof(path), "%s/words.txt", data);
+    snprintf(expected, sizeof(expected), "%s/expected.txt", work);
+    snprintf(output, sizeof(output), "%s/output.txt", client_dir);
+    printf("Generating \033[0;35mwords.txt\033[0m (%ld words)\n", words);
+    if (generate(path, expected, words) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    snprintf(server_bin, sizeof(server_bin), "%s/wordserver", bin_dir);
+    snprintf(client_bin, sizeof(client_bin), "%s/wordclient", bin_dir);
+    snprintf(proxy_bin, sizeof(proxy_bin), "%s/lossy_proxy", bin_dir);
+    if (build("wordserver.c", server_bin) < 0 || build("wordclient.c", client_bin) < 0 ||
+        build("lossy_proxy.c", proxy_bin) < 0)
+        return 1;
+
+    if (probe(SERVER_PORT, 0.2))
+    {
+        printf("\033[1;31mPort %d is already in use\033[0m\n", SERVER_PORT);
+        return 1;
+    }
+    pid_t server = start(server_bin, data, "-q", -1, SERVER_PORT);
+    if (server < 0)
+    {
+        printf("\033[1;31mThe server did not start\033[0m\n");
+        return 1;
+    }
+
+    FILE *out = fopen(csv, "a");
+    if (!out)
+    {
+        perror(csv);
+        stop(server);
+        return 1;
+    }
+    fseek(out, 0, SEEK_END);
+    if (ftell(out) == 0)
+        fprintf(out, "condition,proxy,mode,words,run,seconds,words_ok,goodput_kb_s,ok\n");
+
+    /*
+     * Median time and goodput of every condition
+     * and mode, for the table at the end
+     */
+    double table_s[NCONDITIONS][NMODES], table_kb[NCONDITIONS][NMODES];
+    int table_ok[NCONDITIONS][NMODES];
+    memset(table_ok, -1, sizeof(table_ok));
+
+    for (int c = 0; c < NCONDITIONS; c++)
+    {
+        const struct condition *cond = &conditions[c];
+        if (!in_list(cond_arg, cond->name))
+            continue;
+        printf("\n\033[0;32m%s\033[0m %s\n", cond->name, cond->proxy ? cond->proxy : "(no proxy)");
+        for (int m = 0; m < NMODES; m++)
+        {
+            if (!in_list(modes_arg, modes[m]))
+                continue;
+            double secs[MAX_RUNS], kbs[MAX_RUNS];
+            int ok_runs = 0;
+            for (int r = 0; r < runs; r++)
+            {
+                /*
+                 * A fresh proxy per run, seeded by the
+                 * run, so every mode meets the same
+                 * sequence of losses
+                 */
+                pid_t proxy = -1;
+                int port = SERVER_PORT;
+                if (cond->proxy)
+                {
+                    proxy = start(proxy_bin, data, cond->proxy, r + 1, PROXY_PORT);
+                    port = PROXY_PORT;
+                    if (proxy < 0)
+                    {
+                        printf("\033[1;31mThe proxy did not start\033[0m\n");
+                        break;
+                    }
+                }
+
+                unlink(output);
+                int done;
+                double seconds = run_client(client_bin, client_dir, modes[m], port, timeout, &done);
+                long bytes, got = words_ok(output, expected, &bytes);
+                int ok = done && got == words;
+                double kb = seconds > 0 ? bytes / seconds / 1e3 : 0;
+                if (proxy > 0)
+                    stop(proxy);
+
+                fprintf(out, "%s,%s,%s,%ld,%d,%.6f,%ld,%.1f,%d\n", cond->name,
+                        cond->proxy ? cond->proxy : "", modes[m], words, r, seconds, got, kb, ok);
+                fflush(out);
+                printf("  %-7s run %d: %9.3f s %10.1f kB/s %8ld words  %s\n", modes[m], r, seconds, kb, got,
+                       ok ? "\033[0;32mok\033[0m" : done ? "\033[1;31mFAILED\033[0m" : "\033[1;31mTIMEOUT\033[0m");
+                if (ok)
+                {
+                    secs[ok_runs] = seconds;
+                    kbs[ok_runs++] = kb;
+                }
+            }
+            table_ok[c][m] = ok_runs;
+            if (ok_runs)
+            {
+                table_s[c][m] = median(secs, ok_runs);
+                table_kb[c][m] = median(kbs, ok_runs);
+            }
+        }
+    }
+    stop(server);
+    fclose(out);
+
+    /*
+     * condition | median seconds and kB/s per mode,
+     * or how many runs failed
+     */
+    printf("\n%-12s", "");
+    for (int m = 0; m < NMODES; m++)
+        if (in_list(modes_arg, modes[m]))
+            printf(" %22s", modes[m]);
+    printf("\n");
+    for (int c = 0; c < NCONDITIONS; c++)
+    {
+        if (!in_list(cond_arg, conditions[c].name))
+            continue;
+        printf("%-12s", conditions[c].name);
+        for (int m = 0; m < NMODES; m++)
+        {
+            if (!in_list(modes_arg, modes[m]))
+                continue;
+            char cell[64];
+            if (table_ok[c][m] > 0)
+                snprintf(cell, sizeof(cell), "%.3f s %8.0f kB/s", table_s[c][m], table_kb[c][m]);
+            else
+                snprintf(cell, sizeof(cell), "failed");
+            if (table_ok[c][m] >= 0 && table_ok[c][m] < runs)
+                snprintf(cell + strlen(cell), sizeof(cell) - strlen(cell), " (%d/%d ok)",
+                         table_ok[c][m], runs);
+            printf(" %22s", cell);
+        }
+        printf("\n");
+    }
+    printf("\n\033[0;33mResults appended to %s\033[0m\n", csv);
+    return 0;
+}
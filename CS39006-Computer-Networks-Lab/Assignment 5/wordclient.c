@@ -20,17 +20,37 @@
  *      How to run:
  *      -----------
  *      $ gcc wordclient.c -o wordclient
- *      $ ./wordclient
+ *      $ ./wordclient [-m stream|window|word] [-w <window>] [-r <range>]
+ *                     [-p <port>] [-q] [file]
+ *
+ *      -m picks how the words are fetched:
+ *
+ *        stream  the server pushes them in numbered
+ *                segments, which are acknowledged with
+ *                SACKs and sent again when lost, so the
+ *                transfer survives packet loss (default)
+ *        window  WORDS i..j requests for <range> words
+ *                (default 512) with <window> of them in
+ *                flight (default 16), no loss recovery
+ *        word    one WORDi request per word (also -1)
+ *
+ *      -p sends to another port, e.g. of lossy_proxy,
+ *      -q only prints the summary. Without a file
+ *      name on the command line it is read from the
+ *      standard input.
  */
 
 /**
  *  Client side implementation of UDP (datagram)
  *  based client-server model
  */
+#include <poll.h>
+#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -38,6 +58,19 @@
 
 #define PORT 8080
 #define MAXLINE 1024
+#define MAX_PAYLOAD 1472 // largest reply datagram
+
+#define WINDOW 16 // WORDS requests in flight
+#define RANGE 512 // words per WORDS request
+#define RECV_TIMEOUT 5
+
+#define STREAM_WINDOW 1024 // segments the client holds
+#define MAX_SACK 16        // blocks in one ACK
+#define ACK_INTERVAL 50    // ms of silence before the ACK is sent again
+#define LINGER 0.2         // seconds to answer resent segments at the end
+
+#define HELLO_TRIES 8
+#define HELLO_TIMEOUT 500 // ms
 
 //----------- UTILITY FUNCTIONS ------------
 
@@ -64,9 +97,414 @@ FILE *open_file(const char *file)
     return fout;
 }
 
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//----------- FETCHING WORDS ------------
+
+int verbose = 1;
+long datagrams = 0; // replies received
+double finished = 0; // when the words up to END were written, LINGER not counted
+
+long fetch_words(int sockfd, struct sockaddr_in *servaddr, FILE *fout)
+{
+    char word[MAXLINE], msg[MAXLINE];
+    int count = 0;
+    int status = 1;
+    socklen_t sz;
+
+    /**
+     * We will run  a loop where in  each
+     * iteration  we will request for one
+     * word   from  the server.  Once  we 
+     * receive the word "END" we can stop 
+     * our communication.
+     * 
+     * count -> maintains count of  the  word 
+     *          that we are currently reading
+     * 
+     * msg -> message that the  client  will
+     *        send to the server for quering
+     *        the next word
+     * 
+     * word -> contains the word that we will
+     *         receive as a response
+     * 
+     * In each iteration the client  will send
+     * a  request  of  the type "WORDi"  which 
+     * will mean that the client is requesting
+     * for the ith word. This is done till we
+     * get the word "END" as response
+     */
+
+    while (status)
+    {
+        /**
+         * Increment the count of the word 
+         * to be read
+         */
+
+        ++count;
+        sz = sizeof(*servaddr);
+
+        /**
+         * the message will  contain  the  request
+         * that the client will sen to the  server
+         * so message will contain a word  of  the
+         * form "WORDi". Then we send this message
+         * to the server
+         */
+
+        sprintf(msg, "WORD%d", count);
+        if (verbose)
+            printf("Request for  \033[0;31m%s\033[0m\n", msg);
+        sendto(sockfd, (const char *)msg, strlen(msg),
+               MSG_CONFIRM, (const struct sockaddr *)servaddr,
+               sz);
+
+        /**
+         * Receive the response  from  the
+         * server. Response  will  contain 
+         * the ith word from the file that 
+         * the client requested the server
+         * to read from.
+         */
+
+        int len = recvfrom(sockfd, (char *)word, MAXLINE - 1,
+                           MSG_WAITALL, (struct sockaddr *)servaddr,
+                           &sz);
+        if (len < 0)
+        {
+            printf("\033[1;31mNo reply from the server\033[0m\n");
+            break;
+        }
+        datagrams++;
+
+        word[len] = '\0';
+        if (verbose)
+            printf("Received \033[0;32m%s\033[0m\n\n", word);
+
+        /**
+         * If we recerive the word "END"
+         * then  we  need  to  stop  any 
+         * further iterations
+         */
+
+        if (strcasecmp(word, "END") == 0)
+            status = 0;
+
+        /**
+         * Otherwise write the word that we received
+         * as response from the server in  the  file
+         * that is opened for writing
+         */
+
+        else
+            fprintf(fout, "%s\n", word);
+    }
+    return count - 1;
+}
+
+char *next_word(char **p)
+{
+    /**
+     * The next word of a reply, cut out in place.
+     * Words are separated by any white space, as
+     * they were in the file on the server
+     */
+    char *w = *p + strspn(*p, " \t\n\v\f\r");
+    if (!*w)
+        return NULL;
+    char *e = w + strcspn(w, " \t\n\v\f\r");
+    if (*e)
+        *e++ = '\0';
+    *p = e;
+    return w;
+}
+
+long fetch_batches(int sockfd, struct sockaddr_in *servaddr, FILE *fout, int window, int range)
+{
+    /**
+     * Sliding window over the words of the file:
+     * up to  window  requests  WORDS a..b of
+     * range words each are in flight at  once.
+     * Every reply datagram says where its words
+     * start, so they are parked in a ring  of
+     * window * range slots by position and the
+     * file is written in order from the front
+     * of the ring. The words after END were
+     * asked for in vain, the server ends the
+     * session once every word up to END was
+     * asked for and ignores the rest. A reply
+     * the server cut short ends in  <n>+ : the
+     * request then stops there and the rest of
+     * it is asked for again before new words
+     *
+     * next_req -> first word not asked for yet
+     * next_out -> first word not written yet
+     * end_at   -> position of END once known
+     */
+    long ring_len = (long)window * range;
+    char **ring = calloc(ring_len, sizeof(char *));
+    struct
+    {
+        long first, last, got;
+    } *flight = calloc(window, sizeof(*flight)), *redo = calloc(window, sizeof(*redo));
+    int in_flight = 0, nredo = 0;
+    long next_req = 1, next_out = 1, end_at = -1;
+    char dgram[MAX_PAYLOAD + 1], msg[64];
+
+    while (end_at < 0 || next_out < end_at)
+    {
+        while (in_flight < window && (nredo || ((end_at < 0 || next_req < end_at) &&
+                                                next_req + range <= next_out + ring_len)))
+        {
+            if (nredo)
+                flight[in_flight] = redo[--nredo];
+            else
+            {
+                flight[in_flight].first = next_req;
+                flight[in_flight].last = next_req + range - 1;
+                next_req += range;
+            }
+            flight[in_flight].got = 0;
+            int len = sprintf(msg, "WORDS %ld..%ld", flight[in_flight].first, flight[in_flight].last);
+            in_flight++;
+            sendto(sockfd, msg, len, MSG_CONFIRM,
+                   (const struct sockaddr *)servaddr, sizeof(*servaddr));
+        }
+        if (!in_flight)
+            break;
+
+        socklen_t sz = sizeof(*servaddr);
+        int len = recvfrom(sockfd, dgram, MAX_PAYLOAD, 0,
+                           (struct sockaddr *)servaddr, &sz);
+        if (len < 0)
+        {
+            printf("\033[1;31mNo reply from the server, %d request(s) unanswered\033[0m\n", in_flight);
+            break;
+        }
+        dgram[len] = '\0';
+        datagrams++;
+
+        long first;
+        int n, used;
+        if (sscanf(dgram, "WORDS %ld %d%n", &first, &n, &used) != 2)
+            continue;
+        int cut = dgram[used] == '+';
+        used += cut;
+        if (verbose)
+            printf("Received words \033[0;32m%ld..%ld\033[0m\n", first, first + n - 1);
+
+        char *p = dgram + used, *word;
+        for (int k = 0; k < n && (word = next_word(&p)); k++)
+        {
+            long pos = first + k;
+            if (strcasecmp(word, "END") == 0)
+            {
+                if (end_at < 0 || pos < end_at)
+                    end_at = pos;
+            }
+            else if (pos >= next_out && pos < next_out + ring_len && !ring[pos % ring_len])
+                ring[pos % ring_len] = strdup(word);
+        }
+
+        /**
+         * Retire the requests that are complete:
+         * all of their words arrived, or they lie
+         * past END
+         */
+        for (int r = 0; r < in_flight; r++)
+        {
+            if (first >= flight[r].first && first <= flight[r].last)
+            {
+                flight[r].got += n;
+                if (cut && first + n <= flight[r].last && nredo < window)
+                {
+                    redo[nredo].first = first + n;
+                    redo[nredo++].last = flight[r].last;
+                    flight[r].last = first + n - 1;
+                }
+            }
+            long last = end_at >= 0 && end_at < flight[r].last ? end_at : flight[r].last;
+            if (flight[r].got >= last - flight[r].first + 1)
+                flight[r--] = flight[--in_flight];
+        }
+
+        while (ring[next_out % ring_len])
+        {
+            fprintf(fout, "%s\n", ring[next_out % ring_len]);
+            free(ring[next_out % ring_len]);
+            ring[next_out % ring_len] = NULL;
+            next_out++;
+        }
+    }
+
+    for (long k = 0; k < ring_len; k++)
+        free(ring[k]);
+    free(ring);
+    free(flight);
+    free(redo);
+    return next_out - 1;
+}
+
+void send_ack(int sockfd, struct sockaddr_in *servaddr, char **ring, long rcv_nxt)
+{
+    /**
+     * ACK <next> <window> followed by up to
+     * MAX_SACK blocks a-b of the segments held
+     * past the first hole
+     */
+    char msg[MAX_PAYLOAD];
+    int len = sprintf(msg, "ACK %ld %d", rcv_nxt, STREAM_WINDOW);
+    int blocks = 0;
+    for (long q = rcv_nxt + 1; q < rcv_nxt + STREAM_WINDOW && blocks < MAX_SACK; q++)
+    {
+        if (!ring[q % STREAM_WINDOW])
+            continue;
+        long a = q;
+        while (q < rcv_nxt + STREAM_WINDOW && ring[q % STREAM_WINDOW])
+            q++;
+        len += sprintf(msg + len, " %ld-%ld", a, q);
+        blocks++;
+    }
+    sendto(sockfd, msg, len, 0, (const struct sockaddr *)servaddr, sizeof(*servaddr));
+}
+
+long fetch_stream(int sockfd, struct sockaddr_in *servaddr, FILE *fout)
+{
+    /**
+     * Receiving end of the reliable stream (see
+     * RELIABLE STREAMS in wordserver.c). The
+     * segments are parked in a ring by number
+     * and written out in order. One ACK answers
+     * every burst of datagrams read,  and  the
+     * ACK is repeated after ACK_INTERVAL ms of
+     * silence in case it was the one lost
+     *
+     * rcv_nxt -> first segment not written yet
+     * end_seq -> the segment ending with END, it
+     *            is known once it is written
+     */
+    char **ring = calloc(STREAM_WINDOW, sizeof(char *));
+    long rcv_nxt = 0, end_seq = -1, words = 0;
+    char dgram[MAX_PAYLOAD + 1];
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+    double last_heard = now();
+
+    send_ack(sockfd, servaddr, ring, rcv_nxt);
+    while (end_seq < 0 || rcv_nxt <= end_seq)
+    {
+        if (poll(&pfd, 1, ACK_INTERVAL) <= 0)
+        {
+            if (now() - last_heard > RECV_TIMEOUT)
+            {
+                printf("\033[1;31mNo reply from the server, stream cut at segment %ld\033[0m\n", rcv_nxt);
+                break;
+            }
+            send_ack(sockfd, servaddr, ring, rcv_nxt);
+            continue;
+        }
+        last_heard = now();
+
+        int len;
+        while ((len = recvfrom(sockfd, dgram, MAX_PAYLOAD, MSG_DONTWAIT, NULL, NULL)) >= 0)
+        {
+            dgram[len] = '\0';
+            datagrams++;
+            long seq;
+            int n, used;
+            if (sscanf(dgram, "SEG %ld %d\n%n", &seq, &n, &used) != 2 ||
+                seq < rcv_nxt || seq >= rcv_nxt + STREAM_WINDOW || ring[seq % STREAM_WINDOW])
+                continue;
+            ring[seq % STREAM_WINDOW] = strdup(dgram + used);
+        }
+
+        while (ring[rcv_nxt % STREAM_WINDOW])
+        {
+            char *p = ring[rcv_nxt % STREAM_WINDOW], *word;
+            while ((word = next_word(&p)))
+            {
+                if (strcasecmp(word, "END") == 0)
+                {
+                    end_seq = rcv_nxt;
+                    break;
+                }
+                fprintf(fout, "%s\n", word);
+                words++;
+                if (verbose)
+                    printf("Received \033[0;32m%s\033[0m\n", word);
+            }
+            free(ring[rcv_nxt % STREAM_WINDOW]);
+            ring[rcv_nxt % STREAM_WINDOW] = NULL;
+            rcv_nxt++;
+        }
+        send_ack(sockfd, servaddr, ring, rcv_nxt);
+    }
+
+    /**
+     * The server only lets the session go when
+     * the last ACK arrived. If that one is lost
+     * the last segment comes again: answer it
+     * for a while before leaving
+     */
+    finished = now();
+    if (end_seq >= 0 && rcv_nxt > end_seq)
+    {
+        double until = now() + LINGER;
+        int left;
+        while ((left = (int)((until - now()) * 1000)) > 0 && poll(&pfd, 1, left) > 0)
+            if (recvfrom(sockfd, dgram, MAX_PAYLOAD, MSG_DONTWAIT, NULL, NULL) >= 0)
+                send_ack(sockfd, servaddr, ring, rcv_nxt);
+    }
+
+    for (int k = 0; k < STREAM_WINDOW; k++)
+        free(ring[k]);
+    free(ring);
+    return words;
+}
+
 /**         DRIVER CODE         **/
-int main()
+int main(int argc, char *argv[])
 {
+    char *mode = "stream", *name = NULL;
+    int window = WINDOW, range = RANGE, port = PORT;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-1"))
+            mode = "word";
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+            mode = argv[++i];
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+            port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+            window = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            range = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-q"))
+            verbose = 0;
+        else if (argv[i][0] != '-' && !name)
+            name = argv[i];
+        else
+        {
+            printf("Usage: %s [-m stream|window|word] [-w <window>] [-r <range>] [-p <port>] [-q] [file]\n",
+                   argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (strcmp(mode, "stream") && strcmp(mode, "window") && strcmp(mode, "word"))
+    {
+        printf("Unknown mode %s\n", mode);
+        exit(EXIT_FAILURE);
+    }
+    if (window < 1)
+        window = 1;
+    if (range < 1)
+        range = 1;
 
     /**
      * For the client side the implementation
@@ -105,9 +543,21 @@ int main()
     struct sockaddr_in servaddr;
     memset(&servaddr, 0, sizeof(servaddr));
     servaddr.sin_family = AF_INET;
-    servaddr.sin_port = htons(PORT);
+    servaddr.sin_port = htons(port);
     servaddr.sin_addr.s_addr = INADDR_ANY;
 
+    /**
+     * A window of WORDS replies arrives in one
+     * burst, give it room in the receive buffer.
+     * Nothing is sent again yet, so a reply that
+     * is lost anyway ends the transfer after
+     * RECV_TIMEOUT seconds instead of hanging
+     */
+    int rcvbuf = 4 << 20;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval tv = {RECV_TIMEOUT, 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
     printf("\
     Connection is successfully established !!\n\
     \033[0;32m\n\
@@ -136,9 +586,6 @@ int main()
      * file -> stores the name of the file 
      *         given as input.
      * 
-     * status -> 0 - Some error occured
-     *           1 - Successfull query
-     * 
      * resp -> contains the response received 
      *         from the server
      * 
@@ -146,37 +593,50 @@ int main()
      *            be written
      */
 
-    int status = 1;
     FILE *fout;
     char file[MAXLINE];
     char resp[MAXLINE];
     char *outfile = "output.txt";
 
-    int sz = sizeof(servaddr);
-    printf("Enter the file name: ");
-    scanf("%s", file);
+    socklen_t sz = sizeof(servaddr);
+    if (name)
+        snprintf(file, sizeof(file), "%s", name);
+    else
+    {
+        printf("Enter the file name: ");
+        scanf("%1023s", file);
+    }
 
     /**
      * Send the request in the datagram
-     * Request  will contain a filename
+     * Request  will contain a filename.
+     * Either may be lost on the way, so
+     * ask again when no answer arrives
+     * within HELLO_TIMEOUT
      */
 
-    sendto(sockfd, (const char *)file, strlen(file),
-           MSG_CONFIRM, (const struct sockaddr *)&servaddr,
-           sz);
+    int len = -1;
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+    for (int try = 0; try < HELLO_TRIES && len < 0; try++)
+    {
+        sendto(sockfd, (const char *)file, strlen(file),
+               MSG_CONFIRM, (const struct sockaddr *)&servaddr,
+               sz);
 
-    /**
-     * Receive the response from the 
-     * server and decide for further 
-     * process  what actions will be 
-     * taken.
-     */
+        /**
+         * Receive the response from the 
+         * server and decide for further 
+         * process  what actions will be 
+         * taken.
+         */
 
-    int len = recvfrom(sockfd, (char *)resp, MAXLINE,
-                       MSG_WAITALL, (struct sockaddr *)&servaddr,
-                       &sz);
+        if (poll(&pfd, 1, HELLO_TIMEOUT) > 0)
+            len = recvfrom(sockfd, (char *)resp, MAXLINE - 1,
+                           MSG_WAITALL, (struct sockaddr *)&servaddr,
+                           &sz);
+    }
 
-    resp[len] = '\0';
+    resp[len < 0 ? 0 : len] = '\0';
     if (strcasecmp(resp, "HELLO") == 0)
     {
         /**
@@ -184,12 +644,10 @@ int main()
          * then it means that  the  server  has 
          * found the file we requested  for and 
          * the file is of prober format, so  we
-         * open the output file for writing and
-         * set the status code to 1.
+         * open the output file for writing
          */
 
         fout = open_file(outfile);
-        status = 1;
     }
     else if (strcasecmp(resp, "FILE_NOT_FOUND") == 0)
     {
@@ -250,104 +708,25 @@ int main()
         return 0;
     }
 
-    char word[MAXLINE], msg[MAXLINE];
-    int count = 0;
-
     /**
-     * We will run  a loop where in  each
-     * iteration  we will request for one
-     * word   from  the server.  Once  we 
-     * receive the word "END" we can stop 
-     * our communication.
-     * 
-     * for stoping the commnication, we will
-     * 
-     * 1. close the file descriptor of the
-     *    socket.
-     * 2. Close the file we were writing in
-     * 3. Make the status 0,  since we need 
-     *    not iterate any more
-     * 
-     * count -> maintains count of  the  word 
-     *          that we are currently reading
-     * 
-     * msg -> message that the  client  will
-     *        send to the server for quering
-     *        the next word
-     * 
-     * word -> contains the word that we will
-     *         receive as a response
-     * 
-     * In each iteration the client  will send
-     * a  request  of  the type "WORDi"  which 
-     * will mean that the client is requesting
-     * for the ith word. This is done till we
-     * get the word "END" as response
+     * Fetch the words after HELLO into the output
+     * file in the chosen mode
      */
 
-    while (status)
+    if (!fout)
     {
-        /**
-         * Increment the count of the word 
-         * to be read
-         */
-
-        ++count;
-        sz = sizeof(servaddr);
-
-        /**
-         * the message will  contain  the  request
-         * that the client will sen to the  server
-         * so message will contain a word  of  the
-         * form "WORDi". Then we send this message
-         * to the server
-         */
-
-        sprintf(msg, "WORD%d", count);
-        printf("Request for  \033[0;31m%s\033[0m\n", msg);
-        sendto(sockfd, (const char *)msg, strlen(msg),
-               MSG_CONFIRM, (const struct sockaddr *)&servaddr,
-               sz);
-
-        /**
-         * Receive the response  from  the
-         * server. Response  will  contain 
-         * the ith word from the file that 
-         * the client requested the server
-         * to read from.
-         */
-
-        int len = recvfrom(sockfd, (char *)word, MAXLINE,
-                           MSG_WAITALL, (struct sockaddr *)&servaddr,
-                           &sz);
-
-        word[len] = '\0';
-        printf("Received \033[0;32m%s\033[0m\n\n", word);
-
-        /**
-         * If we recerive the word "END"
-         * then  we  need  to  stop  any 
-         * further iterations  and  also
-         * we need to  close the file in 
-         * which  we  were  writing  the 
-         * output.
-         */
-
-        if (strcasecmp(word, "END") == 0)
-        {
-            fclose(fout);
-            printf("Output Written in file \033[0;31moutput.txt\033[0m\n");
-            status = 0;
-        }
-
-        /**
-         * Write  the  word that we received as
-         * response from the server in the file 
-         * that is opened for writing
-         */
-
-        fprintf(fout, "%s\n", word);
+        close(sockfd);
+        return 0;
     }
+    double start = now();
+    long words = !strcmp(mode, "word")     ? fetch_words(sockfd, &servaddr, fout)
+                 : !strcmp(mode, "window") ? fetch_batches(sockfd, &servaddr, fout, window, range)
+                                           : fetch_stream(sockfd, &servaddr, fout);
+    double secs = (finished ? finished : now()) - start;
+    fclose(fout);
+    printf("Output Written in file \033[0;31moutput.txt\033[0m\n");
+    printf("\033[0;33m%ld words in %.3f s (%.0f words/s), %ld datagrams received\033[0m\n",
+           words, secs, secs > 0 ? words / secs : 0, datagrams);
 
     /**
      * Close   the   socket  file   desctriptor
@@ -0,0 +1,456 @@
+/**
+ *
+ *       Network Assignment-5
+ *
+ *     *--------------------------------*
+ *     *   Word index of a mapped file  *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @file:        wordindex.h
+ *
+ *      The words of a file as fscanf("%1023s") reads
+ *      them: maximal runs of non white space bytes,
+ *      cut into pieces of at most WI_MAX_WORD bytes.
+ *      The file is mapped with mmap and the index
+ *      keeps where every word starts and how long it
+ *      is, so word i is  text + off[i]  without any
+ *      reading or copying.
+ *
+ *      The index is built in one pass over the file.
+ *      With SSE2/AVX2 64 bytes at a time are turned
+ *      into a bit mask  s  of white space, the word
+ *      starts are  ~s & (s << 1 | carry)  and the
+ *      word ends  s & ~(s << 1 | carry), visited with
+ *      ctz. The implementation is chosen at run time.
+ *
+ *      Only a file that starts with the word the
+ *      caller asks for is indexed. A built index is
+ *      written to the cache directory (see
+ *      wi_cache_dir), named after the device and inode
+ *      of the file, and mapped again the next time as
+ *      long as size, mtime and inode still match:
+ *
+ *          struct wi_header    (magic, file identity,
+ *                               nwords, end_at)
+ *          uint64_t off[nwords]
+ *          uint32_t len[nwords]
+ *
+ *      Where that file cannot be written the index
+ *      just lives in memory.
+ *
+ *      A mapped file that is truncated under its
+ *      readers would raise SIGBUS on the pages past
+ *      the new end. wi_open() installs a handler that
+ *      maps a zero page there instead, so the lost
+ *      tail reads as zero bytes (the kernel fails a
+ *      send from such a page with EFAULT by itself).
+ */
+
+#ifndef WORDINDEX_H
+#define WORDINDEX_H
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WI_X86 1
+#endif
+
+#define WI_MAX_WORD 1023
+#define WI_MAGIC "WORDIDX1"
+
+struct wi_header
+{
+    char magic[8];
+    uint64_t size;       // of the file the index belongs to
+    int64_t mtime_sec, mtime_nsec;
+    uint64_t ino;
+    uint64_t nwords;
+    uint64_t end_at;     // first END after HELLO, nwords if none
+};
+
+struct word_index
+{
+    char *path;          // real path of the file
+    const char *text;    // the file, mapped
+    size_t size;
+    uint64_t nwords;
+    uint64_t end_at;
+    const uint64_t *off; // word i is text + off[i] ..
+    const uint32_t *len; //           .. text + off[i] + len[i]
+    void *map;           // cached index file mapped, or the arrays in memory
+    size_t map_len;
+    int cached;          // map is <dev>-<ino>.idx in wi_cache_dir()
+    int built;           // built by wi_open, not found on disk
+    struct stat st;      // identity of the file
+    int refs;            // users of the index (atomic in wordserver.c)
+    struct word_index *next;
+};
+
+//---------------- WHITE SPACE MASKS ---------------
+
+static uint64_t wi_space_scalar(const unsigned char *p)
+{
+    uint64_t s = 0;
+    for (int i = 0; i < 64; i++)
+        s |= (uint64_t)(p[i] == ' ' || (p[i] >= '\t' && p[i] <= '\r')) << i;
+    return s;
+}
+
+#ifdef WI_X86
+
+__attribute__((target("sse2"))) static uint64_t wi_space_sse2(const unsigned char *p)
+{
+    /*
+     * '\t' .. '\r' is the range 9 .. 13, tested with
+     * one signed compare after shifting it to the
+     * bottom of the signed range
+     */
+    uint64_t s = 0;
+    for (int k = 0; k < 4; k++)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+        __m128i r = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 9)));
+        __m128i m = _mm_cmplt_epi8(r, _mm_set1_epi8((char)(0x80 + 5)));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+        s |= (uint64_t)(unsigned)_mm_movemask_epi8(m) << (16 * k);
+    }
+    return s;
+}
+
+__attribute__((target("avx2"))) static uint64_t wi_space_avx2(const unsigned char *p)
+{
+    uint64_t s = 0;
+    for (int k = 0; k < 2; k++)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + 32 * k));
+        __m256i r = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 9)));
+        __m256i m = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 5)), r);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        s |= (uint64_t)(uint32_t)_mm256_movemask_epi8(m) << (32 * k);
+    }
+    return s;
+}
+
+#endif
+
+//---------------- BUILDING ------------------------
+
+struct wi_builder
+{
+    uint64_t *off;
+    uint32_t *len;
+    uint64_t n, cap;
+    uint64_t start; // of the word being read
+};
+
+static void wi_emit(struct wi_builder *b, uint64_t start, uint64_t end)
+{
+    /*
+     * One word, in pieces of WI_MAX_WORD bytes
+     * like fscanf with a field width
+     */
+    for (; start < end; start += WI_MAX_WORD)
+    {
+        if (b->n == b->cap)
+        {
+            b->cap = b->cap ? 2 * b->cap : 4096;
+            b->off = realloc(b->off, b->cap * sizeof(uint64_t));
+            b->len = realloc(b->len, b->cap * sizeof(uint32_t));
+        }
+        b->off[b->n] = start;
+        b->len[b->n] = end - start < WI_MAX_WORD ? end - start : WI_MAX_WORD;
+        b->n++;
+    }
+}
+
+static void wi_build(struct wi_builder *b, const unsigned char *text, size_t size)
+{
+    uint64_t (*space)(const unsigned char *) = wi_space_scalar;
+#ifdef WI_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        space = wi_space_sse2;
+    if (__builtin_cpu_supports("avx2"))
+        space = wi_space_avx2;
+#endif
+
+    memset(b, 0, sizeof(*b));
+    uint64_t prev_space = 1; // the byte before the file counts as white space
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64)
+    {
+        uint64_t s = space(text + i);
+        uint64_t shifted = s << 1 | prev_space;
+        uint64_t edges = (~s & shifted) | (s & ~shifted); // starts and ends
+        while (edges)
+        {
+            int bit = __builtin_ctzll(edges);
+            edges &= edges - 1;
+            if (s >> bit & 1)
+                wi_emit(b, b->start, i + bit);
+            else
+                b->start = i + bit;
+        }
+        prev_space = s >> 63;
+    }
+    for (; i < size; i++)
+    {
+        uint64_t sp = text[i] == ' ' || (text[i] >= '\t' && text[i] <= '\r');
+        if (!sp && prev_space)
+            b->start = i;
+        else if (sp && !prev_space)
+            wi_emit(b, b->start, i);
+        prev_space = sp;
+    }
+    if (!prev_space)
+        wi_emit(b, b->start, size);
+}
+
+//---------------- INTERFACE -----------------------
+
+static void wi_sigbus(int sig, siginfo_t *si, void *ctx)
+{
+    /*
+     * A read past the end of a truncated mapping:
+     * put a zero page over it and read on
+     */
+    (void)ctx;
+    long page = sysconf(_SC_PAGESIZE);
+    void *at = (void *)((uintptr_t)si->si_addr & ~(uintptr_t)(page - 1));
+    if (si->si_code != BUS_ADRERR ||
+        mmap(at, page, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+    {
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+}
+
+static int wi_cache_dir(char *out, size_t n)
+{
+    /*
+     * $XDG_CACHE_HOME/wordindex, ~/.cache/wordindex
+     * or /tmp/wordindex-<uid>. It has to be a
+     * directory of ours that nobody else can write
+     * to, or nothing is cached. Returns 0 if usable
+     */
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    if (xdg && *xdg)
+        snprintf(out, n, "%s/wordindex", xdg);
+    else if (home && *home)
+    {
+        snprintf(out, n, "%s/.cache", home);
+        mkdir(out, 0700);
+        snprintf(out, n, "%s/.cache/wordindex", home);
+    }
+    else
+        snprintf(out, n, "/tmp/wordindex-%d", (int)getuid());
+    mkdir(out, 0700);
+    struct stat st;
+    return lstat(out, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() &&
+                   !(st.st_mode & 022)
+               ? 0
+               : -1;
+}
+
+static int wi_idx_path(const struct word_index *w, char *out, size_t n)
+{
+    char dir[4096];
+    if (wi_cache_dir(dir, sizeof(dir)) < 0)
+        return -1;
+    snprintf(out, n, "%s/%llx-%llx.idx", dir, (unsigned long long)w->st.st_dev,
+             (unsigned long long)w->st.st_ino);
+    return 0;
+}
+
+static int wi_starts_with(const char *text, size_t size, const char *word)
+{
+    /*
+     * 1 if the first word of text is word
+     * (case does not matter)
+     */
+    size_t i = 0, n = strlen(word);
+    while (i < size && (text[i] == ' ' || (text[i] >= '\t' && text[i] <= '\r')))
+        i++;
+    return size - i >= n && strncasecmp(text + i, word, n) == 0 &&
+           (size - i == n || text[i + n] == ' ' || (text[i + n] >= '\t' && text[i + n] <= '\r'));
+}
+
+static int wi_load(struct word_index *w)
+{
+    /*
+     * Map <dev>-<ino>.idx from the cache if it
+     * belongs to this very version of the file.
+     * Returns 0 on success
+     */
+    char ipath[4200];
+    if (wi_idx_path(w, ipath, sizeof(ipath)) < 0)
+        return -1;
+    int fd = open(ipath, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0)
+        return -1;
+    struct stat ist;
+    struct wi_header h;
+    if (fstat(fd, &ist) < 0 || read(fd, &h, sizeof(h)) != sizeof(h) ||
+        memcmp(h.magic, WI_MAGIC, 8) != 0 || h.size != (uint64_t)w->st.st_size ||
+        h.mtime_sec != w->st.st_mtim.tv_sec || h.mtime_nsec != w->st.st_mtim.tv_nsec ||
+        h.ino != w->st.st_ino || h.end_at > h.nwords ||
+        (uint64_t)ist.st_size != sizeof(h) + h.nwords * (sizeof(uint64_t) + sizeof(uint32_t)))
+    {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, ist.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    w->map = map;
+    w->map_len = ist.st_size;
+    w->cached = 1;
+    w->nwords = h.nwords;
+    w->end_at = h.end_at;
+    w->off = (const uint64_t *)((char *)map + sizeof(h));
+    w->len = (const uint32_t *)(w->off + h.nwords);
+    return 0;
+}
+
+static void wi_save(const struct word_index *w, const struct wi_builder *b)
+{
+    /*
+     * Written to a temporary name and renamed,
+     * so a reader never maps half an index
+     */
+    char ipath[4200], tmp[4300];
+    if (wi_idx_path(w, ipath, sizeof(ipath)) < 0)
+        return;
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", ipath); // one per builder, even in one process
+    int fd = mkstemp(tmp);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!f)
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    struct wi_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, WI_MAGIC, 8);
+    h.size = w->st.st_size;
+    h.mtime_sec = w->st.st_mtim.tv_sec;
+    h.mtime_nsec = w->st.st_mtim.tv_nsec;
+    h.ino = w->st.st_ino;
+    h.nwords = b->n;
+    h.end_at = w->end_at;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(b->off, sizeof(uint64_t), b->n, f) == b->n &&
+             fwrite(b->len, sizeof(uint32_t), b->n, f) == b->n;
+    if (fclose(f) == 0 && ok)
+        rename(tmp, ipath);
+    else
+        unlink(tmp);
+}
+
+static struct word_index *wi_open(const char *path, const char *first)
+{
+    /*
+     * Map the file and load or build its index.
+     * NULL if the file cannot be read. A file
+     * whose first word is not first is left
+     * without an index: nwords is 0
+     */
+    static struct sigaction bus;
+    if (!bus.sa_sigaction)
+    {
+        bus.sa_sigaction = wi_sigbus;
+        bus.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigaction(SIGBUS, &bus, NULL);
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct word_index *w = calloc(1, sizeof(struct word_index));
+    if (fstat(fd, &w->st) < 0 || !S_ISREG(w->st.st_mode))
+    {
+        close(fd);
+        free(w);
+        return NULL;
+    }
+    w->path = strdup(path);
+    w->size = w->st.st_size;
+    w->text = "";
+    if (w->size)
+    {
+        void *text = mmap(NULL, w->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (text == MAP_FAILED)
+        {
+            close(fd);
+            free(w->path);
+            free(w);
+            return NULL;
+        }
+        madvise(text, w->size, MADV_WILLNEED);
+        w->text = text;
+    }
+    close(fd);
+
+    if (!wi_starts_with(w->text, w->size, first))
+        return w;
+    if (wi_load(w) == 0)
+        return w;
+
+    struct wi_builder b;
+    wi_build(&b, (const unsigned char *)w->text, w->size);
+    w->built = 1;
+    w->nwords = b.n;
+    w->end_at = b.n;
+    for (uint64_t i = 1; i < b.n; i++)
+        if (b.len[i] == 3 && strncasecmp(w->text + b.off[i], "END", 3) == 0)
+        {
+            w->end_at = i;
+            break;
+        }
+    wi_save(w, &b);
+    if (wi_load(w) == 0)
+    {
+        free(b.off);
+        free(b.len);
+        return w;
+    }
+    w->off = b.off;
+    w->len = b.len;
+    return w;
+}
+
+static void wi_close(struct word_index *w)
+{
+    if (w->size)
+        munmap((void *)w->text, w->size);
+    if (w->cached)
+        munmap(w->map, w->map_len);
+    else
+    {
+        free((void *)w->off);
+        free((void *)w->len);
+    }
+    free(w->path);
+    free(w);
+}
+
+#endif
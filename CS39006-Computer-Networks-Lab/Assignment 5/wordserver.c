@@ -19,30 +19,123 @@
  * 
  *      How to run:
  *      -----------
- *      $ gcc wordserver.c -o wordserver
- *      $ ./wordserver
+ *      $ gcc wordserver.c -o wordserver -lm -pthread
+ *      $ ./wordserver [-t <idle seconds>] [-q] [-b <batch>] [-g]
+ *                     [-n <shards>] [-c]
+ *
+ *      The server keeps running and serves any number
+ *      of clients at once on the one socket, each one
+ *      in its own session (see SESSION TABLE). -t sets
+ *      how long an idle session is kept (default 30 s)
+ *      and -q stops the per word log lines.
+ *
+ *      Datagrams are read and the replies sent <batch>
+ *      at a time (default 64, -b 1 is one system call
+ *      per datagram) and -g sends long WORDS replies
+ *      with UDP GSO, see BATCHED I/O. -n serves on
+ *      that many threads, each with its own socket and
+ *      sessions, and -c pins them to CPUs (see SHARDS).
+ *      Under load the server prints its rates every
+ *      10 seconds.
+ *
+ *      A requested file that starts with HELLO is
+ *      indexed once (wordindex.h) and the index is
+ *      shared by all sessions on it, word i is found
+ *      in O(1) and sent straight out of the mapped
+ *      file. The index is kept in ~/.cache/wordindex
+ *      for the next run.
  */
 
 /**
  *  Server side implementation of UDP (datagram)
  *  based client-server model
  */
+#define _GNU_SOURCE
+#include <math.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <assert.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sched.h>
+#include "wordindex.h"
 
 #define PORT 8080
 #define MAXLINE 1024
 
+#define MAX_SESSIONS 4096
+#define SESSION_BUCKETS 8192
+#define IDLE_TIMEOUT 30
+
+#define MAX_PAYLOAD 1472 // 1500 byte MTU - IP and UDP headers
+#define MAX_REPLY 4      // datagrams in one WORDS reply, at most
+#define ASKED_RANGES 16  // requests remembered past a gap
+
+#define STREAM_WINDOW 1024 // segments in flight, at most
+#define INIT_CWND 10
+#define DUP_THRESH 3
+#define INIT_RTO 0.2
+#define MIN_RTO 0.02
+#define MAX_RTO 2.0
+#define MAX_TIMEOUTS 8 // in a row, then the client is gone
+
+#define RX_BATCH 64      // datagrams read in one recvmmsg()
+#define STATS_INTERVAL 10
+
 //----------- UTILITY FUNCTIONS ------------
 
-FILE *open_file(const char *s)
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Every file that some session reads, with its
+ * word index. Sessions on the same file share
+ * one index, counted in refs, across all shards.
+ * index_lock only guards the list: refs change
+ * with atomics, and an index is built outside
+ * the lock so the other shards keep serving
+ */
+struct word_index *indexes;
+pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct word_index *find_index(const char *path, const struct stat *st)
+{
+    /**
+     * The index of this version of the file
+     * with a ref taken, NULL if there is none.
+     * One whose refs already fell to 0 is on
+     * its way out and does not count
+     */
+    for (struct word_index *w = indexes; w; w = w->next)
+    {
+        if (strcmp(w->path, path) || w->st.st_ino != st->st_ino ||
+            w->st.st_size != st->st_size ||
+            w->st.st_mtim.tv_sec != st->st_mtim.tv_sec ||
+            w->st.st_mtim.tv_nsec != st->st_mtim.tv_nsec)
+            continue;
+        int refs = __atomic_load_n(&w->refs, __ATOMIC_RELAXED);
+        while (refs > 0)
+            if (__atomic_compare_exchange_n(&w->refs, &refs, refs + 1, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return w;
+    }
+    return NULL;
+}
+
+struct word_index *open_file(const char *s)
 {
     /** 
      * Find the path of the requested file
@@ -69,29 +162,1173 @@ FILE *open_file(const char *s)
 
     /**
      * If the path of the file  is  found
-     * Then open the file and return  the
-     * File pinter after opening the file
-     * in read mode
+     * then share the index of a session
+     * already reading the same version of
+     * it, or map the file and load (build
+     * on first use) its index
      */
 
-    FILE *fin = fopen(path, "r");
-    return fin;
+    struct stat st;
+    struct word_index *w = NULL;
+    pthread_mutex_lock(&index_lock);
+    if (stat(path, &st) == 0)
+        w = find_index(path, &st);
+    pthread_mutex_unlock(&index_lock);
+    if (w)
+    {
+        free(path);
+        return w;
+    }
+
+    /**
+     * Build it without the lock. Should another
+     * shard have done the same meanwhile, its
+     * index is used and ours thrown away
+     */
+    double t = now();
+    w = wi_open(path, "HELLO");
+    if (w && w->nwords)
+        printf("\033[0;33m%s %lu words of %s in %.3f ms\033[0m\n\n",
+               w->built ? "Indexed" : "Loaded the index of",
+               (unsigned long)w->nwords, path, (now() - t) * 1e3);
+    free(path);
+    if (!w)
+        return NULL;
+    pthread_mutex_lock(&index_lock);
+    struct word_index *other = find_index(w->path, &w->st);
+    if (!other)
+    {
+        w->refs = 1;
+        w->next = indexes;
+        indexes = w;
+    }
+    pthread_mutex_unlock(&index_lock);
+    if (other)
+    {
+        wi_close(w);
+        w = other;
+    }
+    return w;
 }
 
-void close_file(FILE *f)
+void close_file(struct word_index *w)
 {
     /**
-     * Close the file pointer 
-     * that  was   previously 
-     * opened   for   reading
+     * Release the index. Once neither a session
+     * nor a queued reply on any shard uses it
+     * any more it is unmapped (see BATCHED I/O)
      */
-    fclose(f);
+    if (__atomic_sub_fetch(&w->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    pthread_mutex_lock(&index_lock);
+    struct word_index **pp = &indexes;
+    while (*pp != w)
+        pp = &(*pp)->next;
+    *pp = w->next;
+    pthread_mutex_unlock(&index_lock);
+    wi_close(w);
 }
 
-/**         DRIVER CODE         **/
-int main()
+void hold_file(struct word_index *w)
+{
+    /**
+     * Another ref on an index the caller
+     * already holds one of, no lock needed
+     */
+    __atomic_fetch_add(&w->refs, 1, __ATOMIC_RELAXED);
+}
+
+//----------- SESSION TABLE ------------
+
+/**
+ * Every client (IP address and port) that asked
+ * for a file owns a session: the index of the
+ * file and the number of words sent so far. Any
+ * word can be sent again at any time, so a lost
+ * reply is just asked for once more.
+ *
+ * Sessions are found through a hash table on the
+ * client address. They are also kept on a list in
+ * the order of their last request (head = idle for
+ * the longest), so expiring idle sessions  and
+ * evicting one when the table is full only ever
+ * look at the head of the list.
+ */
+
+struct session
+{
+    struct sockaddr_in addr;         // the client
+    struct word_index *idx;          // the file, shared with other sessions
+    long count;                      // last word sent (HELLO is word 0)
+    long asked;                      // words 1..asked were all asked for
+    struct
+    {
+        long first, last;
+    } gaps[ASKED_RANGES];            // asked for past asked + 1
+    int ngaps;
+    double last_active;              // time of the last request
+    struct stream *st;               // set once the client sent an ACK
+    struct session *hnext;           // next session in the hash bucket
+    struct session *prev, *next;     // idle list (head = least recent)
+};
+
+struct session_table
+{
+    int count;
+    struct session *buckets[SESSION_BUCKETS];
+    struct session *head, *tail;
+    long opened, finished, expired, evicted;
+};
+
+__thread struct session_table sessions;
+int idle_timeout = IDLE_TIMEOUT;
+
+void stream_free(struct session *s);
+int verbose = 1;
+
+char *addr_str(const struct sockaddr_in *a)
+{
+    static __thread char buf[INET_ADDRSTRLEN + 8];
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &a->sin_addr, ip, sizeof(ip));
+    sprintf(buf, "%s:%d", ip, ntohs(a->sin_port));
+    return buf;
+}
+
+unsigned int hash_addr(const struct sockaddr_in *a)
+{
+    /**
+     * Mix the address and the port, clients
+     * on one host only differ in the port
+     */
+    unsigned int h = a->sin_addr.s_addr * 2654435761u;
+    h ^= a->sin_port * 40503u;
+    return (h ^ h >> 15) % SESSION_BUCKETS;
+}
+
+void idle_unlink(struct session *s)
+{
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        sessions.head = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+    else
+        sessions.tail = s->prev;
+    s->prev = s->next = NULL;
+}
+
+void idle_push_back(struct session *s)
+{
+    s->next = NULL;
+    s->prev = sessions.tail;
+    if (sessions.tail)
+        sessions.tail->next = s;
+    sessions.tail = s;
+    if (!sessions.head)
+        sessions.head = s;
+}
+
+struct session *session_find(const struct sockaddr_in *a)
+{
+    for (struct session *s = sessions.buckets[hash_addr(a)]; s; s = s->hnext)
+        if (s->addr.sin_addr.s_addr == a->sin_addr.s_addr && s->addr.sin_port == a->sin_port)
+            return s;
+    return NULL;
+}
+
+void session_touch(struct session *s)
+{
+    /**
+     * A request moves the session to  the
+     * back of the idle list, which so stays
+     * sorted by the time of the last request
+     */
+    s->last_active = now();
+    idle_unlink(s);
+    idle_push_back(s);
+}
+
+void session_close(struct session *s, const char *why)
+{
+    struct session **pp = &sessions.buckets[hash_addr(&s->addr)];
+    while (*pp != s)
+        pp = &(*pp)->hnext;
+    *pp = s->hnext;
+    idle_unlink(s);
+    sessions.count--;
+    if (s->st)
+        stream_free(s);
+
+    printf("Session of \033[0;35m%s\033[0m %s after %ld word(s), %d open\n",
+           addr_str(&s->addr), why, s->count, sessions.count);
+    close_file(s->idx);
+    free(s);
+}
+
+struct session *session_open(const struct sockaddr_in *a, struct word_index *idx)
+{
+    /**
+     * A full table makes room by dropping
+     * the session idle for the longest
+     */
+    if (sessions.count == MAX_SESSIONS)
+    {
+        sessions.evicted++;
+        session_close(sessions.head, "evicted");
+    }
+
+    struct session *s = calloc(1, sizeof(struct session));
+    s->addr = *a;
+    s->idx = idx;
+    unsigned int h = hash_addr(a);
+    s->hnext = sessions.buckets[h];
+    sessions.buckets[h] = s;
+    s->last_active = now();
+    idle_push_back(s);
+    sessions.count++;
+    sessions.opened++;
+    return s;
+}
+
+int session_expire()
+{
+    /**
+     * Close every session idle for longer
+     * than idle_timeout and return the time
+     * in ms until the next one  runs  out,
+     * -1 (wait forever) with no sessions
+     */
+    double t = now();
+    while (sessions.head && t - sessions.head->last_active >= idle_timeout)
+    {
+        sessions.expired++;
+        session_close(sessions.head, "expired");
+    }
+    if (!sessions.head)
+        return -1;
+    return (int)((sessions.head->last_active + idle_timeout - t) * 1000) + 1;
+}
+
+//----------- WORD SLICES ------------
+
+/**
+ * Word i of a session's file for i up to end_at,
+ * where the words stop with END. A file that runs
+ * out without an END is ended as if it had one:
+ * word  nwords  is then the string below
+ */
+
+static const char end_word[] = "END", word_sep[] = "\n";
+
+const char *word_at(const struct word_index *w, long i, int *len)
+{
+    if (i >= (long)w->nwords)
+    {
+        *len = 3;
+        return end_word;
+    }
+    *len = w->len[i];
+    return w->text + w->off[i];
+}
+
+int fit_words(const struct word_index *w, long first, long last, int room)
+{
+    /**
+     * How many of the words  first..last  fit
+     * in room bytes (at least one) when they go
+     * out as they are in the file, white space
+     * between them included. Pieces of a word
+     * longer than WI_MAX_WORD and the made up END
+     * cost one more byte for a separating '\n'
+     */
+    long size = 0;
+    int n = 0;
+    for (long k = first; k <= last; k++)
+    {
+        long add;
+        if (k >= (long)w->nwords)
+            add = 3 + (k > first);
+        else if (k == first)
+            add = w->len[k];
+        else
+        {
+            long gap = w->off[k] - (w->off[k - 1] + w->len[k - 1]);
+            add = (gap ? gap : 1) + w->len[k];
+        }
+        if (n && size + add > room)
+            break;
+        size += add;
+        n++;
+    }
+    return n;
+}
+
+int words_iov(const struct word_index *w, long first, int n, struct iovec *iov)
+{
+    /**
+     * Point iov at the words first..first+n-1
+     * inside the mapped file, without copying
+     * them: one entry per run of the file, a
+     * '\n' between two pieces of one word and
+     * the made up END at the end. Returns the
+     * number of entries (at most 8, as a run
+     * that is split holds WI_MAX_WORD bytes and
+     * only one of those fits in a datagram)
+     */
+    int cnt = 0, open = 0;
+    uint64_t from = 0, to = 0;
+    for (long k = first; k < first + n; k++)
+    {
+        if (k >= (long)w->nwords)
+        {
+            if (open)
+                iov[cnt++] = (struct iovec){(void *)(w->text + from), to - from};
+            open = 0;
+            if (k > first)
+                iov[cnt++] = (struct iovec){(void *)word_sep, 1};
+            iov[cnt++] = (struct iovec){(void *)end_word, 3};
+            continue;
+        }
+        if (open && w->off[k] == to)
+        {
+            iov[cnt++] = (struct iovec){(void *)(w->text + from), to - from};
+            iov[cnt++] = (struct iovec){(void *)word_sep, 1};
+            open = 0;
+        }
+        if (!open)
+            from = w->off[k];
+        open = 1;
+        to = w->off[k] + w->len[k];
+    }
+    if (open)
+        iov[cnt++] = (struct iovec){(void *)(w->text + from), to - from};
+    return cnt;
+}
+
+//----------- BATCHED I/O ------------
+
+/**
+ * Datagrams are read up to  batch  at a time with
+ * recvmmsg() and the replies to all of them queue
+ * up here, to leave in one sendmmsg() before the
+ * server goes back to poll(). A queued datagram is
+ * a list of iovecs: the header is copied into hdrs,
+ * the words are pointed at in the mapped file. So
+ * the queue holds a ref on every index it points
+ * into until the flush: the last session on a file
+ * may close meanwhile, on this shard or another.
+ *
+ * With GSO (-g) the datagrams of one WORDS reply go
+ * to the kernel as a single message cut into
+ * MAX_PAYLOAD byte segments (UDP_SEGMENT). All but
+ * the last are padded up to that size with spaces,
+ * which the client skips like any white space.
+ */
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#define TX_BATCH 64   // messages in one sendmmsg()
+#define TX_IOVS 2048
+#define TX_HDRS 512
+#define DGRAM_IOVS 10 // header, words (see words_iov) and padding
+
+struct tx_queue
+{
+    struct mmsghdr msgs[TX_BATCH];
+    struct sockaddr_in addrs[TX_BATCH];
+    char cmsgs[TX_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+    int gso[TX_BATCH];   // segment size, 0 for a plain datagram
+    struct iovec iovs[TX_IOVS];
+    char hdrs[TX_HDRS][32];
+    struct word_index *held[TX_BATCH]; // one ref each, dropped by tx_flush()
+    int n, niov, nhdr, nheld;
+};
+
+struct io_stats
 {
+    long requests, sent;                // datagrams in and out
+    long recv_calls, send_calls, polls; // system calls
+    double since;
+};
 
+__thread struct tx_queue tx;
+__thread struct io_stats io;
+__thread int gso;
+__thread int shard_id;
+int batch = RX_BATCH;
+static char padding[MAX_PAYLOAD];
+
+void tx_unbatch(int sockfd, struct msghdr *m, int seg)
+{
+    /**
+     * GSO refused by the kernel or the device:
+     * send the segments of m one by one, each
+     * of them ends on an iovec boundary
+     */
+    struct msghdr one = *m;
+    one.msg_control = NULL;
+    one.msg_controllen = 0;
+    one.msg_iovlen = 0;
+    size_t bytes = 0;
+    for (size_t k = 0; k < m->msg_iovlen; k++)
+    {
+        one.msg_iovlen++;
+        bytes += m->msg_iov[k].iov_len;
+        if (bytes == (size_t)seg || k + 1 == m->msg_iovlen)
+        {
+            sendmsg(sockfd, &one, 0);
+            io.send_calls++;
+            io.sent++;
+            one.msg_iov += one.msg_iovlen;
+            one.msg_iovlen = 0;
+            bytes = 0;
+        }
+    }
+}
+
+void tx_flush(int sockfd)
+{
+    for (int k = 0; k < tx.n;)
+    {
+        int r = sendmmsg(sockfd, tx.msgs + k, tx.n - k, 0);
+        io.send_calls++;
+        if (r > 0)
+        {
+            for (int j = k; j < k + r; j++)
+                io.sent += tx.gso[j] ? (tx.msgs[j].msg_len + tx.gso[j] - 1) / tx.gso[j] : 1;
+            k += r;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (tx.gso[k])
+        {
+            if (gso)
+                printf("\033[1;31mUDP GSO failed (%s), sending one datagram at a time\033[0m\n",
+                       strerror(errno));
+            gso = 0;
+            tx_unbatch(sockfd, &tx.msgs[k].msg_hdr, tx.gso[k]);
+        }
+        k++; // a datagram that cannot be sent at all is lost
+    }
+    tx.n = tx.niov = tx.nhdr = 0;
+
+    for (int k = 0; k < tx.nheld; k++)
+        close_file(tx.held[k]);
+    tx.nheld = 0;
+}
+
+void tx_begin(int sockfd, const struct sockaddr_in *to, int dgrams)
+{
+    /**
+     * Start a message of up to dgrams datagrams,
+     * flushing the queue first if it is full
+     */
+    if (tx.n >= batch || tx.n == TX_BATCH || tx.niov + dgrams * DGRAM_IOVS > TX_IOVS ||
+        tx.nhdr + dgrams > TX_HDRS)
+        tx_flush(sockfd);
+    struct mmsghdr *m = &tx.msgs[tx.n];
+    memset(m, 0, sizeof(*m));
+    tx.addrs[tx.n] = *to;
+    m->msg_hdr.msg_name = &tx.addrs[tx.n];
+    m->msg_hdr.msg_namelen = sizeof(*to);
+    m->msg_hdr.msg_iov = &tx.iovs[tx.niov];
+    tx.gso[tx.n] = 0;
+}
+
+int tx_add(const char *hdr, int hlen, struct word_index *w, long first, int n, int pad_to)
+{
+    /**
+     * One more datagram in the message begun
+     * last: hlen (< 32) bytes of header, then
+     * words first..first+n-1 and spaces up to
+     * pad_to bytes. Returns its size
+     */
+    struct msghdr *m = &tx.msgs[tx.n].msg_hdr;
+    struct iovec *iov = m->msg_iov + m->msg_iovlen;
+    int cnt = 0, size = 0;
+    if (n)
+    {
+        int k = 0;
+        while (k < tx.nheld && tx.held[k] != w)
+            k++;
+        if (k == tx.nheld) // a message points into one index at most
+        {
+            hold_file(w);
+            tx.held[tx.nheld++] = w;
+        }
+    }
+    if (hlen)
+    {
+        char *h = tx.hdrs[tx.nhdr++];
+        memcpy(h, hdr, hlen);
+        iov[cnt++] = (struct iovec){h, hlen};
+    }
+    if (n)
+        cnt += words_iov(w, first, n, iov + cnt);
+    for (int k = 0; k < cnt; k++)
+        size += iov[k].iov_len;
+    if (size < pad_to)
+    {
+        iov[cnt++] = (struct iovec){padding, pad_to - size};
+        size = pad_to;
+    }
+    m->msg_iovlen += cnt;
+    tx.niov += cnt;
+    return size;
+}
+
+void tx_end(int gso_size)
+{
+    /**
+     * Close the message, as one datagram or as
+     * segments of gso_size bytes
+     */
+    struct msghdr *m = &tx.msgs[tx.n].msg_hdr;
+    if (gso_size)
+    {
+        m->msg_control = tx.cmsgs[tx.n];
+        m->msg_controllen = sizeof(tx.cmsgs[tx.n]);
+        struct cmsghdr *c = CMSG_FIRSTHDR(m);
+        c->cmsg_level = SOL_UDP;
+        c->cmsg_type = UDP_SEGMENT;
+        c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *(uint16_t *)CMSG_DATA(c) = gso_size;
+        tx.gso[tx.n] = gso_size;
+    }
+    tx.n++;
+}
+
+int io_report()
+{
+    /**
+     * Every STATS_INTERVAL seconds of traffic
+     * print the rates and how many system calls
+     * a request took. Returns the time in ms
+     * until the next report, -1 with no traffic
+     */
+    if (!io.requests)
+        return -1;
+    double t = now(), dt = t - io.since;
+    if (dt < STATS_INTERVAL)
+        return (int)((STATS_INTERVAL - dt) * 1000) + 1;
+    long calls = io.recv_calls + io.send_calls + io.polls;
+    printf("\033[0;33mShard %d: %.0f requests/s, %.0f datagrams/s sent, %.2f system calls per request "
+           "(%.1f requests per recvmmsg, %.1f datagrams per send), %d session(s)\033[0m\n",
+           shard_id, io.requests / dt, io.sent / dt, (double)calls / io.requests,
+           (double)io.requests / (io.recv_calls ? io.recv_calls : 1),
+           (double)io.sent / (io.send_calls ? io.send_calls : 1), sessions.count);
+    memset(&io, 0, sizeof(io));
+    return -1;
+}
+
+//----------- REQUESTS ------------
+
+void reply(int sockfd, const struct sockaddr_in *cliaddr, const char *msg)
+{
+    tx_begin(sockfd, cliaddr, 1);
+    tx_add(msg, strlen(msg), NULL, 0, 0, 0);
+    tx_end(0);
+}
+
+void reply_word(int sockfd, const struct sockaddr_in *cliaddr, struct word_index *w, long i)
+{
+    int len;
+    const char *word = word_at(w, i, &len);
+    tx_begin(sockfd, cliaddr, 1);
+    tx_add(NULL, 0, w, i, 1, 0);
+    tx_end(0);
+    if (verbose)
+        printf("Sending \033[0;32m%.*s\033[0m\n\n", len, word);
+}
+
+void open_session(int sockfd, const struct sockaddr_in *cliaddr, const char *file)
+{
+    /**
+     * A datagram that is not a WORDi request
+     * names a file and starts a new session
+     * for the client, replacing its old one
+     */
+    printf("File Requested by \033[0;35m%s\033[0m: \033[0;35m%s\033[0m\n",
+           addr_str(cliaddr), file);
+
+    struct session *old = session_find(cliaddr);
+    if (old)
+        session_close(old, "restarted");
+
+    struct word_index *w = open_file(file);
+    if (!w)
+    {
+        /**
+         * send  FILE_NOT_FOUND  message
+         * to  the  client  if  the file
+         * requested was  not  found  on
+         * the server (i.e. w is NULL)
+         */
+        reply(sockfd, cliaddr, "FILE_NOT_FOUND");
+        return;
+    }
+
+    /**
+     * The first word of the file has to be
+     * a HELLO.  This is required to make
+     * sure that the file requested is in
+     * the correct format. open_file() does
+     * not even index a file without it
+     */
+
+    if (!w->nwords)
+    {
+        reply(sockfd, cliaddr, "WRONG_FILE_FORMAT");
+        close_file(w);
+        return;
+    }
+
+    session_open(cliaddr, w);
+    reply_word(sockfd, cliaddr, w, 0);
+}
+
+struct session *request_session(const struct sockaddr_in *cliaddr, const char *msg)
+{
+    struct session *s = session_find(cliaddr);
+    if (!s)
+    {
+        printf("\033[1;31mIgnored request without a session from %s\033[0m\n", addr_str(cliaddr));
+        return NULL;
+    }
+    session_touch(s);
+    if (verbose)
+        printf("Request for  \033[0;31m%s\033[0m from %s\n", msg, addr_str(cliaddr));
+    return s;
+}
+
+void end_session(struct session *s)
+{
+    /**
+     * The session ends with the word  END,
+     * as the client stops asking after it
+     */
+    sessions.finished++;
+    session_close(s, "finished");
+}
+
+int ask_words(struct session *s, long first, long last)
+{
+    /**
+     * Note that words first..last were asked
+     * for and return 1 once every word up to
+     * END has been. Requests can arrive out of
+     * order, so the one for END does not end
+     * the session while an earlier range is
+     * still on its way. Ranges past a gap are
+     * kept until the gap fills; if there are
+     * too many, the session just idles out
+     */
+    if (first > s->asked + 1)
+    {
+        if (s->ngaps < ASKED_RANGES)
+        {
+            s->gaps[s->ngaps].first = first;
+            s->gaps[s->ngaps++].last = last;
+        }
+        return 0;
+    }
+    if (last > s->asked)
+        s->asked = last;
+    for (int k = 0; k < s->ngaps; k++)
+        if (s->gaps[k].first <= s->asked + 1)
+        {
+            if (s->gaps[k].last > s->asked)
+                s->asked = s->gaps[k].last;
+            s->gaps[k] = s->gaps[--s->ngaps];
+            k = -1; // it may close an earlier gap
+        }
+    return s->asked >= s->idx->end_at;
+}
+
+void serve_word(int sockfd, const struct sockaddr_in *cliaddr, const char *msg)
+{
+    /**
+     * WORDi asks for the ith word of the file,
+     * anything past END is answered with END
+     */
+    char *end;
+    long i = strtol(msg + 4, &end, 10);
+    if (*end || end == msg + 4 || i < 1)
+    {
+        printf("\033[1;31mIgnored bad request from %s\033[0m\n", addr_str(cliaddr));
+        return;
+    }
+    struct session *s = request_session(cliaddr, msg);
+    if (!s)
+        return;
+
+    long end_at = s->idx->end_at;
+    s->count = i < end_at ? i : end_at;
+    reply_word(sockfd, cliaddr, s->idx, s->count);
+    if (ask_words(s, s->count, s->count))
+        end_session(s);
+}
+
+void serve_words(int sockfd, const struct sockaddr_in *cliaddr, const char *msg)
+{
+    /**
+     * WORDS i..j asks for words i to j in as few
+     * datagrams as possible. Every datagram is
+     *
+     *      WORDS <first> <n>\n
+     *      <word> ... (n words)
+     *
+     * with the words separated by white space,
+     * as they are in the file, filled up to
+     * MAX_PAYLOAD bytes so that a reply is never
+     * fragmented by IP. The words stop early at
+     * END, which is sent as a word.
+     *
+     * A request is a few bytes from an address
+     * nobody checked, so a reply is held to
+     * MAX_REPLY datagrams. If the words do not
+     * fit, the last datagram says  <n>+  and the
+     * client asks again from first + n. A whole
+     * file at once is what the stream is for
+     */
+    long i, j;
+    int used;
+    if (sscanf(msg, "WORDS %ld..%ld%n", &i, &j, &used) != 2 || msg[used] || i < 1 || j < i)
+    {
+        printf("\033[1;31mIgnored bad request from %s\033[0m\n", addr_str(cliaddr));
+        return;
+    }
+    struct session *s = request_session(cliaddr, msg);
+    if (!s)
+        return;
+
+    struct word_index *w = s->idx;
+    long end_at = w->end_at;
+    long first = i < end_at ? i : end_at, last = j < end_at ? j : end_at;
+    char hdr[32];
+    int per_msg = gso ? MAX_REPLY : 1, segs = 0, dgrams = 0;
+    long k = first;
+    while (k <= last)
+    {
+        int n = fit_words(w, k, last, MAX_PAYLOAD - sizeof(hdr));
+        int cut = k + n <= last && ++dgrams == MAX_REPLY;
+        int hlen = sprintf(hdr, "WORDS %ld %d%s\n", k, n, cut ? "+" : "");
+        if (!segs)
+            tx_begin(sockfd, cliaddr, per_msg);
+        k += n;
+        int more = k <= last && !cut;
+        tx_add(hdr, hlen, w, k - n, n, gso && more ? MAX_PAYLOAD : 0);
+        if (++segs == per_msg || !more)
+        {
+            tx_end(segs > 1 ? MAX_PAYLOAD : 0);
+            segs = 0;
+        }
+        if (cut)
+            break;
+    }
+    s->count = k - 1;
+    if (verbose)
+        printf("Sent words \033[0;32m%ld..%ld\033[0m\n\n", first, k - 1);
+    if (ask_words(s, first, k - 1))
+        end_session(s);
+}
+
+//----------- RELIABLE STREAMS ------------
+
+/**
+ * An ACK request turns the session into a stream:
+ * the server pushes the words by itself in numbered
+ * segments
+ *
+ *      SEG <seq> <n>\n<word> ... (n words)
+ *
+ * which the client acknowledges with
+ *
+ *      ACK <next> <window> [<a>-<b> ...]
+ *
+ * next   -> every segment before it arrived
+ * window -> segments it takes from next on
+ * a-b    -> SACK blocks: a .. b-1 arrived
+ *
+ * The first ACK (ACK 0 ...) starts the stream. The
+ * last segment ends with END and the session is over
+ * once that is acknowledged. A segment only keeps
+ * which words it carries, it is put together again
+ * from the mapped file whenever it is sent.
+ *
+ * Loss recovery and congestion control work like TCP.
+ * The RTT is sampled from segments sent only once
+ * (Karn) and gives the retransmission timeout as in
+ * RFC 6298. A segment is lost, and sent again at
+ * once, when DUP_THRESH segments above it were SACKed
+ * or when a segment sent more than srtt / 4 after it
+ * was delivered (as in RACK, which also catches lost
+ * retransmissions). The congestion window is then
+ * halved, once per window of data. A timeout marks the whole flight lost, drops
+ * the window to one segment and doubles the timeout.
+ * Otherwise the window grows by one segment for every
+ * segment delivered (slow start) and then by one per
+ * window (AIMD).
+ */
+
+#define SEG_SENT 1   // in flight
+#define SEG_SACKED 2 // arrived, before a hole
+#define SEG_LOST 3   // to be sent again
+#define SEG_RESENT 4 // sent again, in flight
+
+struct segment
+{
+    long first;     // words first .. first + n - 1
+    int n;
+    int state;
+    int resent;     // sent more than once, no RTT sample
+    double sent_at;
+};
+
+struct stream
+{
+    struct segment segs[STREAM_WINDOW]; // segment seq at seq % STREAM_WINDOW
+    long una, nxt;                      // oldest unacknowledged, next new
+    long high_sacked;                   // above the highest SACKed segment
+    double rack;                        // latest send time of a delivered segment
+    long recover;                       // end of the current recovery
+    long rwnd;                          // window of the client
+    double cwnd, ssthresh;              // in segments
+    double srtt, rttvar, rto;           // seconds
+    double deadline;                    // retransmission timer, 0 = off
+    double started;
+    int timeouts;                       // in a row
+    long next_word;                     // first word of the next new segment
+    int eof;                            // END is in a segment
+    long sent, resent, rto_count;       // statistics
+    struct session *owner;
+    struct stream *prev, *next;         // all streams
+};
+
+__thread struct stream *streams;
+
+void stream_free(struct session *s)
+{
+    struct stream *st = s->st;
+    if (st->prev)
+        st->prev->next = st->next;
+    else
+        streams = st->next;
+    if (st->next)
+        st->next->prev = st->prev;
+    free(st);
+    s->st = NULL;
+}
+
+struct stream *stream_start(struct session *s)
+{
+    struct stream *st = calloc(1, sizeof(struct stream));
+    st->owner = s;
+    st->cwnd = INIT_CWND;
+    st->ssthresh = STREAM_WINDOW;
+    st->rto = INIT_RTO;
+    st->rwnd = STREAM_WINDOW;
+    st->next_word = 1;
+    st->started = now();
+    st->next = streams;
+    if (streams)
+        streams->prev = st;
+    streams = st;
+    s->st = st;
+    return st;
+}
+
+void build_segment(struct session *s, struct segment *seg)
+{
+    /**
+     * The next words, as many as fit in a
+     * datagram like a WORDS reply
+     */
+    struct stream *st = s->st;
+    long end_at = s->idx->end_at;
+    seg->first = st->next_word;
+    seg->n = fit_words(s->idx, seg->first, end_at, MAX_PAYLOAD - 32);
+    st->next_word += seg->n;
+    st->eof = st->next_word > end_at;
+    s->count = st->next_word - 1;
+    seg->resent = 0;
+}
+
+void send_segment(int sockfd, struct session *s, struct segment *seg, long seq)
+{
+    struct stream *st = s->st;
+    char hdr[32];
+    tx_begin(sockfd, &s->addr, 1);
+    tx_add(hdr, sprintf(hdr, "SEG %ld %d\n", seq, seg->n), s->idx, seg->first, seg->n, 0);
+    tx_end(0);
+    seg->sent_at = now();
+    st->sent++;
+    if (!st->deadline)
+        st->deadline = seg->sent_at + st->rto;
+}
+
+void stream_transmit(int sockfd, struct session *s)
+{
+    /**
+     * Fill the congestion window: the segments
+     * found lost first, then new ones as far as
+     * the window of the client goes
+     */
+    struct stream *st = s->st;
+    long pipe = 0;
+    for (long q = st->una; q < st->nxt; q++)
+        pipe += st->segs[q % STREAM_WINDOW].state == SEG_SENT ||
+                st->segs[q % STREAM_WINDOW].state == SEG_RESENT;
+
+    for (long q = st->una; q < st->nxt && pipe < st->cwnd; q++)
+    {
+        struct segment *seg = &st->segs[q % STREAM_WINDOW];
+        if (seg->state != SEG_LOST)
+            continue;
+        seg->state = SEG_RESENT;
+        seg->resent = 1;
+        st->resent++;
+        send_segment(sockfd, s, seg, q);
+        pipe++;
+    }
+
+    long limit = st->rwnd < STREAM_WINDOW ? st->rwnd : STREAM_WINDOW;
+    while (pipe < st->cwnd && !st->eof && st->nxt - st->una < limit)
+    {
+        struct segment *seg = &st->segs[st->nxt % STREAM_WINDOW];
+        build_segment(s, seg);
+        seg->state = SEG_SENT;
+        send_segment(sockfd, s, seg, st->nxt);
+        st->nxt++;
+        pipe++;
+    }
+}
+
+void rtt_sample(struct stream *st, double r)
+{
+    /**
+     * RFC 6298: smoothed RTT and its variation,
+     * the timeout is srtt + 4 rttvar
+     */
+    if (!st->srtt)
+    {
+        st->srtt = r;
+        st->rttvar = r / 2;
+    }
+    else
+    {
+        st->rttvar = 0.75 * st->rttvar + 0.25 * fabs(st->srtt - r);
+        st->srtt = 0.875 * st->srtt + 0.125 * r;
+    }
+    st->rto = st->srtt + 4 * st->rttvar;
+    st->rto = st->rto < MIN_RTO ? MIN_RTO : st->rto > MAX_RTO ? MAX_RTO : st->rto;
+}
+
+void stream_report(struct session *s)
+{
+    struct stream *st = s->st;
+    printf("\033[0;33mStream to %s: %ld segments, %ld sent again, %ld timeout(s), "
+           "cwnd %.1f, srtt %.3f ms, %.3f s\033[0m\n",
+           addr_str(&s->addr), st->nxt, st->resent, st->rto_count,
+           st->cwnd, st->srtt * 1e3, now() - st->started);
+}
+
+void serve_ack(int sockfd, const struct sockaddr_in *cliaddr, const char *msg)
+{
+    long next, win;
+    int used;
+    if (sscanf(msg, "ACK %ld %ld%n", &next, &win, &used) != 2 || next < 0 || win < 1)
+    {
+        printf("\033[1;31mIgnored bad request from %s\033[0m\n", addr_str(cliaddr));
+        return;
+    }
+    struct session *s = request_session(cliaddr, msg);
+    if (!s)
+        return;
+    struct stream *st = s->st ? s->st : stream_start(s);
+    if (next > st->nxt)
+        return;
+
+    double t = now(), sample = -1, rack = 0;
+    long delivered = 0;
+    st->rwnd = win;
+
+    /**
+     * Cumulative part: free everything before next
+     */
+    if (next > st->una)
+    {
+        for (long q = st->una; q < next; q++)
+        {
+            struct segment *seg = &st->segs[q % STREAM_WINDOW];
+            if (seg->state != SEG_SACKED)
+            {
+                delivered++;
+                if (!seg->resent)
+                    sample = t - seg->sent_at;
+                if (seg->sent_at > rack)
+                    rack = seg->sent_at;
+            }
+            seg->state = 0;
+        }
+        st->una = next;
+        st->timeouts = 0;
+        st->deadline = st->una < st->nxt ? t + st->rto : 0;
+    }
+
+    /**
+     * SACK blocks: segments that arrived past a hole
+     */
+    const char *p = msg + used;
+    long a, b;
+    while (sscanf(p, " %ld-%ld%n", &a, &b, &used) == 2)
+    {
+        p += used;
+        for (long q = a > st->una ? a : st->una; q < b && q < st->nxt; q++)
+        {
+            struct segment *seg = &st->segs[q % STREAM_WINDOW];
+            if (seg->state == SEG_SACKED)
+                continue;
+            delivered++;
+            if (!seg->resent)
+                sample = t - seg->sent_at;
+            if (seg->sent_at > rack)
+                rack = seg->sent_at;
+            seg->state = SEG_SACKED;
+            if (q + 1 > st->high_sacked)
+                st->high_sacked = q + 1;
+        }
+    }
+    if (sample >= 0)
+        rtt_sample(st, sample);
+    if (rack > st->rack)
+        st->rack = rack;
+
+    /**
+     * Loss: DUP_THRESH segments SACKed past a
+     * segment still in flight, or one sent well
+     * after it delivered first
+     */
+    int lost = 0;
+    for (long q = st->una; q < st->nxt; q++)
+    {
+        struct segment *seg = &st->segs[q % STREAM_WINDOW];
+        if ((seg->state == SEG_SENT && q + DUP_THRESH < st->high_sacked) ||
+            ((seg->state == SEG_SENT || seg->state == SEG_RESENT) &&
+             seg->sent_at + st->srtt / 4 < st->rack))
+        {
+            seg->state = SEG_LOST;
+            lost = 1;
+        }
+    }
+    if (lost && st->una >= st->recover)
+    {
+        st->ssthresh = st->cwnd / 2 < 2 ? 2 : st->cwnd / 2;
+        st->cwnd = st->ssthresh;
+        st->recover = st->nxt;
+    }
+    else if (delivered && st->una >= st->recover)
+    {
+        st->cwnd += st->cwnd < st->ssthresh ? delivered : (double)delivered / st->cwnd;
+        if (st->cwnd > STREAM_WINDOW)
+            st->cwnd = STREAM_WINDOW;
+    }
+
+    if (st->eof && st->una == st->nxt)
+    {
+        stream_report(s);
+        end_session(s);
+        return;
+    }
+    stream_transmit(sockfd, s);
+}
+
+void stream_timeout(int sockfd, struct session *s)
+{
+    struct stream *st = s->st;
+    st->rto_count++;
+    if (++st->timeouts > MAX_TIMEOUTS)
+    {
+        stream_report(s);
+        session_close(s, "lost");
+        return;
+    }
+    st->ssthresh = st->cwnd / 2 < 2 ? 2 : st->cwnd / 2;
+    st->cwnd = 1;
+    st->rto = st->rto * 2 > MAX_RTO ? MAX_RTO : st->rto * 2;
+    for (long q = st->una; q < st->nxt; q++)
+    {
+        struct segment *seg = &st->segs[q % STREAM_WINDOW];
+        if (seg->state == SEG_SENT || seg->state == SEG_RESENT)
+            seg->state = SEG_LOST;
+    }
+    st->recover = st->nxt;
+    st->deadline = 0;
+    stream_transmit(sockfd, s);
+}
+
+int streams_run(int sockfd)
+{
+    /**
+     * Fire the retransmission timers that ran
+     * out and return the time in ms until the
+     * next one, -1 when none is running
+     */
+    double t = now(), first = 0;
+    for (struct stream *st = streams, *next; st; st = next)
+    {
+        next = st->next;
+        if (st->deadline && st->deadline <= t)
+            stream_timeout(sockfd, st->owner);
+    }
+    for (struct stream *st = streams; st; st = st->next)
+        if (st->deadline && (!first || st->deadline < first))
+            first = st->deadline;
+    if (!first)
+        return -1;
+    return first <= t ? 0 : (int)((first - t) * 1000) + 1;
+}
+
+//----------- SHARDS ------------
+
+/**
+ * With -n <shards> the server runs that many threads,
+ * each on its own socket bound to PORT with
+ * SO_REUSEPORT. The kernel picks the socket for a
+ * datagram by a hash of its addresses and ports, so
+ * all requests of one client reach the same shard.
+ * That is why the session table, the streams and the
+ * send queue are simply per thread (__thread above);
+ * only the word indexes are shared (their list under
+ * index_lock, their refs counted with atomics).
+ *
+ * -c pins shard i to CPU i (modulo the CPUs there
+ * are). Every STATS_INTERVAL seconds of traffic the
+ * main thread prints how the requests spread over
+ * the shards.
+ */
+
+#define MAX_SHARDS 64
+
+struct shard
+{
+    int id, fd, cpu;
+    long requests; // since the last balance report
+    int sessions;
+    pthread_t thread;
+};
+
+struct shard shards[MAX_SHARDS];
+__thread struct shard *self;
+int nshards = 1, pin = 0, use_gso = 0;
+
+int server_socket()
+{
     /**
      * First we need to setup the UDP  socket
      * after which we will bind the socket to
@@ -101,7 +1338,7 @@ int main()
      */
 
     int sockfd;
-    struct sockaddr_in servaddr, cliaddr;
+    struct sockaddr_in servaddr;
 
     /**
      * Create the socket file descriptor
@@ -114,7 +1351,6 @@ int main()
         exit(EXIT_FAILURE);
     }
     memset(&servaddr, 0, sizeof(servaddr));
-    memset(&cliaddr, 0, sizeof(cliaddr));
 
     /**
      *  Filling server information
@@ -134,6 +1370,16 @@ int main()
     servaddr.sin_addr.s_addr = INADDR_ANY;
     servaddr.sin_port = htons(PORT);
 
+    /**
+     * Only shards share the port. A single
+     * shard leaves SO_REUSEPORT off, so that a
+     * second server fails here instead of
+     * silently taking half of the clients
+     */
+    int one = 1;
+    if (nshards > 1)
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
     /** 
      * Bind the socket with the server address
      */
@@ -145,156 +1391,215 @@ int main()
         exit(EXIT_FAILURE);
     }
 
-    printf("\
-    Connection is successfully established !!\n\
-    \033[0;32m\n\
-    *************************************\n\
-    *                                   *\n\
-    *       WELCOME TO THE SERVER       *\n\
-    *                                   *\n\
-    *      ALL STARTUP PROCESSES        *\n\
-    *      SUCCESSFULLY EXECUTED        *\n\
-    *                                   *\n\
-    *************************************\n\
-    \033[0m\n\
-    Waiting for client request ...\n\n");
+    /**
+     * Requests of many clients arrive in bursts,
+     * a larger receive buffer queues them instead
+     * of dropping them (capped at rmem_max)
+     */
+    int rcvbuf = 4 << 20;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
 
     /**
-     * Keep listening on the port from the 
-     * client unless the  client  requests
-     * for  a  valid file. A valid file is 
-     * one which exists in the  server  as
-     * well  as  the first word is "HELLO"
-     * 
-     * File name is stored in Char[] file
-     * Error message is in Char[] err_msg
+     * Kernels before 4.18 do not know UDP_SEGMENT,
+     * setting it to 0 (per message instead) tells
      */
+    int zero = 0;
+    if (use_gso && setsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) < 0)
+    {
+        printf("\033[1;31mUDP GSO is not supported here, sending one datagram at a time\033[0m\n");
+        use_gso = 0;
+    }
+    return sockfd;
+}
+
+void *shard_main(void *arg)
+{
+    self = arg;
+    shard_id = self->id;
+    gso = use_gso;
+    int sockfd = self->fd;
+    struct sockaddr_in cliaddr;
 
-    char file[MAXLINE];
-    char word[MAXLINE];
-    char *err_msg;
-    FILE *fin;
+    if (pin)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(self->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            printf("\033[1;31mShard %d could not be pinned to CPU %d\033[0m\n", self->id, self->cpu);
+    }
 
-    int sz = sizeof(cliaddr);
-    int len = recvfrom(sockfd, (char *)file, MAXLINE,
-                       MSG_WAITALL, (struct sockaddr *)&cliaddr,
-                       &sz);
-    file[len] = '\0';
-    printf("File Requested by client: \033[0;35m%s\033[0m\n", file);
+    /**
+     * Keep serving datagrams from any client.
+     * A request of the form WORDi asks for the
+     * ith word of the file of the  client's
+     * session, WORDS i..j for words i to j in
+     * full datagrams and ACK starts (and then
+     * drives) a reliable stream of all of the
+     * words.  Anything else is the
+     * name of a file to start a new session
+     * with.  The file has to exist  on  the
+     * server and its first word must be HELLO
+     *
+     * Between datagrams the server sleeps in
+     * poll() no longer than until the oldest
+     * session runs idle or the first stream
+     * needs a retransmission. Everything queued
+     * for sending meanwhile leaves just before
+     */
 
-    fin = open_file(file);
-    if (!fin)
+    static __thread char msgs[RX_BATCH][MAXLINE];
+    struct sockaddr_in addrs[RX_BATCH];
+    struct iovec iovs[RX_BATCH];
+    struct mmsghdr rx[RX_BATCH];
+    memset(rx, 0, sizeof(rx));
+    for (int k = 0; k < RX_BATCH; k++)
     {
-        /**
-             * send  FILE_NOT_FOUND  message
-             * to  the  client  if  the file
-             * requested was  not  found  on 
-             * the server (i.e. fin is NULL)
-             * After this  close  the socket
-             * file descriptor
-             */
-        err_msg = "FILE_NOT_FOUND";
-        sendto(sockfd, (const char *)err_msg, strlen(err_msg),
-               MSG_CONFIRM, (const struct sockaddr *)&cliaddr,
-               sz);
-
-        close(sockfd);
-        return 0;
+        iovs[k] = (struct iovec){msgs[k], MAXLINE - 1};
+        rx[k].msg_hdr.msg_iov = &iovs[k];
+        rx[k].msg_hdr.msg_iovlen = 1;
+        rx[k].msg_hdr.msg_name = &addrs[k];
     }
-    else
+
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+    while (1)
     {
-        /**
-             * We  read  the first content of the 
-             * file to ensure that it starts with 
-             * a HELLO.  This is required to make 
-             * sure that the file requested is in 
-             * the correct format.
-             */
-
-        fscanf(fin, "%s", word);
-        if (strcasecmp(word, "HELLO") != 0)
+        int timeout = session_expire();
+        int rto = streams_run(sockfd);
+        if (rto >= 0 && (timeout < 0 || rto < timeout))
+            timeout = rto;
+        int report = io_report();
+        if (report >= 0 && (timeout < 0 || report < timeout))
+            timeout = report;
+        tx_flush(sockfd);
+        __atomic_store_n(&self->sessions, sessions.count, __ATOMIC_RELAXED);
+        io.polls++;
+        if (poll(&pfd, 1, timeout) < 0)
         {
-            /**
-                 * If the requested  file is not in
-                 * the  correct   format  then  the 
-                 * server will send a error message 
-                 * indicating  that the file is not 
-                 * in correct format and close  the
-                 * socket  file  descriptor.
-                 */
-
-            err_msg = "WRONG_FILE_FORMAT";
-            sendto(sockfd, (const char *)err_msg, strlen(err_msg),
-                   MSG_CONFIRM, (const struct sockaddr *)&cliaddr,
-                   sz);
-
-            close(sockfd);
-            return 0;
+            if (errno == EINTR)
+                continue;
+            perror("\033[0;31mpoll failed!!\033[0m\n");
+            break;
         }
-        else
+        if (!(pfd.revents & POLLIN))
+            continue;
+
+        for (int k = 0; k < batch; k++)
+            rx[k].msg_hdr.msg_namelen = sizeof(addrs[k]);
+        int n = recvmmsg(sockfd, rx, batch, MSG_DONTWAIT, NULL);
+        io.recv_calls++;
+        if (n <= 0)
+            continue;
+        if (!io.requests)
+            io.since = now();
+        io.requests += n;
+        __atomic_fetch_add(&self->requests, n, __ATOMIC_RELAXED);
+
+        for (int k = 0; k < n; k++)
         {
-            /**
-                 * If the file is in  correct  format 
-                 * then send the hello message ( that 
-                 * was  read  from  the file ) to the 
-                 * client.
-                 */
-
-            sendto(sockfd, (const char *)word, strlen(word),
-                   MSG_CONFIRM, (const struct sockaddr *)&cliaddr,
-                   sz);
+            char *msg = msgs[k];
+            msg[rx[k].msg_len] = '\0';
+            cliaddr = addrs[k];
+            if (strncmp(msg, "ACK ", 4) == 0)
+                serve_ack(sockfd, &cliaddr, msg);
+            else if (strncmp(msg, "WORDS ", 6) == 0)
+                serve_words(sockfd, &cliaddr, msg);
+            else if (strncmp(msg, "WORD", 4) == 0)
+                serve_word(sockfd, &cliaddr, msg);
+            else
+                open_session(sockfd, &cliaddr, msg);
         }
     }
 
+    close(sockfd);
+    return NULL;
+}
+
+void balance_report()
+{
     /**
-     * Read the message  from the   client
-     * which will be of the  format  WORDi
-     * which will represent  the ith  word
-     * that needs to be read from the file 
-     * and sent. 
-     * The communication between client  and
-     * the server ends when the word END has
-     * been read by the user hence after END
-     * has  been  sent  by  the  server  the 
-     * connection is closed
+     * Share of the requests of every shard since
+     * the last report and the busiest shard over
+     * the mean (1.00 is a perfect spread)
      */
-    while (1)
+    long load[MAX_SHARDS], total = 0, max = 0;
+    for (int i = 0; i < nshards; i++)
     {
-        fscanf(fin, "%s", word);
-        sz = sizeof(cliaddr);
-
-        /**
-         * Recieve the  message  requestion
-         * for the  WORDi  from  the client 
-         * side  and then send the response 
-         * with the  word requested back to 
-         * the client
-         */
-        char msg[MAXLINE];
-        int len = recvfrom(sockfd, (char *)msg, MAXLINE,
-                           MSG_WAITALL, (struct sockaddr *)&cliaddr,
-                           &sz);
-        msg[len] = '\0';
-
-        /**
-         * Assert that the request  in  the datagram
-         * is for the ith word,  that is the request 
-         * is of the proper type otherwise terminate 
-         * connection
-         */
-
-        printf("Request for  \033[0;31m%s\033[0m\n", msg);
-        assert(msg[0] == 'W' && msg[1] == 'O' && msg[2] == 'R' && msg[3] == 'D');
-        printf("Sending \033[0;32m%s\033[0m\n\n", word);
+        load[i] = __atomic_exchange_n(&shards[i].requests, 0, __ATOMIC_RELAXED);
+        total += load[i];
+        max = load[i] > max ? load[i] : max;
+    }
+    if (!total)
+        return;
+    printf("\033[0;33mShard load:");
+    for (int i = 0; i < nshards; i++)
+        printf("  %d: %.1f%% (%d)", i, 100.0 * load[i] / total,
+               __atomic_load_n(&shards[i].sessions, __ATOMIC_RELAXED));
+    printf(",  busiest / mean %.2f\033[0m\n", (double)max * nshards / total);
+}
 
-        sendto(sockfd, (const char *)word, strlen(word),
-               MSG_CONFIRM, (const struct sockaddr *)&cliaddr,
-               sz);
+/**         DRIVER CODE         **/
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            idle_timeout = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-q"))
+            verbose = 0;
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            batch = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-g"))
+            use_gso = 1;
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            nshards = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c"))
+            pin = 1;
+        else
+        {
+            printf("Usage: %s [-t <idle seconds>] [-q] [-b <batch>] [-g] [-n <shards>] [-c]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (idle_timeout < 1)
+        idle_timeout = 1;
+    batch = batch < 1 ? 1 : batch > RX_BATCH ? RX_BATCH : batch;
+    nshards = nshards < 1 ? 1 : nshards > MAX_SHARDS ? MAX_SHARDS : nshards;
 
-        if (strcasecmp(word, "END") == 0)
-            break;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < nshards; i++)
+    {
+        shards[i].id = i;
+        shards[i].cpu = i % (ncpu < 1 ? 1 : ncpu);
+        shards[i].fd = server_socket();
     }
+    memset(padding, ' ', sizeof(padding));
 
-    close(sockfd);
+    printf("\
+    Connection is successfully established !!\n\
+    \033[0;32m\n\
+    *************************************\n\
+    *                                   *\n\
+    *       WELCOME TO THE SERVER       *\n\
+    *                                   *\n\
+    *      ALL STARTUP PROCESSES        *\n\
+    *      SUCCESSFULLY EXECUTED        *\n\
+    *                                   *\n\
+    *************************************\n\
+    \033[0m\n\
+    Waiting for client request ...\n\n");
+    if (nshards > 1 || pin)
+        printf("\033[0;33m%d shard(s)%s\033[0m\n\n", nshards, pin ? ", pinned to CPUs" : "");
+
+    for (int i = 0; i < nshards; i++)
+        pthread_create(&shards[i].thread, NULL, shard_main, &shards[i]);
+    if (nshards == 1)
+        pthread_join(shards[0].thread, NULL);
+    else
+        while (1)
+        {
+            sleep(STATS_INTERVAL);
+            balance_report();
+        }
     return 0;
 }
@@ -19,8 +19,12 @@
  * 
  *      How to run:
  *      -----------
- *      $ gcc file_client.c -o client
+ *      $ gcc file_client.c -o client -lpthread
  *      $ ./client
+ *
+ *      Counting a local file (e.g. a finished download)
+ *      with N threads, no server involved:
+ *      $ ./client -l <file> [N]
  */
 
 // Client side C/C++ program to demonstrate Socket programming
@@ -31,13 +35,20 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
+#include "wordcount.h"
+
 #define PORT 8080
+#ifndef MAXLEN // file_bench.c builds other chunk sizes
 #define MAXLEN 100
+#endif
 
 //------------------- UTILITY FUNCTIONS -------------
 
@@ -57,36 +68,138 @@ int open_file(const char *s)
     return fd;
 }
 
-int check(char c)
+void get_words(struct wc_state *st, const char *buf, int len)
 {
-    return c == ',' || c == ';' || c == ':' || c == '.' || isspace(c);
+    /*
+     * count the words in the next len bytes of the
+     * file, all given punctuations are separators.
+     * st carries over whether the previous chunk
+     * ended inside a word (see wordcount.h)
+     */
+    wc_feed(st, buf, len);
 }
 
-int get_words(const char *buf)
+//------------------- LOCAL FILE STATISTICS ---------
+
+/*
+ * The file is mapped once and cut into one slice per
+ * thread. Every cut is moved forward to just after a
+ * separator so that no word is shared by two slices,
+ * then each thread counts its slice with the SIMD
+ * counter and the totals are simply added up.
+ */
+
+struct wc_job
+{
+    const unsigned char *p;   // start of the slice
+    size_t n;                 // bytes in the slice
+    struct wc_state st;       // counts of the slice
+};
+
+double now()
 {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void *wc_worker(void *arg)
+{
+    struct wc_job *job = arg;
     /*
-     * obtain the number of words in char array buf
-     * consider all given punctuations as separator
+     * madvise() wants a page aligned start, the slice is
+     * stretched back to its page. The advice values are
+     * not flags and have to be given one at a time
      */
-    int n = strlen(buf);
-    int words = 0, cur = 0;
-    for (int i = 0; i < n; i++)
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)job->p & ~(page - 1);
+    size_t len = job->n + ((uintptr_t)job->p - start);
+    madvise((void *)start, len, MADV_SEQUENTIAL);
+    madvise((void *)start, len, MADV_WILLNEED);
+    wc_begin(&job->st);
+    wc_feed(&job->st, job->p, job->n);
+    return NULL;
+}
+
+int local_stats(const char *path, int nthreads)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        printf("\033[1;36mCouldn't open %s\033[0m\n\n", path);
+        return 1;
+    }
+    size_t size = st.st_size;
+    const unsigned char *p = NULL;
+    if (size > 0)
     {
-        if (check(buf[i]))
+        p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
         {
-            words += (cur > 0 ? 1 : 0);
-            cur = 0;
+            perror("mmap");
+            return 1;
         }
-        else
-            cur++;
     }
-    return words;
+    close(fd);
+
+    if (nthreads < 1)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct wc_job *jobs = calloc(nthreads, sizeof(struct wc_job));
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+
+    double start = now();
+    size_t begin = 0;
+    for (int i = 0; i < nthreads; i++)
+    {
+        size_t end = i == nthreads - 1 ? size : size / nthreads * (i + 1);
+        if (end < begin)
+            end = begin;
+        while (end < size && end > 0 && !wc_is_sep(p[end - 1]))
+            end++;
+        jobs[i].p = p + begin;
+        jobs[i].n = end - begin;
+        begin = end;
+        pthread_create(&threads[i], NULL, wc_worker, &jobs[i]);
+    }
+
+    struct wc_state total;
+    wc_begin(&total);
+    for (int i = 0; i < nthreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        total.words += jobs[i].st.words;
+        total.lines += jobs[i].st.lines;
+    }
+    double elapsed = now() - start;
+
+    printf("\n\
+        ************************************\n\
+            \033[0;35mSize  of  file\033[0m  = \033[1;36m%zu bytes\033[0m\n\
+            \033[0;35mNumber of words\033[0m = \033[1;36m%lld\033[0m\n\
+            \033[0;35mNumber of lines\033[0m = \033[1;36m%lld\033[0m\n\
+        ************************************\n\n",
+           size, total.words, total.lines);
+    printf("\033[0;33m%d thread(s), %.3f s, %.2f GB/s\033[0m\n",
+           nthreads, elapsed, elapsed > 0 ? size / elapsed / 1e9 : 0.0);
+
+    if (size > 0)
+        munmap((void *)p, size);
+    free(jobs);
+    free(threads);
+    return 0;
 }
 
 /**         DRIVER CODE         **/
 
 int main(int argc, char const *argv[])
 {
+    if (argc >= 3 && strcmp(argv[1], "-l") == 0)
+    {
+        wc_init();
+        return local_stats(argv[2], argc > 3 ? atoi(argv[3]) : 0);
+    }
+
     /*
      * create the socket
      * assign the necessary socket information for connection request
@@ -174,8 +287,10 @@ int main(int argc, char const *argv[])
     printf("\nReceiving data for \033[0;35m%s\033[0m\n", file);
     int fd = open_file("output.txt");
     int size_of_file = 0;
-    int words_in_file = 0;
+    struct wc_state words_in_file;
     char buffer[MAXLEN];
+    wc_init();
+    wc_begin(&words_in_file);
     int is_file_present = 0;
 
     if (fd < 0)
@@ -208,14 +323,13 @@ int main(int argc, char const *argv[])
                 break;
             }
 
-        if (!len && is_file_present)
+        if (len <= 0 && is_file_present)
             break;
 
-        buffer[len] = '\0';
         is_file_present = 1;
         size_of_file += len;
-        words_in_file += get_words((const char *)buffer);
-        write(fd, buffer, strlen(buffer));
+        get_words(&words_in_file, buffer, len);
+        write(fd, buffer, len);
     }
 
     /*
@@ -228,10 +342,6 @@ int main(int argc, char const *argv[])
     shutdown(sock, O_RDWR);
     close(sock);
 
-    int lend = strlen(buffer);
-    if (lend > 0 && !check(buffer[lend - 1]))
-        words_in_file++;
-
     /*
          * Print the size of the file
          * Print the number of words in the file
@@ -242,7 +352,7 @@ int main(int argc, char const *argv[])
             \033[0;35mSize  of  file\033[0m  = \033[1;36m%d bytes\033[0m\n\
             \033[0;35mNumber of words\033[0m = \033[1;36m%d\033[0m\n\
         ************************************\n\n",
-           size_of_file, words_in_file);
+           size_of_file, (int)words_in_file.words);
 
     printf("Output Written in file \033[0;31moutput.txt\033[0m\n");
 
@@ -37,7 +37,9 @@
 #include <sys/socket.h>
 
 #define PORT 8080
+#ifndef MAXLEN // file_bench.c builds other chunk sizes
 #define MAXLEN 100
+#endif
 
 //---------------- UTILITY FUNCTIONS ---------------
 
@@ -193,7 +195,7 @@ int main(int argc, char const *argv[])
          * if found - but an empy file ##################################################################################################
          * if found - send chunks of data (with a maximum len of MAXLEN)
          */
-        char file[MAXLEN];
+        char file[MAXLEN + 1];
         int len = read(new_socket, file, MAXLEN);
         file[len] = '\0';
         printf("File Requested by client: \033[0;35m%s\033[0m\n", file);
@@ -225,7 +227,7 @@ int main(int argc, char const *argv[])
 
             int is_not_empty = 0;
 
-            char buf[MAXLEN];
+            char buf[MAXLEN + 1]; // room for the '\0' after a full chunk
             while (1)
             {
                 int len = read(fd, buf, MAXLEN);
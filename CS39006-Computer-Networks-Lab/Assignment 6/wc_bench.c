@@ -0,0 +1,145 @@
+/**
+ *
+ *       Network Assignment-6
+ *
+ *     *--------------------------------*
+ *     *   Word counter benchmark       *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @application: BENCHMARK
+ *      @file:        wc_bench.c
+ *
+ *      How to run:
+ *      -----------
+ *      $ gcc -O2 wc_bench.c -o wc_bench
+ *      $ ./wc_bench [size in MB] [passes]
+ *
+ *      Generates random text, checks that every word
+ *      counter of wordcount.h agrees with the others
+ *      (whole buffer and fed in MAXLEN byte chunks, as
+ *      the client receives it) and reports GB/s for
+ *      each of them. With several passes the same
+ *      buffer is streamed again, so multi-GB streams
+ *      can be measured without multi-GB memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wordcount.h"
+
+#define MAXLEN 100
+
+struct counter
+{
+    const char *name;
+    void (*feed)(struct wc_state *, const unsigned char *, size_t);
+};
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void generate(unsigned char *buf, size_t n)
+{
+    /*
+     * Words of 1-12 letters separated by one or two
+     * of the separators, roughly like the Test files
+     */
+    const char *seps = " \n\t,.;:";
+    size_t i = 0;
+    unsigned int seed = 6;
+    while (i < n)
+    {
+        int len = 1 + rand_r(&seed) % 12;
+        for (int k = 0; k < len && i < n; k++)
+            buf[i++] = 'a' + rand_r(&seed) % 26;
+        int nsep = 1 + rand_r(&seed) % 2;
+        for (int k = 0; k < nsep && i < n; k++)
+            buf[i++] = seps[rand_r(&seed) % 7];
+    }
+}
+
+struct wc_state count(const struct counter *c, const unsigned char *buf, size_t n, size_t chunk, int passes)
+{
+    struct wc_state st;
+    wc_begin(&st);
+    for (int p = 0; p < passes; p++)
+        for (size_t i = 0; i < n; i += chunk)
+            c->feed(&st, buf + i, i + chunk < n ? chunk : n - i);
+    return st;
+}
+
+int main(int argc, char const *argv[])
+{
+    size_t mb = argc > 1 ? atol(argv[1]) : 256;
+    int passes = argc > 2 ? atoi(argv[2]) : 4;
+    size_t n = mb << 20;
+
+    wc_init();
+    struct counter counters[3];
+    int ncounters = 0;
+    counters[ncounters++] = (struct counter){"scalar", wc_feed_scalar};
+#ifdef WC_X86
+    if (__builtin_cpu_supports("popcnt") && __builtin_cpu_supports("sse2"))
+        counters[ncounters++] = (struct counter){"sse2", wc_feed_sse2};
+    if (__builtin_cpu_supports("popcnt") && __builtin_cpu_supports("avx2"))
+        counters[ncounters++] = (struct counter){"avx2", wc_feed_avx2};
+#endif
+
+    unsigned char *buf = malloc(n);
+    if (!buf)
+    {
+        perror("malloc");
+        return 1;
+    }
+    generate(buf, n);
+    printf("\033[0;32m%zu MB x %d passes of random text\033[0m\n\n", mb, passes);
+
+    /*
+     * Every counter must agree with the scalar one,
+     * whole buffer and MAXLEN sized chunks alike
+     */
+    struct wc_state expected = count(&counters[0], buf, n, n, 1);
+    for (int i = 0; i < ncounters; i++)
+    {
+        struct wc_state whole = count(&counters[i], buf, n, n, 1);
+        struct wc_state chunked = count(&counters[i], buf, n, MAXLEN, 1);
+        if (whole.words != expected.words || chunked.words != expected.words ||
+            whole.lines != expected.lines || chunked.lines != expected.lines)
+        {
+            printf("\033[1;31m%s: %lld / %lld words, expected %lld\033[0m\n",
+                   counters[i].name, whole.words, chunked.words, expected.words);
+            return 1;
+        }
+    }
+    printf("All counters agree: %lld words, %lld lines\n\n", expected.words, expected.lines);
+
+    for (int i = 0; i < ncounters; i++)
+    {
+        size_t chunks[] = {MAXLEN, 64 * 1024, n};
+        for (int k = 0; k < 3; k++)
+        {
+            double t0 = now();
+            count(&counters[i], buf, n, chunks[k], passes);
+            double t = now() - t0;
+            printf("%-8s chunk %10zu B : \033[1;36m%6.2f GB/s\033[0m\n",
+                   counters[i].name, chunks[k], (double)n * passes / t / 1e9);
+        }
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,204 @@
+/**
+ *
+ *       Network Assignment-6
+ *
+ *     *--------------------------------*
+ *     *   Streaming word counter       *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @file:        wordcount.h
+ *
+ *      A word is a maximal run of bytes that are not
+ *      separators (',' ';' ':' '.' and white space).
+ *      Instead of looking for the end of every word we
+ *      count word starts: a non separator byte  whose
+ *      predecessor is a separator.  The predecessor of
+ *      the first byte of a chunk is the last byte of
+ *      the previous chunk, kept in struct wc_state, so
+ *      words cut by a chunk boundary are counted once.
+ *
+ *      With SSE2/AVX2 a whole vector is classified at a
+ *      time into a bit mask  s  of separators and the
+ *      word starts are  popcount(~s & (s << 1 | carry)).
+ *      Lines ('\n' bytes) are counted in the same pass.
+ *      The implementation is chosen at run time by
+ *      wc_init(), a scalar loop is used elsewhere.
+ */
+
+#ifndef WORDCOUNT_H
+#define WORDCOUNT_H
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WC_X86 1
+#endif
+
+struct wc_state
+{
+    int prev_sep;       // last byte seen was a separator (1 at the start)
+    long long words;    // words started so far
+    long long lines;    // '\n' bytes seen so far
+};
+
+static unsigned char wc_sep_table[256];
+static void (*wc_feed_impl)(struct wc_state *, const unsigned char *, size_t);
+
+static inline int wc_is_sep(unsigned char c)
+{
+    return c == ',' || c == ';' || c == ':' || c == '.' || isspace(c);
+}
+
+//---------------- SCALAR --------------------------
+
+static void wc_feed_scalar(struct wc_state *st, const unsigned char *p, size_t n)
+{
+    int prev = st->prev_sep;
+    long long words = 0, lines = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        int sep = wc_sep_table[p[i]];
+        words += prev & !sep;
+        lines += p[i] == '\n';
+        prev = sep;
+    }
+    st->prev_sep = prev;
+    st->words += words;
+    st->lines += lines;
+}
+
+#ifdef WC_X86
+
+//---------------- SSE2 ----------------------------
+
+__attribute__((target("sse2"))) static inline unsigned wc_nl_mask16(__m128i v)
+{
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+}
+
+__attribute__((target("sse2"))) static inline unsigned wc_sep_mask16(__m128i v)
+{
+    /*
+     * '\t' .. '\r' is the range 9 .. 13, tested with
+     * one signed compare after shifting it to the
+     * bottom of the signed range
+     */
+    __m128i r = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 9)));
+    __m128i s = _mm_cmplt_epi8(r, _mm_set1_epi8((char)(0x80 + 5)));
+    s = _mm_or_si128(s, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    s = _mm_or_si128(s, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+    s = _mm_or_si128(s, _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+    s = _mm_or_si128(s, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+    s = _mm_or_si128(s, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+    return (unsigned)_mm_movemask_epi8(s);
+}
+
+__attribute__((target("sse2,popcnt"))) static void wc_feed_sse2(struct wc_state *st, const unsigned char *p, size_t n)
+{
+    uint64_t carry = st->prev_sep;
+    long long words = 0, lines = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(p + i + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(p + i + 32));
+        __m128i v3 = _mm_loadu_si128((const __m128i *)(p + i + 48));
+        uint64_t s = (uint64_t)wc_sep_mask16(v0) | (uint64_t)wc_sep_mask16(v1) << 16 |
+                     (uint64_t)wc_sep_mask16(v2) << 32 | (uint64_t)wc_sep_mask16(v3) << 48;
+        uint64_t nl = (uint64_t)wc_nl_mask16(v0) | (uint64_t)wc_nl_mask16(v1) << 16 |
+                      (uint64_t)wc_nl_mask16(v2) << 32 | (uint64_t)wc_nl_mask16(v3) << 48;
+        words += _mm_popcnt_u64(~s & (s << 1 | carry));
+        lines += _mm_popcnt_u64(nl);
+        carry = s >> 63;
+    }
+    st->prev_sep = carry;
+    st->words += words;
+    st->lines += lines;
+    wc_feed_scalar(st, p + i, n - i);
+}
+
+//---------------- AVX2 ----------------------------
+
+__attribute__((target("avx2"))) static inline uint32_t wc_nl_mask32(__m256i v)
+{
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+}
+
+__attribute__((target("avx2"))) static inline uint32_t wc_sep_mask32(__m256i v)
+{
+    __m256i r = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 9)));
+    __m256i s = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 5)), r);
+    s = _mm256_or_si256(s, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+    s = _mm256_or_si256(s, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+    s = _mm256_or_si256(s, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')));
+    s = _mm256_or_si256(s, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')));
+    s = _mm256_or_si256(s, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+    return (uint32_t)_mm256_movemask_epi8(s);
+}
+
+__attribute__((target("avx2,popcnt"))) static void wc_feed_avx2(struct wc_state *st, const unsigned char *p, size_t n)
+{
+    uint64_t carry = st->prev_sep;
+    long long words = 0, lines = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        uint64_t s = (uint64_t)wc_sep_mask32(v0) | (uint64_t)wc_sep_mask32(v1) << 32;
+        uint64_t nl = (uint64_t)wc_nl_mask32(v0) | (uint64_t)wc_nl_mask32(v1) << 32;
+        words += _mm_popcnt_u64(~s & (s << 1 | carry));
+        lines += _mm_popcnt_u64(nl);
+        carry = s >> 63;
+    }
+    st->prev_sep = carry;
+    st->words += words;
+    st->lines += lines;
+    wc_feed_scalar(st, p + i, n - i);
+}
+
+#endif
+
+//---------------- INTERFACE -----------------------
+
+static void wc_init()
+{
+    for (int c = 0; c < 256; c++)
+        wc_sep_table[c] = wc_is_sep(c);
+    wc_feed_impl = wc_feed_scalar;
+#ifdef WC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("popcnt"))
+    {
+        if (__builtin_cpu_supports("sse2"))
+            wc_feed_impl = wc_feed_sse2;
+        if (__builtin_cpu_supports("avx2"))
+            wc_feed_impl = wc_feed_avx2;
+    }
+#endif
+}
+
+static inline void wc_begin(struct wc_state *st)
+{
+    st->prev_sep = 1;
+    st->words = 0;
+    st->lines = 0;
+}
+
+static inline void wc_feed(struct wc_state *st, const void *buf, size_t n)
+{
+    wc_feed_impl(st, (const unsigned char *)buf, n);
+}
+
+#endif
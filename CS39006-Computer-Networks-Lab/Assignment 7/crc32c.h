@@ -0,0 +1,196 @@
+/**
+ *
+ *       Network Assignment-7
+ *
+ *     *--------------------------------*
+ *     *   CRC32C (Castagnoli) checksum *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @file:        crc32c.h
+ *
+ *      On x86 CPUs with SSE4.2 the crc32 instruction
+ *      checksums 8 bytes per instruction,  otherwise a
+ *      slicing-by-8 table is used. The choice is made
+ *      once at run time by crc32c_init().
+ *
+ *      Usage mirrors zlib's crc32():
+ *
+ *          uint32_t crc = 0;
+ *          crc = crc32c(crc, buf1, len1);
+ *          crc = crc32c(crc, buf2, len2);
+ *          crc = crc32c_zeros(crc, len3); // len3 zero bytes
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#endif
+
+#define CRC32C_POLY 0x82f63b78u // reversed Castagnoli polynomial
+
+static uint32_t crc32c_table[8][256];
+static uint32_t (*crc32c_impl)(uint32_t, const unsigned char *, size_t);
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    /*
+     * Slicing-by-8: one table lookup per byte but
+     * eight independent lookups per iteration
+     */
+    while (len && ((uintptr_t)p & 7))
+    {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = crc32c_table[7][v & 0xff] ^
+              crc32c_table[6][(v >> 8) & 0xff] ^
+              crc32c_table[5][(v >> 16) & 0xff] ^
+              crc32c_table[4][(v >> 24) & 0xff] ^
+              crc32c_table[3][(v >> 32) & 0xff] ^
+              crc32c_table[2][(v >> 40) & 0xff] ^
+              crc32c_table[1][(v >> 48) & 0xff] ^
+              crc32c_table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len && ((uintptr_t)p & 7))
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 32)
+    {
+        uint64_t v[4];
+        memcpy(v, p, 32);
+        crc64 = _mm_crc32_u64(crc64, v[0]);
+        crc64 = _mm_crc32_u64(crc64, v[1]);
+        crc64 = _mm_crc32_u64(crc64, v[2]);
+        crc64 = _mm_crc32_u64(crc64, v[3]);
+        p += 32;
+        len -= 32;
+    }
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+static void crc32c_init()
+{
+    if (crc32c_impl)
+        return;
+    for (int i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32c_table[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            crc32c_table[t][i] = crc32c_table[0][crc32c_table[t - 1][i] & 0xff] ^
+                                 (crc32c_table[t - 1][i] >> 8);
+
+    crc32c_impl = crc32c_sw;
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_impl = crc32c_hw;
+#endif
+}
+
+static inline uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    return ~crc32c_impl(~crc, (const unsigned char *)buf, len);
+}
+
+//---------------- RUNS OF ZEROS -------------------
+
+static uint32_t crc32c_gf2_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, mat++)
+        if (vec & 1)
+            sum ^= *mat;
+    return sum;
+}
+
+static void crc32c_gf2_square(uint32_t *square, const uint32_t *mat)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = crc32c_gf2_times(mat, mat[n]);
+}
+
+static inline uint32_t crc32c_zeros(uint32_t crc, uint64_t len)
+{
+    /*
+     * Same as crc32c() over len zero bytes without
+     * reading them (holes of sparse files): a zero
+     * byte is a linear map of the register, and it
+     * is raised to the power len by squaring, as in
+     * zlib's crc32_combine(). O(log len)
+     */
+    uint32_t even[32], odd[32];
+    odd[0] = CRC32C_POLY; // one zero bit
+    for (int n = 1; n < 32; n++)
+        odd[n] = 1u << (n - 1);
+    crc32c_gf2_square(even, odd); // two zero bits
+    crc32c_gf2_square(odd, even); // four zero bits
+
+    uint32_t reg = ~crc;
+    while (len)
+    {
+        crc32c_gf2_square(even, odd); // 1, 4, 16 ... zero bytes
+        if (len & 1)
+            reg = crc32c_gf2_times(even, reg);
+        len >>= 1;
+        if (!len)
+            break;
+        crc32c_gf2_square(odd, even); // 2, 8, 32 ... zero bytes
+        if (len & 1)
+            reg = crc32c_gf2_times(odd, reg);
+        len >>= 1;
+    }
+    return ~reg;
+}
+
+#endif
@@ -0,0 +1,680 @@
+/**
+ *
+ *       Network Assignment-7
+ *
+ *     *--------------------------------*
+ *     *   File transfer benchmark      *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @application: BENCHMARK
+ *      @file:        file_bench.c
+ *
+ *      How to run (from this directory):
+ *      -----------
+ *      $ gcc -O2 file_bench.c -o file_bench
+ *      $ ./file_bench [-s 1k,1m,64m,1g] [-m a6,a7,...] [-c <chunk,...>]
+ *                     [-n <runs>] [-w <work dir>] [-o <results.csv>] [-S]
+ *
+ *      For every mode (see modes[]) and chunk size the
+ *      server and the client are compiled with that
+ *      chunk (-DMAXLEN=... or -DFX_CHUNK=...), the server
+ *      is started on loopback in a directory of generated
+ *      text files of the given sizes and the client
+ *      fetches each file n times. Every transfer is
+ *      checked against the original and appended as one
+ *      line to the CSV file:
+ *
+ *          mode,chunk,size,run,seconds,mb_per_s,
+ *          client_cpu,server_cpu,client_syscr,client_syscw,
+ *          server_syscr,server_syscw,client_syscalls,ok
+ *
+ *      CPU times are user + system seconds, syscr and
+ *      syscw the read and write system calls counted in
+ *      /proc/<pid>/io (read/pread/write ..., socket calls
+ *      like recv() and io_uring reads are not in there).
+ *      With -S every file is fetched once more under
+ *      ptrace, untimed, and client_syscalls counts all
+ *      system calls of the client (-1 without -S).
+ *      A new transfer mode is one more line in modes[].
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/ptrace.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define PORT 8080
+#define MAX_SIZES 32
+#define MAX_CHUNKS 32
+
+//---------------- TRANSFER MODES ------------------
+
+struct mode
+{
+    const char *name;
+    const char *server_src;  // relative to this directory
+    const char *client_src;  // NULL: legacy_client() below
+    const char *chunk_macro; // the chunk size is -D<chunk_macro>=<n>
+    const char *chunks;      // default chunk sizes
+    const char *client_flag; // extra client option or NULL
+};
+
+struct mode modes[] = {
+    /*
+     * A6: the file name is read from stdin, blocks of
+     * MAXLEN bytes. A7 legacy: the original one file
+     * per connection protocol (MAXLEN 20), spoken by
+     * legacy_client(). A7: the framed protocol with
+     * FX_CHUNK blocks, plain and with LZ compression
+     */
+    {"a6", "../Assignment 6/file_server.c", "../Assignment 6/file_client.c", "MAXLEN", "100,1024,16384", NULL},
+    {"a7-legacy", "file_server.c", NULL, "MAXLEN", "20,1024,16384", NULL},
+    {"a7", "file_server.c", "file_client.c", "FX_CHUNK", "16384,65536,262144", NULL},
+    {"a7-lz", "file_server.c", "file_client.c", "FX_CHUNK", "65536", "-z"},
+};
+
+#define NMODES (int)(sizeof(modes) / sizeof(modes[0]))
+
+//---------------- UTILITY FUNCTIONS ---------------
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long parse_size(const char *s)
+{
+    /*
+     * 4096, 64k, 16m, 2g
+     */
+    char *end;
+    long n = strtol(s, &end, 10);
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        return n << 10;
+    case 'm':
+    case 'M':
+        return n << 20;
+    case 'g':
+    case 'G':
+        return n << 30;
+    }
+    return n;
+}
+
+int parse_list(const char *s, long *out, int max)
+{
+    int n = 0;
+    char *copy = strdup(s), *save;
+    for (char *tok = strtok_r(copy, ",", &save); tok && n < max; tok = strtok_r(NULL, ",", &save))
+        out[n++] = parse_size(tok);
+    free(copy);
+    return n;
+}
+
+void quiet_stdio()
+{
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(null);
+}
+
+int read_proc_io(pid_t pid, long *syscr, long *syscw)
+{
+    char path[64], line[128];
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    FILE *f = fopen(path, "r");
+    *syscr = *syscw = -1;
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f))
+    {
+        sscanf(line, "syscr: %ld", syscr);
+        sscanf(line, "syscw: %ld", syscw);
+    }
+    fclose(f);
+    return 0;
+}
+
+double read_proc_cpu(pid_t pid)
+{
+    /*
+     * utime + stime of every thread of the process,
+     * fields 14 and 15 of /proc/<pid>/stat
+     */
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    char *p = strrchr(buf, ')'); // the name may contain spaces
+    unsigned long utime = 0, stime = 0;
+    if (p)
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+int same_file(const char *a, const char *b)
+{
+    static char x[1 << 20], y[1 << 20];
+    int fa = open(a, O_RDONLY), fb = open(b, O_RDONLY), same = fa >= 0 && fb >= 0;
+    while (same)
+    {
+        ssize_t na = read(fa, x, sizeof(x));
+        ssize_t nb = na > 0 ? read(fb, y, na) : read(fb, y, 1);
+        if (na != nb || na < 0 || memcmp(x, y, na) != 0)
+            same = 0;
+        if (na <= 0)
+            break;
+    }
+    if (fa >= 0)
+        close(fa);
+    if (fb >= 0)
+        close(fb);
+    return same;
+}
+
+//---------------- TEST FILES ----------------------
+
+void file_name(long size, char *out)
+{
+    /*
+     * Short names: the legacy protocols read the
+     * name into MAXLEN bytes
+     */
+    if (size >= 1 << 30 && size % (1 << 30) == 0)
+        sprintf(out, "f%ldg.txt", size >> 30);
+    else if (size >= 1 << 20 && size % (1 << 20) == 0)
+        sprintf(out, "f%ldm.txt", size >> 20);
+    else if (size >= 1 << 10 && size % (1 << 10) == 0)
+        sprintf(out, "f%ldk.txt", size >> 10);
+    else
+        sprintf(out, "f%ld.txt", size);
+}
+
+int generate(const char *path, long size)
+{
+    /*
+     * Random words and separators like the Test
+     * files, no NUL bytes (the A6 server sends
+     * strlen() of every block). A file of the
+     * right size from an earlier run is reused
+     */
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size == size)
+        return 0;
+    static char buf[1 << 20];
+    const char *seps = " \n\t,.;:";
+    unsigned int seed = 7;
+    for (size_t i = 0; i < sizeof(buf);)
+    {
+        int len = 1 + rand_r(&seed) % 12;
+        for (int k = 0; k < len && i < sizeof(buf); k++)
+            buf[i++] = 'a' + rand_r(&seed) % 26;
+        if (i < sizeof(buf))
+            buf[i++] = seps[rand_r(&seed) % 7];
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    for (long done = 0; done < size;)
+    {
+        long n = size - done < (long)sizeof(buf) ? size - done : (long)sizeof(buf);
+        if (write(fd, buf, n) != n)
+        {
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+    close(fd);
+    return 0;
+}
+
+//---------------- SERVER --------------------------
+
+int port_open()
+{
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int ok = connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    close(sock);
+    return ok;
+}
+
+pid_t start_server(const char *bin, const char *dir)
+{
+    /*
+     * Run the server in the data directory and wait
+     * until it accepts connections. The probe is an
+     * empty request, answered as a missing file.
+     * Both servers set SO_REUSEPORT, so a server left
+     * over from an earlier run would silently take
+     * half of the connections: refuse to start then
+     */
+    if (port_open())
+    {
+        printf("\033[1;31mPort %d is already in use\033[0m\n", PORT);
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGKILL); // do not outlive the benchmark
+        if (chdir(dir) < 0)
+            _exit(127);
+        quiet_stdio();
+        execl(bin, bin, (char *)NULL);
+        _exit(127);
+    }
+    for (int i = 0; i < 500; i++)
+    {
+        usleep(10000);
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return -1;
+        if (port_open())
+            return pid;
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+void stop_server(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+//---------------- CLIENT --------------------------
+
+int legacy_client(const char *file, long size, long chunk)
+{
+    /*
+     * The A7 client before file_proto.h: send the
+     * name, get "L" (or "E") and the size in ASCII,
+     * then the data until the server closes. The
+     * size has no delimiter, we know how long it is
+     */
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return 1;
+    send(sock, file, strlen(file), 0);
+
+    char digits[32], *buf = malloc(chunk);
+    int ndigits = sprintf(digits, "%ld", size);
+    if (recv(sock, buf, 1, MSG_WAITALL) != 1 || buf[0] != 'L' ||
+        recv(sock, digits, ndigits, MSG_WAITALL) != ndigits)
+        return 1;
+    int fd = open("output.txt", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    ssize_t n;
+    while ((n = recv(sock, buf, chunk, MSG_WAITALL)) > 0)
+        if (write(fd, buf, n) != n)
+            return 1;
+    close(fd);
+    close(sock);
+    return n < 0;
+}
+
+void exec_client(const struct mode *m, const char *bin, const char *dir, const char *file,
+                 long size, long chunk, int in)
+{
+    /*
+     * In the child: the client with stdin from in,
+     * its output thrown away
+     */
+    dup2(in, STDIN_FILENO);
+    close(in);
+    if (chdir(dir) < 0)
+        _exit(127);
+    quiet_stdio();
+    if (!m->client_src)
+        _exit(legacy_client(file, size, chunk));
+    if (m->client_flag)
+        execl(bin, bin, m->client_flag, file, (char *)NULL);
+    else
+        execl(bin, bin, file, (char *)NULL);
+    _exit(127);
+}
+
+struct result
+{
+    double seconds;
+    double client_cpu, server_cpu;
+    long client_syscr, client_syscw;
+    long server_syscr, server_syscw;
+    int ok;
+};
+
+int run_client(const struct mode *m, const char *bin, const char *dir, const char *file,
+               long size, long chunk, pid_t server, double timeout, struct result *res)
+{
+    /*
+     * One transfer. The client is timed from fork()
+     * to its exit, its /proc/<pid>/io is read while
+     * it is a zombie (waitid with WNOWAIT) and its
+     * CPU time comes from wait4()
+     */
+    memset(res, 0, sizeof(*res));
+    long ssr0, ssw0, ssr1, ssw1;
+    read_proc_io(server, &ssr0, &ssw0);
+    double scpu0 = read_proc_cpu(server);
+
+    char out[4096];
+    snprintf(out, sizeof(out), "%s/output.txt", dir);
+    unlink(out);
+    int in[2];
+    if (pipe(in) < 0)
+        return -1;
+
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+
+    double t0 = now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        close(in[1]);
+        exec_client(m, bin, dir, file, size, chunk, in[0]);
+    }
+    close(in[0]);
+    dprintf(in[1], "%s\n", file); // A6 reads the name from stdin
+    close(in[1]);
+
+    siginfo_t si;
+    int done = 0;
+    while (!done)
+    {
+        double left = timeout - (now() - t0);
+        struct timespec ts = {(time_t)left, (long)((left - (time_t)left) * 1e9)};
+        if (left <= 0 || (sigtimedwait(&chld, NULL, &ts) < 0 && errno == EAGAIN))
+        {
+            kill(pid, SIGKILL);
+            break;
+        }
+        si.si_pid = 0;
+        done = waitid(P_PID, pid, &si, WEXITED | WNOHANG | WNOWAIT) == 0 && si.si_pid == pid;
+    }
+    res->seconds = now() - t0;
+    read_proc_io(pid, &res->client_syscr, &res->client_syscw);
+
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    res->client_cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+                      ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+    /*
+     * The server may still be closing the
+     * connection, give it a moment before
+     * its counters are read again
+     */
+    usleep(20000);
+    read_proc_io(server, &ssr1, &ssw1);
+    res->server_syscr = ssr1 - ssr0;
+    res->server_syscw = ssw1 - ssw0;
+    res->server_cpu = read_proc_cpu(server) - scpu0;
+    res->ok = done && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    return 0;
+}
+
+long count_syscalls(const struct mode *m, const char *bin, const char *dir, const char *file,
+                    long size, long chunk)
+{
+    /*
+     * -S: run the client once more under ptrace and
+     * count the syscall stops of all its threads and
+     * children (two per call, one for exit_group)
+     */
+    int in[2];
+    if (pipe(in) < 0)
+        return -1;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(in[1]);
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        exec_client(m, bin, dir, file, size, chunk, in[0]);
+    }
+    close(in[0]);
+    dprintf(in[1], "%s\n", file);
+    close(in[1]);
+
+    int st;
+    if (waitpid(pid, &st, 0) != pid || !WIFSTOPPED(st))
+        return -1;
+    ptrace(PTRACE_SETOPTIONS, pid, NULL,
+           (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK |
+                          PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL));
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+    long stops = 0;
+    int tasks = 1;
+    while (tasks > 0)
+    {
+        pid_t t = waitpid(-1, &st, __WALL);
+        if (t < 0)
+            break;
+        if (WIFEXITED(st) || WIFSIGNALED(st))
+        {
+            tasks--;
+            continue;
+        }
+        int sig = WSTOPSIG(st);
+        if (sig == (SIGTRAP | 0x80))
+            stops++;
+        if (st >> 16)
+            tasks++; // a new thread or child, traced too
+        if (sig == (SIGTRAP | 0x80) || sig == SIGTRAP || sig == SIGSTOP)
+            sig = 0;
+        ptrace(PTRACE_SYSCALL, t, NULL, (void *)(long)sig);
+    }
+    return (stops + 1) / 2;
+}
+
+//---------------- BUILDING ------------------------
+
+int build(const char *src, const struct mode *m, long chunk, const char *out)
+{
+    char cmd[8192];
+    snprintf(cmd, sizeof(cmd), "gcc -O2 -D%s=%ld \"%s\" -o \"%s\" -lpthread",
+             m->chunk_macro, chunk, src, out);
+    if (system(cmd) != 0)
+    {
+        printf("\033[1;31mBuild failed: %s\033[0m\n", cmd);
+        return -1;
+    }
+    return 0;
+}
+
+/**         DRIVER CODE         **/
+
+int main(int argc, char *argv[])
+{
+    const char *sizes_arg = "1k,64k,1m,16m,256m", *modes_arg = NULL, *chunks_arg = NULL;
+    const char *work = "/tmp/file_bench", *csv = "file_bench.csv";
+    int runs = 3, trace = 0;
+    double timeout = 600;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:m:c:n:w:o:t:S")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            sizes_arg = optarg;
+            break;
+        case 'm':
+            modes_arg = optarg;
+            break;
+        case 'c':
+            chunks_arg = optarg;
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        case 'w':
+            work = optarg;
+            break;
+        case 'o':
+            csv = optarg;
+            break;
+        case 't':
+            timeout = atof(optarg);
+            break;
+        case 'S':
+            trace = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s sizes] [-m modes] [-c chunks] [-n runs] [-w dir] [-o csv] [-t timeout] [-S]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    long sizes[MAX_SIZES];
+    int nsizes = parse_list(sizes_arg, sizes, MAX_SIZES);
+
+    /*
+     * Work directory: data/ is served, client/ is
+     * where the client writes, bin/ the builds
+     */
+    char data[4096], client_dir[4096], bin_dir[4096];
+    mkdir(work, 0755);
+    snprintf(data, sizeof(data), "%s/data", work);
+    snprintf(client_dir, sizeof(client_dir), "%s/client", work);
+    snprintf(bin_dir, sizeof(bin_dir), "%s/bin", work);
+    mkdir(data, 0755);
+    mkdir(client_dir, 0755);
+    mkdir(bin_dir, 0755);
+    for (int i = 0; i < nsizes; i++)
+    {
+        char name[64], path[4200];
+        file_name(sizes[i], name);
+        snprintf(path, sizeof(path), "%s/%s", data, name);
+        printf("Generating \033[0;35m%s\033[0m (%ld bytes)\n", name, sizes[i]);
+        if (generate(path, sizes[i]) < 0)
+        {
+            perror(path);
+            return 1;
+        }
+    }
+
+    FILE *out = fopen(csv, "a");
+    if (!out)
+    {
+        perror(csv);
+        return 1;
+    }
+    fseek(out, 0, SEEK_END);
+    if (ftell(out) == 0)
+        fprintf(out, "mode,chunk,size,run,seconds,mb_per_s,client_cpu,server_cpu,"
+                     "client_syscr,client_syscw,server_syscr,server_syscw,client_syscalls,ok\n");
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int k = 0; k < NMODES; k++)
+    {
+        const struct mode *m = &modes[k];
+        if (modes_arg)
+        {
+            char list[1024];
+            snprintf(list, sizeof(list), ",%s,", modes_arg);
+            char key[128];
+            snprintf(key, sizeof(key), ",%s,", m->name);
+            if (!strstr(list, key))
+                continue;
+        }
+
+        long chunks[MAX_CHUNKS];
+        int nchunks = parse_list(chunks_arg ? chunks_arg : m->chunks, chunks, MAX_CHUNKS);
+        for (int c = 0; c < nchunks; c++)
+        {
+            char server_bin[4300], client_bin[4300];
+            snprintf(server_bin, sizeof(server_bin), "%s/%s-%ld-server", bin_dir, m->name, chunks[c]);
+            snprintf(client_bin, sizeof(client_bin), "%s/%s-%ld-client", bin_dir, m->name, chunks[c]);
+            if (build(m->server_src, m, chunks[c], server_bin) < 0 ||
+                (m->client_src && build(m->client_src, m, chunks[c], client_bin) < 0))
+                continue;
+
+            pid_t server = start_server(server_bin, data);
+            if (server < 0)
+            {
+                printf("\033[1;31m%s: the server did not start\033[0m\n", m->name);
+                continue;
+            }
+            printf("\n\033[0;32m%s, chunk %ld\033[0m\n", m->name, chunks[c]);
+
+            for (int i = 0; i < nsizes; i++)
+            {
+                char name[64], orig[4200], copy[4200];
+                file_name(sizes[i], name);
+                snprintf(orig, sizeof(orig), "%s/%s", data, name);
+                snprintf(copy, sizeof(copy), "%s/output.txt", client_dir);
+                long syscalls = -1;
+                if (trace)
+                    syscalls = count_syscalls(m, client_bin, client_dir, name, sizes[i], chunks[c]);
+                for (int r = 0; r < runs; r++)
+                {
+                    struct result res;
+                    run_client(m, client_bin, client_dir, name, sizes[i], chunks[c], server, timeout, &res);
+                    res.ok = res.ok && same_file(orig, copy);
+                    double rate = res.seconds > 0 ? sizes[i] / res.seconds / 1e6 : 0;
+                    fprintf(out, "%s,%ld,%ld,%d,%.6f,%.2f,%.4f,%.4f,%ld,%ld,%ld,%ld,%ld,%d\n",
+                            m->name, chunks[c], sizes[i], r, res.seconds, rate,
+                            res.client_cpu, res.server_cpu, res.client_syscr, res.client_syscw,
+                            res.server_syscr, res.server_syscw, syscalls, res.ok);
+                    fflush(out);
+                    printf("  %-10s run %d: %9.4f s %9.2f MB/s  cpu %.3f/%.3f s  r/w calls %ld/%ld",
+                           name, r, res.seconds, rate, res.client_cpu, res.server_cpu,
+                           res.client_syscr + res.client_syscw, res.server_syscr + res.server_syscw);
+                    if (trace)
+                        printf("  syscalls %ld", syscalls);
+                    printf("  %s\n", res.ok ? "\033[0;32mok\033[0m" : "\033[1;31mFAILED\033[0m");
+                }
+            }
+            stop_server(server);
+        }
+    }
+    fclose(out);
+    printf("\n\033[0;33mResults appended to %s\033[0m\n", csv);
+    return 0;
+}
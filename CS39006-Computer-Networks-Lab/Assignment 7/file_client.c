@@ -19,25 +19,51 @@
  * 
  *      How to run:
  *      -----------
- *      $ gcc file_client.c -o client
- *      $ ./client
+ *      $ gcc file_client.c -o client -lpthread
+ *      $ ./client [-z] [-D] [-d] [-R] [file1 file2 ...]
+ *
+ *      All the files named on the command line (or typed
+ *      at the prompt) are requested over one connection,
+ *      see file_proto.h for the pipelined protocol.
+ *      Every block is checked against its CRC32C and
+ *      corrupt ranges are requested again. Holes of
+ *      sparse files are not sent, they are punched. With -z the
+ *      server may compress the blocks (lzblock.h), with
+ *      -D the output files are written with O_DIRECT.
+ *      With -d an output file that already exists is
+ *      updated with a delta transfer (rsum.h): only the
+ *      parts of the file it does not have cross the wire.
+ *      With -R the names are directories, each one is
+ *      received as a single archive into output_<name>/
  */
 
 // Client side C/C++ program to demonstrate Socket programming
+#define _GNU_SOURCE
 #include <poll.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
+#include <pthread.h>
+
+#include "crc32c.h"
+#include "rsum.h"
+#include "lzblock.h"
+#include "file_proto.h"
 
 #define PORT 8080
 #define MAXLEN 20
+#define MAX_RETRY 3
 
 //------------------- UTILITY FUNCTIONS -------------
 
@@ -62,9 +88,35 @@ int check(char c)
     return c == ',' || c == ';' || c == ':' || c == '.' || isspace(c);
 }
 
-/**         DRIVER CODE         **/
+double cpu_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-int main(int argc, char const *argv[])
+double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+const char *output_name(const char *file, int nfiles, char *out)
+{
+    /*
+     * A single file is written to output.txt as
+     * before, with several files each one  gets
+     * output_<basename> so they do not clash
+     */
+    if (nfiles == 1)
+        return strcpy(out, "output.txt");
+    const char *base = strrchr(file, '/');
+    sprintf(out, "output_%s", base ? base + 1 : file);
+    return out;
+}
+
+int connect_server()
 {
     /*
      * create the socket
@@ -79,22 +131,6 @@ int main(int argc, char const *argv[])
         return -1;
     }
 
-    /**
-     * Set  time  out  for 
-     * receive if the file
-     * is empty. The server 
-     * will send NULL value
-     * for  empty  hence we 
-     * need  to  handle the 
-     * time out interval
-     */
-
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 100000;
-
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-
     struct sockaddr_in serv_addr;
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_port = htons(PORT);
@@ -106,14 +142,890 @@ int main(int argc, char const *argv[])
     if (inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0)
     {
         printf("\nInvalid address/ Address not supported \n");
+        close(sock);
         return -1;
     }
 
     if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
     {
         printf("\nConnection Failed \n");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+pid_t send_requests(int sock, char **lines, char **bodies, size_t *body_len, int n)
+{
+    /*
+     * A long list of requests may not fit in the
+     * socket buffers while the server is already
+     * answering, so a child process writes them
+     * while the parent reads the responses.
+     * bodies (may be NULL) are sent right after
+     * their request line, as SYNC needs
+     */
+    pid_t writer = fork();
+    if (writer == 0)
+    {
+        size_t req_len = 0;
+        for (int i = 0; i < n; i++)
+            req_len += strlen(lines[i]) + 1 + (bodies ? body_len[i] : 0);
+        char *req = malloc(req_len + 1), *r = req;
+        for (int i = 0; i < n; i++)
+        {
+            r += sprintf(r, "%s\n", lines[i]);
+            if (bodies && body_len[i])
+            {
+                memcpy(r, bodies[i], body_len[i]);
+                r += body_len[i];
+            }
+        }
+        send_all(sock, req, req_len);
+        shutdown(sock, SHUT_WR);
+        _exit(0); // do not flush the parent's stdio buffers twice
+    }
+    return writer;
+}
+
+//------------------- RECEIVE ENGINE ----------------
+
+/*
+ * Incoming frames are parsed out of one large aligned
+ * buffer filled by recv() calls whose size adapts to
+ * the measured throughput: it doubles (up to RX_MAX)
+ * while every doubling still buys 10% more, and halves
+ * when throughput drops by a fifth.
+ *
+ * Decoded blocks are gathered in an aligned write batch
+ * and reach the disk in one pwrite() per WB_SIZE bytes
+ * (or whenever the next block is not contiguous).
+ */
+
+#define ALIGN 4096
+#define RX_MIN (64 * 1024)
+#define RX_MAX (4 * 1024 * 1024)
+#define RX_CAP (RX_MAX + FX_HEADER_LEN + LZ_BOUND(FX_CHUNK))
+#define WB_SIZE (4 * 1024 * 1024)
+
+struct rx
+{
+    int sock;
+    char *buf;              // RX_CAP bytes, page aligned
+    size_t start, end;      // unparsed bytes are buf[start, end)
+    size_t chunk;           // current recv() size
+    long recv_calls;
+    long window_bytes;      // bytes since the last adaptation
+    double window_start;
+    double best_rate;       // best throughput seen so far (bytes/s)
+};
+
+struct wbatch
+{
+    int fd;
+    int direct;             // fd was opened with O_DIRECT
+    char *buf;              // WB_SIZE bytes, page aligned
+    size_t len;             // bytes gathered
+    off_t off;              // file offset of buf[0]
+    long write_calls;
+    int error;              // errno of the first failed write, 0 if none
+};
+
+struct rx receiver;
+struct wbatch batch;
+int use_direct = 0; // -D: write with O_DIRECT
+
+void *aligned_alloc_or_die(size_t size)
+{
+    void *p;
+    if (posix_memalign(&p, ALIGN, size) != 0)
+    {
+        perror("posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+void rx_init(struct rx *r, int sock)
+{
+    if (!r->buf)
+        r->buf = aligned_alloc_or_die(RX_CAP);
+    r->sock = sock;
+    r->start = r->end = 0;
+    r->chunk = RX_MIN;
+    r->recv_calls = r->window_bytes = 0;
+    r->window_start = now();
+    r->best_rate = 0;
+}
+
+void rx_adapt(struct rx *r, long n)
+{
+    /*
+     * Measure over windows of 8 recv() sizes so
+     * a single slow call does not flip the size
+     */
+    r->window_bytes += n;
+    if (r->window_bytes < 8 * (long)r->chunk)
+        return;
+    double elapsed = now() - r->window_start;
+    double rate = elapsed > 0 ? r->window_bytes / elapsed : 1e12;
+    if (rate > 1.1 * r->best_rate && r->chunk < RX_MAX)
+        r->chunk *= 2;
+    else if (rate < 0.8 * r->best_rate && r->chunk > RX_MIN)
+        r->chunk /= 2;
+    if (rate > r->best_rate)
+        r->best_rate = rate;
+    r->window_bytes = 0;
+    r->window_start = now();
+}
+
+char *rx_need(struct rx *r, size_t n)
+{
+    /*
+     * Return a pointer to the next n unparsed bytes,
+     * receiving more if needed, NULL on EOF/error.
+     * The bytes stay valid until the next call
+     */
+    while (r->end - r->start < n)
+    {
+        if (r->start > 0 && (r->end == r->start || RX_CAP - r->start < n + r->chunk))
+        {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        size_t room = RX_CAP - r->end;
+        ssize_t got = recv(r->sock, r->buf + r->end, room < r->chunk ? room : r->chunk, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return NULL;
+        r->recv_calls++;
+        r->end += got;
+        rx_adapt(r, got);
+    }
+    char *p = r->buf + r->start;
+    r->start += n;
+    return p;
+}
+
+int rx_frame(struct rx *r, struct fx_header *h)
+{
+    unsigned char *p = (unsigned char *)rx_need(r, FX_HEADER_LEN);
+    if (!p)
+        return -1;
+    fx_unpack(p, h);
+    return 0;
+}
+
+void wb_open(struct wbatch *w, int fd, int direct)
+{
+    if (!w->buf)
+        w->buf = aligned_alloc_or_die(WB_SIZE);
+    w->fd = fd;
+    w->direct = direct;
+    w->len = 0;
+    w->off = 0;
+    w->error = 0;
+}
+
+int wb_flush(struct wbatch *w)
+{
+    /*
+     * O_DIRECT needs the length rounded up to a
+     * block, the padding is cut off by ftruncate()
+     * once the file is complete. If the filesystem
+     * refuses the direct write we drop O_DIRECT.
+     * A short write goes on where it stopped, the
+     * first error (a full disk, EIO) sticks to the
+     * batch and fails the file. Returns -1 then
+     */
+    if (!w->len)
+        return w->error ? -1 : 0;
+    size_t len = w->len, done = 0;
+    if (w->direct)
+    {
+        len = (len + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+        memset(w->buf + w->len, 0, len - w->len);
+    }
+    while (done < len && !w->error)
+    {
+        ssize_t n = pwrite(w->fd, w->buf + done, len - done, w->off + done);
+        w->write_calls++;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && w->direct && errno == EINVAL)
+        {
+            fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+            w->direct = 0;
+            len = w->len;
+            continue;
+        }
+        if (n <= 0)
+            w->error = n < 0 ? errno : ENOSPC;
+        else
+            done += n;
+    }
+    w->off += w->len;
+    w->len = 0;
+    return w->error ? -1 : 0;
+}
+
+char *wb_reserve(struct wbatch *w, off_t off, size_t len)
+{
+    /*
+     * Room for len bytes that belong at file offset
+     * off. Blocks are decoded straight into it and
+     * kept only if wb_commit() is called
+     */
+    if (w->len && (off != w->off + (off_t)w->len || w->len + len > WB_SIZE))
+        wb_flush(w);
+    if (!w->len)
+        w->off = off;
+    if (w->direct && (w->off & (ALIGN - 1)))
+    {
+        fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+        w->direct = 0;
+    }
+    return w->buf + w->len;
+}
+
+void wb_commit(struct wbatch *w, size_t len)
+{
+    w->len += len;
+}
+
+void wb_hole(struct wbatch *w, off_t off, off_t len)
+{
+    /*
+     * FX_HOLE: the zeros are not written, the range
+     * is deallocated instead. Where punching is not
+     * supported it already reads as zeros, the file
+     * was truncated when it was opened. Pending
+     * blocks go first so that O_DIRECT padding does
+     * not land in the hole after it is punched
+     */
+    wb_flush(w);
+    fallocate(w->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len);
+}
+
+//------------------- RECEIVING FILES ---------------
+
+struct range
+{
+    long off, len;
+};
+
+struct transfer
+{
+    char *file;                     // path requested from the server
+    char outfile[FX_LINE_MAX + 16]; // where it is written locally
+    int found;                      // server sent FX_OPEN
+    int complete;                   // FX_END seen for the whole file
+    long size;                      // size announced in FX_OPEN
+    uint32_t file_crc;              // CRC32C announced in FX_END
+    uint32_t running_crc;           // CRC32C of the blocks as received
+    long received;                  // bytes received
+    long wire_bytes;                // payload bytes on the wire
+    double lz_cpu;                  // seconds spent decompressing
+    int number_of_block;
+    int size_of_last_block;
+    long write_calls;               // pwrite() calls for this file
+    int nbad, badcap;               // blocks that failed their checksum
+    struct range *bad;
+    int basis_fd;                   // -d: old copy the delta refers to, or -1
+    size_t bs;                      // -d: block size of its signatures
+    long nsig;                      // -d: number of signatures sent
+    long copied;                    // -d: bytes taken from the old copy
+    long hole_bytes;                // zero bytes that came as FX_HOLE
+    int write_error;                // errno if the output could not be written
+    int nfiles, ndirs;              // -R: members of the archive
+    int bad_files;                  // -R: files that failed their checksum
+};
+
+void add_bad_range(struct transfer *t, long off, long len)
+{
+    if (t->nbad == t->badcap)
+    {
+        t->badcap = t->badcap ? 2 * t->badcap : 8;
+        t->bad = realloc(t->bad, t->badcap * sizeof(struct range));
+    }
+    t->bad[t->nbad].off = off;
+    t->bad[t->nbad].len = len;
+    t->nbad++;
+}
+
+int copy_blocks(struct transfer *t, struct wbatch *w, off_t off, off_t src, long len)
+{
+    /*
+     * FX_COPY: the bytes are already in our old copy,
+     * read them into the write batch like a block
+     */
+    while (len > 0)
+    {
+        int n = len < FX_CHUNK ? len : FX_CHUNK;
+        char *block = wb_reserve(w, off, n);
+        if (pread(t->basis_fd, block, n, src) != n)
+            return -1;
+        wb_commit(w, n);
+        t->running_crc = crc32c(t->running_crc, block, n);
+        t->received += n;
+        t->copied += n;
+        off += n;
+        src += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int receive_file(struct rx *r, struct transfer *t, struct wbatch *w, int repair)
+{
+    /*
+     * Read one response (OPEN, DATA ..., END or ERR)
+     * gathering every block at its offset in the
+     * write batch.  A block whose CRC32C does not
+     * match is dropped, its range is remembered to
+     * be fetched again.
+     * Returns -1 if the connection broke, -2 if the
+     * response was read but the output could not be
+     * written (t->write_error says why)
+     */
+    struct fx_header h;
+    if (rx_frame(r, &h) < 0)
+        return -1;
+
+    if (h.type == FX_ERR)
+    {
+        char msg[64];
+        char *p = rx_need(r, h.len);
+        if (!p)
+            return -1;
+        int n = h.len < sizeof(msg) - 1 ? h.len : sizeof(msg) - 1;
+        memcpy(msg, p, n);
+        msg[n] = '\0';
+        printf("\033[1;36mERR 01: File Not Found (%s)\033[0m\n\n", msg);
+        return 0;
+    }
+    if (h.type != FX_OPEN)
+        return -1;
+    if (!repair)
+    {
+        t->found = 1;
+        t->size = h.off;
+
+        /*
+         * Reserve the whole file up front so the
+         * batched writes never have to extend it
+         */
+        if (t->size > 0)
+            fallocate(w->fd, 0, 0, t->size);
+    }
+
+    long writes_before = w->write_calls;
+    while (rx_frame(r, &h) == 0)
+    {
+        if (h.type == FX_END)
+        {
+            wb_flush(w);
+            t->write_calls += w->write_calls - writes_before;
+            if (!repair)
+            {
+                t->complete = 1;
+                t->file_crc = h.crc;
+            }
+            if (w->error)
+            {
+                t->write_error = w->error;
+                return -2;
+            }
+            return 1;
+        }
+        if (h.type == FX_COPY)
+        {
+            unsigned char *p = (unsigned char *)rx_need(r, h.len);
+            if (!p || h.len != 8 || t->basis_fd < 0)
+                return -1;
+            t->wire_bytes += h.len;
+            uint32_t first = fx_get32(p), count = fx_get32(p + 4);
+            if (first + (uint64_t)count > (uint64_t)t->nsig || h.raw != (uint64_t)count * t->bs ||
+                copy_blocks(t, w, h.off, (off_t)first * t->bs, h.raw) < 0)
+            {
+                printf("\033[1;31mBad copy of %u block(s) at offset %ld\033[0m\n", count, (long)h.off);
+                add_bad_range(t, h.off, h.raw);
+            }
+            continue;
+        }
+        if (h.type == FX_HOLE)
+        {
+            unsigned char *p = (unsigned char *)rx_need(r, h.len);
+            if (!p || h.len != 8)
+                return -1;
+            uint64_t len = fx_get64(p);
+            t->wire_bytes += h.len;
+            wb_hole(w, h.off, len);
+            if (!repair)
+            {
+                t->received += len;
+                t->hole_bytes += len;
+                t->running_crc = crc32c_zeros(t->running_crc, len);
+            }
+            continue;
+        }
+        if (h.type != FX_DATA || h.len > LZ_BOUND(FX_CHUNK) || h.raw > FX_CHUNK)
+            return -1;
+        char *payload = rx_need(r, h.len);
+        if (!payload)
+            return -1;
+        t->wire_bytes += h.len;
+
+        /*
+         * A compressed block that does not decode to the
+         * announced size is as corrupt as a bad checksum
+         */
+        char *block = wb_reserve(w, h.off, h.raw);
+        int len = h.len;
+        if (h.flags & FX_F_LZ)
+        {
+            double t0 = cpu_time();
+            len = lz_decompress(payload, h.len, block, h.raw);
+            t->lz_cpu += cpu_time() - t0;
+        }
+        else if (len == (int)h.raw)
+            memcpy(block, payload, len);
+        if (len != (int)h.raw || crc32c(0, block, h.raw) != h.crc)
+        {
+            printf("\033[1;31mChecksum mismatch in block at offset %ld\033[0m\n", (long)h.off);
+            add_bad_range(t, h.off, h.raw);
+            continue;
+        }
+        wb_commit(w, len);
+        if (!repair)
+        {
+            t->number_of_block++;
+            t->size_of_last_block = len;
+            t->received += len;
+            t->running_crc = crc32c(t->running_crc, block, len);
+        }
+    }
+    return -1;
+}
+
+uint32_t crc_of_file(const char *path)
+{
+    static char buffer[FX_CHUNK];
+    uint32_t crc = 0;
+    int fd = open(path, O_RDONLY), len;
+    while (fd >= 0 && (len = read(fd, buffer, sizeof(buffer))) > 0)
+        crc = crc32c(crc, buffer, len);
+    if (fd >= 0)
+        close(fd);
+    return crc;
+}
+
+int compress = 0; // ask the server for z=lz
+int delta = 0;    // -d: SYNC against existing output files
+int dir_mode = 0; // -R: request whole directories
+
+char *make_signatures(struct transfer *t, long size, size_t *len)
+{
+    /*
+     * Weak and strong checksum of every full block of
+     * the old copy, as sent after the SYNC line
+     */
+    t->bs = rs_block_size(size);
+    t->nsig = size / t->bs;
+    if (t->nsig > FX_SIG_MAX) // the rest of the old copy is not reused
+        t->nsig = FX_SIG_MAX;
+    unsigned char *body = malloc(t->nsig * RS_SIG_LEN + 1), *p = body;
+    unsigned char *block = malloc(t->bs);
+    for (long i = 0; i < t->nsig; i++)
+    {
+        if (pread(t->basis_fd, block, t->bs, i * t->bs) != (ssize_t)t->bs)
+        {
+            t->nsig = i;
+            break;
+        }
+        fx_put32(p, rs_weak(block, t->bs));
+        fx_put64(p + 4, rs_strong(block, t->bs));
+        p += RS_SIG_LEN;
+    }
+    free(block);
+    *len = p - body;
+    return (char *)body;
+}
+
+int repair_file(struct transfer *t)
+{
+    /*
+     * Ask for every corrupt range again on a fresh
+     * connection (the first one is half closed),
+     * up to MAX_RETRY rounds, then check the whole
+     * file against the checksum from FX_END
+     */
+    for (int round = 0; round < MAX_RETRY && t->nbad; round++)
+    {
+        int sock = connect_server();
+        int fd = open(t->outfile, O_WRONLY);
+        if (sock < 0 || fd < 0)
+            return 0;
+
+        int n = t->nbad;
+        struct range *ranges = t->bad;
+        t->bad = NULL;
+        t->nbad = t->badcap = 0;
+
+        char **lines = malloc(n * sizeof(char *));
+        char *quoted = fx_quote_path(malloc(3 * strlen(t->file) + 1), t->file);
+        for (int i = 0; i < n; i++)
+        {
+            lines[i] = malloc(strlen(quoted) + 64);
+            sprintf(lines[i], "GET %s crc sparse%s off=%ld len=%ld", quoted,
+                    compress ? " z=lz" : "", ranges[i].off, ranges[i].len);
+        }
+        free(quoted);
+        printf("\033[0;33mRequesting %d corrupt block(s) of %s again\033[0m\n", n, t->file);
+        pid_t writer = send_requests(sock, lines, NULL, NULL, n);
+        struct rx r = {0};
+        rx_init(&r, sock);
+        wb_open(&batch, fd, 0);
+        for (int i = 0; i < n; i++)
+            if (receive_file(&r, t, &batch, 1) < 0)
+            {
+                add_bad_range(t, ranges[i].off, ranges[i].len);
+                break;
+            }
+        close(sock);
+        if (close(fd) < 0 && !t->write_error)
+            t->write_error = errno;
+        free(r.buf);
+        waitpid(writer, NULL, 0);
+        for (int i = 0; i < n; i++)
+            free(lines[i]);
+        free(lines);
+        free(ranges);
+        if (t->write_error)
+            return 0;
+    }
+    return t->nbad == 0 && crc_of_file(t->outfile) == t->file_crc;
+}
+
+//------------------- RECEIVING DIRECTORIES ---------
+
+/*
+ * -R: each name is a directory, received as one DIR
+ * archive. This thread parses and checks the frames,
+ * WRITERS threads create the files: every file goes
+ * to one writer (in turn) whose queue keeps its open,
+ * writes and close in order, so many small files are
+ * opened, written and closed in parallel.
+ */
+
+#define WRITERS 4
+#define WQ_LEN 64
+
+#define WJ_OPEN 0
+#define WJ_DATA 1
+#define WJ_HOLE 2
+#define WJ_CLOSE 3
+#define WJ_QUIT 4
+
+struct wjob
+{
+    int type;              // WJ_*
+    char *path;            // WJ_OPEN: file to create
+    mode_t mode;           // WJ_OPEN
+    off_t off;             // WJ_DATA/HOLE: file offset, WJ_OPEN/CLOSE: size
+    char *data;            // WJ_DATA: malloc()ed block
+    size_t len;            // WJ_DATA/HOLE
+};
+
+struct writer
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct wjob q[WQ_LEN];
+    int head, count;
+    int fd;                // file being written
+    long write_calls;
+    int errors;            // files that could not be written
+};
+
+struct writer writers[WRITERS];
+
+int make_parents(char *path)
+{
+    /*
+     * mkdir -p of the directories leading to path
+     */
+    for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/'))
+    {
+        *p = '\0';
+        int ok = mkdir(path, 0777) == 0 || errno == EEXIST;
+        *p = '/';
+        if (!ok)
+            return -1;
+    }
+    return 0;
+}
+
+void writer_job(struct writer *w, struct wjob *j)
+{
+    if (j->type == WJ_OPEN)
+    {
+        int flags = O_WRONLY | O_TRUNC | O_CREAT;
+        w->fd = open(j->path, flags, j->mode & 0777);
+        if (w->fd < 0 && errno == ENOENT && make_parents(j->path) == 0)
+            w->fd = open(j->path, flags, j->mode & 0777);
+        if (w->fd < 0)
+        {
+            printf("\033[1;31mCouldn't create %s\033[0m\n", j->path);
+            w->errors++;
+        }
+        else if (j->off >= WB_SIZE)
+            fallocate(w->fd, 0, 0, j->off);
+        free(j->path);
+    }
+    else if (j->type == WJ_DATA)
+    {
+        if (w->fd >= 0 && pwrite(w->fd, j->data, j->len, j->off) != (ssize_t)j->len)
+        {
+            w->errors++;
+            close(w->fd);
+            w->fd = -1;
+        }
+        w->write_calls++;
+        free(j->data);
+    }
+    else if (j->type == WJ_HOLE && w->fd >= 0)
+        fallocate(w->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, j->off, j->len);
+    else if (j->type == WJ_CLOSE && w->fd >= 0)
+    {
+        ftruncate(w->fd, j->off);
+        close(w->fd);
+        w->fd = -1;
+    }
+}
+
+void *writer_main(void *arg)
+{
+    struct writer *w = arg;
+    while (1)
+    {
+        pthread_mutex_lock(&w->lock);
+        while (!w->count)
+            pthread_cond_wait(&w->changed, &w->lock);
+        struct wjob j = w->q[w->head];
+        w->head = (w->head + 1) % WQ_LEN;
+        w->count--;
+        pthread_cond_signal(&w->changed);
+        pthread_mutex_unlock(&w->lock);
+        if (j.type == WJ_QUIT)
+            return NULL;
+        writer_job(w, &j);
+    }
+}
+
+void writer_push(struct writer *w, struct wjob j)
+{
+    pthread_mutex_lock(&w->lock);
+    while (w->count == WQ_LEN)
+        pthread_cond_wait(&w->changed, &w->lock);
+    w->q[(w->head + w->count) % WQ_LEN] = j;
+    w->count++;
+    pthread_cond_signal(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void writers_start()
+{
+    for (int i = 0; i < WRITERS; i++)
+    {
+        struct writer *w = &writers[i];
+        memset(w, 0, sizeof(*w));
+        w->fd = -1;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->changed, NULL);
+        pthread_create(&w->thread, NULL, writer_main, w);
+    }
+}
+
+int writers_stop(struct transfer *t)
+{
+    /*
+     * Wait for every queued job, returns the number
+     * of files that could not be written
+     */
+    int errors = 0;
+    for (int i = 0; i < WRITERS; i++)
+    {
+        struct writer *w = &writers[i];
+        writer_push(w, (struct wjob){WJ_QUIT});
+        pthread_join(w->thread, NULL);
+        if (w->fd >= 0)
+            close(w->fd);
+        t->write_calls += w->write_calls;
+        errors += w->errors;
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->changed);
+    }
+    return errors;
+}
+
+int safe_member(const char *rel, size_t len)
+{
+    /*
+     * A member must stay inside the output directory:
+     * relative, no ".." component, no NUL byte
+     */
+    if (!len || rel[0] == '/' || strlen(rel) != len)
+        return 0;
+    for (const char *p = rel; p; p = strchr(p, '/'))
+    {
+        p += *p == '/';
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+            return 0;
+    }
+    return 1;
+}
+
+int receive_dir(struct rx *r, struct transfer *t)
+{
+    /*
+     * Read one DIR response into t->outfile. Blocks
+     * are checked here and handed to the writer of
+     * their file. Returns -1 if the connection broke
+     */
+    struct fx_header h;
+    if (rx_frame(r, &h) < 0)
         return -1;
+    if (h.type == FX_ERR)
+    {
+        char msg[64];
+        char *p = rx_need(r, h.len);
+        if (!p)
+            return -1;
+        int n = h.len < sizeof(msg) - 1 ? h.len : sizeof(msg) - 1;
+        memcpy(msg, p, n);
+        msg[n] = '\0';
+        printf("\033[1;36mERR 01: Directory Not Found (%s)\033[0m\n\n", msg);
+        return 0;
     }
+    if (h.type != FX_OPEN || (mkdir(t->outfile, 0777) < 0 && errno != EEXIST))
+        return -1;
+    t->found = 1;
+
+    writers_start();
+    struct writer *w = NULL;
+    char path[2 * FX_LINE_MAX + 32];
+    int status = -1, bad = 0;
+    while (rx_frame(r, &h) == 0)
+    {
+        if (h.type == FX_ENTRY)
+        {
+            char *p = rx_need(r, h.len);
+            if (!p || h.len < 4 || h.len > 4 + FX_LINE_MAX)
+                break;
+            char rel[FX_LINE_MAX + 1];
+            memcpy(rel, p + 4, h.len - 4);
+            rel[h.len - 4] = '\0';
+            if (!safe_member(rel, h.len - 4))
+            {
+                printf("\033[1;31mUnsafe member name in the archive\033[0m\n");
+                break;
+            }
+            snprintf(path, sizeof(path), "%s/%s", t->outfile, rel);
+            mode_t mode = fx_get32((unsigned char *)p);
+
+            /*
+             * Directories are made here, before any
+             * writer can need them
+             */
+            if (h.flags & FX_F_DIR)
+            {
+                mkdir(path, (mode & 0777) | 0700);
+                t->ndirs++;
+                w = NULL;
+                continue;
+            }
+            w = &writers[t->nfiles++ % WRITERS];
+            writer_push(w, (struct wjob){WJ_OPEN, strdup(path), mode, h.off});
+            t->size += h.off;
+            t->running_crc = 0;
+            bad = 0;
+            continue;
+        }
+        if (h.type == FX_END && (h.flags & FX_F_LAST))
+        {
+            t->complete = 1;
+            status = 1;
+            break;
+        }
+        if (!w)
+            break;
+        if (h.type == FX_HOLE)
+        {
+            unsigned char *p = (unsigned char *)rx_need(r, h.len);
+            if (!p || h.len != 8)
+                break;
+            uint64_t len = fx_get64(p);
+            t->wire_bytes += h.len;
+            t->received += len;
+            t->hole_bytes += len;
+            t->running_crc = crc32c_zeros(t->running_crc, len);
+            writer_push(w, (struct wjob){WJ_HOLE, NULL, 0, h.off, NULL, len});
+            continue;
+        }
+        if (h.type == FX_END)
+        {
+            if (bad || h.crc != t->running_crc)
+            {
+                printf("\033[1;31mChecksum mismatch in %s\033[0m\n", path);
+                t->bad_files++;
+            }
+            writer_push(w, (struct wjob){WJ_CLOSE, NULL, 0, h.off});
+            w = NULL;
+            continue;
+        }
+        if (h.type != FX_DATA || h.len > LZ_BOUND(FX_CHUNK) || h.raw > FX_CHUNK)
+            break;
+        char *payload = rx_need(r, h.len);
+        if (!payload)
+            break;
+        t->wire_bytes += h.len;
+        char *block = malloc(h.raw ? h.raw : 1);
+        int len = h.len;
+        if (h.flags & FX_F_LZ)
+        {
+            double t0 = cpu_time();
+            len = lz_decompress(payload, h.len, block, h.raw);
+            t->lz_cpu += cpu_time() - t0;
+        }
+        else if (len == (int)h.raw)
+            memcpy(block, payload, len);
+        if (len != (int)h.raw || crc32c(0, block, h.raw) != h.crc)
+        {
+            bad = 1;
+            free(block);
+            continue;
+        }
+        t->number_of_block++;
+        t->received += len;
+        t->running_crc = crc32c(t->running_crc, block, len);
+        writer_push(w, (struct wjob){WJ_DATA, NULL, 0, h.off, block, len});
+    }
+    t->bad_files += writers_stop(t);
+    return status;
+}
+
+/**         DRIVER CODE         **/
+
+int main(int argc, char const *argv[])
+{
+    int sock = connect_server();
+    if (sock < 0)
+        return -1;
+    crc32c_init();
 
     // connection successfully established
     printf("\
@@ -130,103 +1042,254 @@ int main(int argc, char const *argv[])
     \033[0m\n\n");
 
     /*
-     * read the file name
-     * send the request to server the file name
+     * read the file names (command line or prompt)
+     * send all the requests at once - the server
+     * answers them back to back on this connection
      */
-    char file[MAXLEN];
-    printf("Enter the file name: ");
-    scanf("%s", file);
-    printf("\n\033[0;32mSending request to server ...\033[0m\n\n");
-    send(sock, file, strlen(file), 0);
-
-    // struct pollfd pfd[] = {{sock, POLLIN, 0}};
-    // poll(pfd, 1, 5);
-    // printf("%d\n", pfd[0].revents);
-
-    int l = sizeof(serv_addr);
-
-    /*
-         * File successfully found in the server
-         * write the obtained data into an output file
-         * store the number of words read with the aid of get_words()
-         */
-    printf("\nReceiving data for \033[0;35m%s\033[0m\n", file);
-    int fd = open_file("output.txt");
-    int size_of_file = 0;
-    int size_of_last_block = 0;
-    int number_of_block = 0;
-    char buffer[MAXLEN];
-
-    if (fd < 0)
+    char *files[FX_LINE_MAX];
+    int nfiles = 0;
+    char input[FX_LINE_MAX];
+    for (int i = 1; i < argc && nfiles < FX_LINE_MAX; i++)
     {
-        printf("Couldn't open the output file\n\n");
-        return 0;
+        if (strcmp(argv[i], "-z") == 0)
+            compress = 1;
+        else if (strcmp(argv[i], "-D") == 0)
+            use_direct = 1;
+        else if (strcmp(argv[i], "-d") == 0)
+            delta = 1;
+        else if (strcmp(argv[i], "-R") == 0)
+            dir_mode = 1;
+        else
+            files[nfiles++] = (char *)argv[i];
     }
-
-    // if the buf  received is "E"
-    // file is empty  hence  close
-    // the  connection   else  the
-    // file   is   not  empty  and
-    // continue receiving the data
-    int len = recv(sock, buffer, MAXLEN, 0);
-    buffer[len] = '\0';
-
-    if (strcasecmp(buffer, "E") == 0)
+    if (!nfiles)
     {
-        printf("\033[1;36mERR 01: File Not Found\033[0m\n\n");
-        shutdown(sock, O_RDWR);
-        close(sock);
+        printf("Enter the file name(s): ");
+        if (!fgets(input, sizeof(input), stdin))
+            return 0;
+        for (char *tok = strtok(input, " \t\n"); tok; tok = strtok(NULL, " \t\n"))
+            files[nfiles++] = tok;
+    }
+    if (!nfiles)
+    {
+        printf("No file requested\n");
         return 0;
     }
 
-    len = recv(sock, buffer, MAXLEN, 0);
-    buffer[len] = '\0';
-    int FSIZE = atoi(buffer);
-    printf("\033[1;35mExpected File Size to be Received: %d bytes\033[0m\n\n", FSIZE);
-    if (FSIZE == 0)
+    struct transfer *transfers = calloc(nfiles, sizeof(struct transfer));
+    char **lines = malloc(nfiles * sizeof(char *));
+    char **bodies = calloc(nfiles, sizeof(char *));
+    size_t *body_len = calloc(nfiles, sizeof(size_t));
+    for (int i = 0; i < nfiles; i++)
     {
-        printf("\033[1;36mEmpty File\033[0m\n\n");
+        struct transfer *t = &transfers[i];
+        t->file = files[i];
+        output_name(files[i], nfiles, t->outfile);
+        lines[i] = malloc(3 * strlen(files[i]) + 64);
+        char *quoted = fx_quote_path(malloc(3 * strlen(files[i]) + 1), files[i]);
+        t->basis_fd = -1;
+        if (dir_mode)
+        {
+            size_t n = strlen(files[i]);
+            while (n > 1 && files[i][n - 1] == '/')
+                files[i][--n] = '\0';
+            output_name(files[i], 2, t->outfile);
+            fx_quote_path(quoted, files[i]);
+            sprintf(lines[i], "DIR %s crc sparse%s", quoted, compress ? " z=lz" : "");
+            free(quoted);
+            continue;
+        }
+
+        /*
+         * With -d an existing output file becomes the
+         * basis of a delta, the new version is written
+         * next to it and renamed over it at the end
+         */
+        struct stat st;
+        if (delta && stat(t->outfile, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+            t->basis_fd = open(t->outfile, O_RDONLY);
+        if (t->basis_fd >= 0)
+        {
+            bodies[i] = make_signatures(t, st.st_size, &body_len[i]);
+            sprintf(lines[i], "SYNC %s bs=%zu n=%ld crc%s", quoted, t->bs, t->nsig,
+                    compress ? " z=lz" : "");
+        }
+        else
+            sprintf(lines[i], "GET %s crc sparse%s", quoted, compress ? " z=lz" : "");
+        free(quoted);
     }
-    else
+    printf("\n\033[0;32mSending %d request(s) to server ...\033[0m\n\n", nfiles);
+    pid_t writer = send_requests(sock, lines, bodies, body_len, nfiles);
+
+    /*
+     * Responses come in the order of the requests
+     * each one framed as OPEN, DATA ..., END or as
+     * a single ERR frame
+     */
+    rx_init(&receiver, sock);
+    double start = now();
+    long total_bytes = 0, wire_bytes = 0;
+    double lz_cpu = 0;
+    int received = 0;
+
+    for (int i = 0; i < nfiles; i++)
     {
-        while (size_of_file < FSIZE)
+        struct transfer *t = &transfers[i];
+        printf("\nReceiving data for \033[0;35m%s\033[0m\n", t->file);
+        if (dir_mode)
         {
-            // The chunk size used by the server is not known to the client ###################################################################
-            len = recv(sock, buffer, MAXLEN, MSG_WAITALL);
-
-            if (!len)
+            if (receive_dir(&receiver, t) < 0)
+            {
+                printf("\033[1;31mTransfer of %s was cut short\033[0m\n\n", t->file);
                 break;
+            }
+            continue;
+        }
 
-            number_of_block++;
-            size_of_last_block = len;
-            buffer[len] = '\0';
-            size_of_file += len;
-            write(fd, buffer, strlen(buffer));
+        char path[FX_LINE_MAX + 32];
+        if (t->basis_fd >= 0)
+            sprintf(path, "%s.sync", t->outfile);
+        else
+            strcpy(path, t->outfile);
+
+        int fd = -1, direct = 0;
+        if (use_direct)
+            direct = (fd = open(path, O_WRONLY | O_TRUNC | O_CREAT | O_DIRECT, 0666)) >= 0;
+        if (fd < 0)
+            fd = open_file(path);
+        if (fd < 0)
+        {
+            printf("Couldn't open the output file\n\n");
+            return 0;
+        }
+        wb_open(&batch, fd, direct);
+        int status = receive_file(&receiver, t, &batch, 0);
+        if (t->found && ftruncate(fd, t->size) < 0 && !t->write_error) // drop O_DIRECT padding
+            t->write_error = errno;
+        if (close(fd) < 0 && !t->write_error)
+            t->write_error = errno;
+
+        /*
+         * A delta that could not be written must not
+         * replace the old copy it was made from
+         */
+        if (!t->found || (t->write_error && t->basis_fd >= 0))
+            unlink(path);
+        else if (t->basis_fd >= 0)
+            rename(path, t->outfile);
+        if (t->basis_fd >= 0)
+            close(t->basis_fd);
+        if (status == -1)
+        {
+            printf("\033[1;31mTransfer of %s was cut short\033[0m\n\n", t->file);
+            break;
         }
     }
+
     /*
-         * if the len of data received is zero
-         * close the file descriptor of output file
-         * shutdown the socket
-         * close the socket
-         */
-    close(fd);
-    shutdown(sock, O_RDWR);
+     * close the socket once every response
+     * has been read, the server only takes
+     * the repair connection after this one
+     */
     close(sock);
+    waitpid(writer, NULL, 0);
 
-    /*
-         * Print the size of the file
-         * Print the number of words in the file
+    for (int i = 0; i < nfiles; i++)
+    {
+        struct transfer *t = &transfers[i];
+        if (!t->complete)
+            continue;
+        if (dir_mode)
+        {
+            /*
+             * Every file of the archive was checked as
+             * it arrived, a corrupt one is reported
+             */
+            printf("\n\
+        \033[0;32m> Directory Transfer is %s <\033[0m\n\n\
+        ************************************************\n\
+            \033[0;35mFiles / directories\033[0m = \033[1;36m%d / %d\033[0m\n\
+            \033[0;35mBytes\033[0m = \033[1;36m%ld\033[0m\n\
+            \033[0;35mFailed files\033[0m = \033[1;36m%d\033[0m\n\
+            \033[0;35mBytes on the wire\033[0m = \033[1;36m%ld (%.1f%%)\033[0m\n\
+            \033[0;35mDisk writes\033[0m = \033[1;36m%ld (%d writer threads)\033[0m\n\
+        ************************************************\n\n",
+                   t->bad_files ? "Incomplete" : "Successful!!", t->nfiles, t->ndirs,
+                   t->received, t->bad_files, t->wire_bytes,
+                   t->received ? 100.0 * t->wire_bytes / t->received : 100.0,
+                   t->write_calls, WRITERS);
+            if (t->hole_bytes)
+                printf("\033[0;33mSparse: %ld bytes of holes were not sent\033[0m\n", t->hole_bytes);
+            printf("Output Written in directory \033[0;31m%s\033[0m\n", t->outfile);
+            received += !t->bad_files;
+            total_bytes += t->received;
+            wire_bytes += t->wire_bytes;
+            lz_cpu += t->lz_cpu;
+            continue;
+        }
+
+        /*
+         * Verify the file: when every block passed its
+         * own check the running checksum must match the
+         * one sent with FX_END, otherwise fetch the bad
+         * ranges again and check the file on disk
          */
-    printf("\n\
+        printf("\n\033[1;35m%s: %ld bytes expected\033[0m\n", t->file, t->size);
+        if (t->size == 0)
+            printf("\033[1;36mEmpty File\033[0m\n\n");
+        if (t->write_error)
+        {
+            printf("\033[1;31mCouldn't write %s: %s\033[0m\n\n", t->outfile, strerror(t->write_error));
+            continue;
+        }
+        if (!t->nbad && t->running_crc != t->file_crc)
+            add_bad_range(t, 0, t->size);
+        int verified = t->nbad ? repair_file(t) : 1;
+        if (!verified)
+        {
+            if (t->write_error)
+                printf("\033[1;31mCouldn't write %s: %s\033[0m\n", t->outfile, strerror(t->write_error));
+            printf("\033[1;31mIntegrity check failed for %s\033[0m\n\n", t->file);
+            continue;
+        }
+        received++;
+        total_bytes += t->size;
+        wire_bytes += t->wire_bytes;
+        lz_cpu += t->lz_cpu;
+
+        /*
+         * Print the number of blocks and the
+         * size of the last block of this file
+         */
+        printf("\n\
         \033[0;32m> File Transfer is Successful!! <\033[0m\n\n\
         ************************************************\n\
             \033[0;35mTotal number of blocks received\033[0m  = \033[1;36m%d\033[0m\n\
             \033[0;35mLast block size\033[0m = \033[1;36m%d bytes\033[0m\n\
+            \033[0;35mCRC32C\033[0m = \033[1;36m%08x (verified)\033[0m\n\
+            \033[0;35mBytes on the wire\033[0m = \033[1;36m%ld (%.1f%%)\033[0m\n\
+            \033[0;35mDisk writes\033[0m = \033[1;36m%ld\033[0m\n\
         ************************************************\n\n",
-           number_of_block, size_of_last_block);
+               t->number_of_block, t->size_of_last_block, t->file_crc, t->wire_bytes,
+               t->size ? 100.0 * t->wire_bytes / t->size : 100.0, t->write_calls);
+
+        if (t->hole_bytes)
+            printf("\033[0;33mSparse: %ld bytes of holes were not sent\033[0m\n", t->hole_bytes);
+        if (t->bs)
+            printf("\033[0;33mDelta: %ld of %ld bytes reused from the old %s\033[0m\n",
+                   t->copied, t->size, t->outfile);
+        printf("Output Written in file \033[0;31m%s\033[0m\n", t->outfile);
+    }
 
-    printf("Output Written in file \033[0;31moutput.txt\033[0m\n");
+    double elapsed = now() - start;
+    printf("\n\033[0;33m%d/%d file(s), %ld bytes in %.3f s (%.2f MB/s)\033[0m\n",
+           received, nfiles, total_bytes, elapsed,
+           elapsed > 0 ? total_bytes / elapsed / 1e6 : 0.0);
+    printf("\033[0;33m%ld recv() calls, final receive size %zu KB\033[0m\n",
+           receiver.recv_calls, receiver.chunk / 1024);
+    if (compress || delta)
+        printf("\033[0;33m%ld bytes on the wire (%.1f%%), %.3f ms CPU decompressing\033[0m\n",
+               wire_bytes, total_bytes ? 100.0 * wire_bytes / total_bytes : 100.0, lz_cpu * 1e3);
 
     return 0;
 }
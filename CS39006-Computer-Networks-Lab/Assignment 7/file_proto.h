@@ -0,0 +1,317 @@
+/**
+ *
+ *       Network Assignment-7
+ *
+ *     *--------------------------------*
+ *     *   Framed File Transfer Protocol *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @file:        file_proto.h
+ *
+ *      Shared by file_server.c and file_client.c
+ *
+ *      Protocol:
+ *      ---------
+ *      The client opens one connection and writes  any
+ *      number of request lines without waiting:
+ *
+ *          GET <path> [crc] [z=lz] [sparse] [off=<n>] [len=<n>]\n
+ *
+ *      then half-closes the socket (or sends "BYE\n").
+ *      "crc" asks for CRC32C checksums, off/len ask for
+ *      a byte range of the file instead of all of it,
+ *      "z=lz" lets the server compress DATA payloads
+ *      with lzblock.h (flag FX_F_LZ, raw = size before
+ *      compression). Blocks that do not shrink are sent
+ *      as they are. With "sparse" the holes of a sparse
+ *      file are not sent as zeros but as FX_HOLE frames
+ *      (off = file offset, payload = 8 byte length), the
+ *      checksums count them as zero bytes.
+ *
+ *          SYNC <path> bs=<n> n=<count> [crc] [z=lz]\n
+ *          <count> signatures, RS_SIG_LEN bytes each
+ *          (count <= FX_SIG_MAX)
+ *
+ *      asks for <path> as a delta against the client's
+ *      old copy, whose blocks of <n> bytes have the given
+ *      rsum.h signatures. The answer is framed like GET
+ *      but parts of the file may come as FX_COPY frames
+ *      (off = file offset, raw = bytes, payload = first
+ *      block and number of blocks of the old copy).
+ *
+ *          DIR <path> [crc] [z=lz] [sparse]\n
+ *
+ *      asks for every file below the directory <path>
+ *      as one archive: FX_OPEN, then for each member an
+ *      FX_ENTRY (off = size, payload = mode(4) and the
+ *      path below <path>), for a regular file followed
+ *      by its DATA frames and its own END, and last an
+ *      FX_END flagged FX_F_LAST (off = number of files).
+ *      Directories are flagged FX_F_DIR and come before
+ *      anything inside them.
+ *      The server answers the requests in order, back to
+ *      back, each one as a sequence of frames:
+ *
+ *          FX_OPEN (off = file size)
+ *          FX_DATA (off = file offset, payload = bytes,
+ *                   crc = checksum of the file bytes) ...
+ *          FX_END  (off = total bytes sent,
+ *                   crc = checksum of everything sent)
+ *
+ *      or a single FX_ERR whose payload is the reason.
+ *      In every request line the path is escaped with
+ *      fx_quote_path(): white space, '%' and control
+ *      bytes are sent as %XX, so paths may hold spaces.
+ *      A request that does not start with one of these
+ *      verbs is served with the old one-file-per-
+ *      connection protocol of the assignment.
+ */
+
+#ifndef FILE_PROTO_H
+#define FILE_PROTO_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define FX_HEADER_LEN 24
+#ifndef FX_CHUNK // file_bench.c builds other chunk sizes
+#define FX_CHUNK (64 * 1024)
+#endif
+#define FX_LINE_MAX 4096
+#define FX_SIG_MAX (1L << 22) // signatures in one SYNC, 64 MB of them
+
+/* frame types */
+#define FX_OPEN 1
+#define FX_DATA 2
+#define FX_END 3
+#define FX_ERR 4
+#define FX_COPY 5
+#define FX_ENTRY 6
+#define FX_HOLE 7
+
+/* frame flags */
+#define FX_F_LZ 0x01   // payload compressed with lz_compress()
+#define FX_F_DIR 0x02  // FX_ENTRY of a directory
+#define FX_F_LAST 0x04 // FX_END of a whole DIR archive
+
+struct fx_header
+{
+    uint8_t type;     // one of FX_*
+    uint8_t flags;    // FX_F_*
+    uint32_t len;     // bytes of payload following the header
+    uint64_t off;     // meaning depends on the frame type
+    uint32_t crc;     // CRC32C if requested, else zero
+    uint32_t raw;     // FX_DATA: bytes of file data carried
+};
+
+//---------------- WIRE ENCODING -------------------
+
+static inline void fx_put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+}
+
+static inline uint32_t fx_get32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void fx_put64(unsigned char *p, uint64_t v)
+{
+    fx_put32(p, v >> 32);
+    fx_put32(p + 4, (uint32_t)v);
+}
+
+static inline uint64_t fx_get64(const unsigned char *p)
+{
+    return (uint64_t)fx_get32(p) << 32 | fx_get32(p + 4);
+}
+
+static inline void fx_pack(unsigned char *p, const struct fx_header *h)
+{
+    /*
+     * type(1) flags(1) reserved(2) len(4) off(8)
+     * crc(4) raw(4)
+     * all multi byte fields in network order
+     */
+    p[0] = h->type;
+    p[1] = h->flags;
+    p[2] = p[3] = 0;
+    fx_put32(p + 4, h->len);
+    fx_put64(p + 8, h->off);
+    fx_put32(p + 16, h->crc);
+    fx_put32(p + 20, h->raw);
+}
+
+static inline void fx_unpack(const unsigned char *p, struct fx_header *h)
+{
+    h->type = p[0];
+    h->flags = p[1];
+    h->len = fx_get32(p + 4);
+    h->off = fx_get64(p + 8);
+    h->crc = fx_get32(p + 16);
+    h->raw = fx_get32(p + 20);
+}
+
+//---------------- SOCKET HELPERS ------------------
+
+static inline int send_all(int sock, const void *buf, size_t len)
+{
+    /*
+     * send() may write only part of the buffer
+     * keep going until everything is written
+     */
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static inline int recv_all(int sock, void *buf, size_t len)
+{
+    /*
+     * Returns 1 on success, 0 on a clean EOF
+     * before any byte and -1 on error or on
+     * an EOF in the middle of the buffer
+     */
+    char *p = buf;
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = recv(sock, p + got, len - got, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return (n == 0 && got == 0) ? 0 : -1;
+        got += n;
+    }
+    return 1;
+}
+
+static inline int fx_send_frame(int sock, const struct fx_header *h, const void *payload)
+{
+    /*
+     * Header and payload leave in a single sendmsg()
+     * so a small frame is a single TCP segment
+     */
+    unsigned char hdr[FX_HEADER_LEN];
+    uint32_t len = h->len;
+    fx_pack(hdr, h);
+
+    struct iovec iov[2] = {{hdr, FX_HEADER_LEN}, {(void *)payload, len}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len ? 2 : 1;
+
+    ssize_t n;
+    do
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -1;
+    if (n < FX_HEADER_LEN)
+    {
+        if (send_all(sock, hdr + n, FX_HEADER_LEN - n) < 0)
+            return -1;
+        n = FX_HEADER_LEN;
+    }
+    return send_all(sock, (const char *)payload + (n - FX_HEADER_LEN), len - (n - FX_HEADER_LEN));
+}
+
+static inline int fx_send(int sock, int type, uint64_t off, const void *payload, uint32_t len)
+{
+    struct fx_header h = {type, 0, len, off, 0, len};
+    return fx_send_frame(sock, &h, payload);
+}
+
+static inline int fx_recv(int sock, struct fx_header *h)
+{
+    unsigned char hdr[FX_HEADER_LEN];
+    int status = recv_all(sock, hdr, FX_HEADER_LEN);
+    if (status > 0)
+        fx_unpack(hdr, h);
+    return status;
+}
+
+//---------------- REQUEST PATHS -------------------
+
+static inline char *fx_quote_path(char *out, const char *path)
+{
+    /*
+     * Escape path for a request line, out needs
+     * 3 * strlen(path) + 1 bytes. Returns out
+     */
+    static const char hex[] = "0123456789ABCDEF";
+    char *o = out;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++)
+    {
+        if (*p <= ' ' || *p == '%' || *p == 0x7f)
+        {
+            *o++ = '%';
+            *o++ = hex[*p >> 4];
+            *o++ = hex[*p & 15];
+        }
+        else
+            *o++ = *p;
+    }
+    *o = '\0';
+    return out;
+}
+
+static inline int fx_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static inline int fx_unquote_path(char *s)
+{
+    /*
+     * Undo fx_quote_path() in place. -1 for a
+     * malformed escape or an escaped NUL byte
+     */
+    char *o = s;
+    for (; *s; s++)
+    {
+        if (*s != '%')
+        {
+            *o++ = *s;
+            continue;
+        }
+        int hi = fx_hex(s[1]), lo = hi < 0 ? -1 : fx_hex(s[2]);
+        if (lo < 0 || (hi | lo) == 0)
+            return -1;
+        *o++ = (char)(hi << 4 | lo);
+        s += 2;
+    }
+    *o = '\0';
+    return 0;
+}
+
+#endif
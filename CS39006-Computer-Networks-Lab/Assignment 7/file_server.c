@@ -19,83 +19,2788 @@
  * 
  *      How to run:
  *      -----------
- *      $ gcc file_server.c -o file_server
- *      $ ./file_server
+ *      $ gcc file_server.c -o file_server -lpthread
+ *      $ ./file_server [-r <bytes per second>[k|m|g]] [-u <host:port>] [-P <port>]
+ *
+ *      Connections are served concurrently by a few
+ *      io_uring worker threads (see ASYNC ENGINE),
+ *      one at a time where io_uring is unavailable.
+ *      Every connection gets a fair share of the send
+ *      bandwidth, -r caps each client IP address.
+ *      With -u the server is a caching proxy for the
+ *      file server at host:port (see CACHING PROXY),
+ *      e.g.  ./file_server -P 9090  and in another
+ *      directory  ./file_server -u 127.0.0.1:9090
  */
 
 // Server side C/C++ program to demonstrate Socket programming
+#include <ctype.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+
+#include "crc32c.h"
+#include "rsum.h"
+#include "lzblock.h"
+#include "file_proto.h"
+#include "uring.h"
 
 #define PORT 8080
+#ifndef MAXLEN // file_bench.c builds other chunk sizes
 #define MAXLEN 20
+#endif
+
+#define CACHE_SIZE 64
+#define CACHE_BUCKETS 256
+
+//---------------- UTILITY FUNCTIONS ---------------
+
+int open_file(const char *s)
+{
+    /*
+     * Find the path of the requested file
+     * if it exists somewhere on the server
+     */
+
+    char *path = realpath(s, NULL);
+
+    /*
+     * If the file doesn't exist on  the 
+     * server then return return -1  for
+     * indication file not found
+     */
+
+    if (!path)
+    {
+        printf("\033[1;36mRequested File Not Found\033[0m\n\n");
+        return -1;
+    }
+    else
+        printf("Resource requested found at location:\n\
+        \033[1;36m%s\033[0m\n\n",
+               path);
+
+    /*
+     * If the path of the file  is  found
+     * Then open the file and return  the
+     * File descriptor after opening  the 
+     * file in read mode
+     */
+
+    int fd = open(path, O_RDONLY, 0666);
+    return fd;
+}
+
+int get_file_size(char *filename)
+{
+    /**
+     * To get the size of the file we make 
+     * use of the stat system  call  which
+     * will return  the stats of the  file
+     * along with file size as one  of the
+     * return values.
+     */
+
+    struct stat st;
+    stat(filename, &st);
+    int size = st.st_size;
+    return size;
+}
+
+//---------------- HOT FILE CACHE ------------------
+
+/**
+ * Every request used to pay for a realpath(),
+ * an open() and a stat() even when the  same
+ * file was asked for a  thousand  times.  We
+ * keep the open descriptor and the  metadata
+ * of recently requested files in a small LRU
+ * cache keyed by the  requested  path.  Each
+ * cached file is watched with inotify so any
+ * modification, rename or delete invalidates
+ * its entries before the next lookup.
+ *
+ * The cache is shared by the worker threads, so
+ * it is guarded by one mutex and entries are
+ * reference counted: an entry that is evicted
+ * while a response still reads from it keeps
+ * its descriptor until the last release.
+ */
+
+struct cache_entry
+{
+    char *key;                        // path as requested by the client
+    int fd;                           // open descriptor (read with pread)
+    int wd;                           // inotify watch descriptor
+    off_t size;                       // size of the file in bytes
+    int refs;                         // responses reading from fd
+    int removed;                      // no longer in the cache
+    struct cache_entry *hnext;        // next entry in the hash bucket
+    struct cache_entry *prev, *next;  // LRU list (head = most recent)
+};
+
+struct file_cache
+{
+    pthread_mutex_t lock;
+    int ifd;                                        // inotify instance
+    int count;                                      // number of cached files
+    struct cache_entry *buckets[CACHE_BUCKETS];
+    struct cache_entry *head, *tail;
+    long hits, misses, evictions, invalidations;
+};
+
+struct file_cache cache;
+
+unsigned int hash_key(const char *s)
+{
+    /*
+     * FNV-1a hash of the requested path
+     */
+    unsigned int h = 2166136261u;
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h % CACHE_BUCKETS;
+}
+
+void cache_init()
+{
+    memset(&cache, 0, sizeof(cache));
+    pthread_mutex_init(&cache.lock, NULL);
+    cache.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache.ifd < 0)
+        perror("\033[0;31minotify unavailable, cache disabled\033[0m\n");
+}
+
+void lru_unlink(struct cache_entry *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        cache.head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        cache.tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+void lru_push_front(struct cache_entry *e)
+{
+    e->prev = NULL;
+    e->next = cache.head;
+    if (cache.head)
+        cache.head->prev = e;
+    cache.head = e;
+    if (!cache.tail)
+        cache.tail = e;
+}
+
+void cache_remove(struct cache_entry *e)
+{
+    /*
+     * Unlink the entry from its bucket and the
+     * LRU list. The watch is only dropped when
+     * no other key (e.g. "./a.txt" and "a.txt")
+     * still refers to the same file, and the
+     * entry itself only once nobody reads it
+     */
+    struct cache_entry **pp = &cache.buckets[hash_key(e->key)];
+    while (*pp != e)
+        pp = &(*pp)->hnext;
+    *pp = e->hnext;
+    lru_unlink(e);
+
+    int shared = 0;
+    for (struct cache_entry *it = cache.head; it; it = it->next)
+        if (it->wd == e->wd)
+            shared = 1;
+    if (!shared)
+        inotify_rm_watch(cache.ifd, e->wd);
+
+    cache.count--;
+    e->removed = 1;
+    if (e->refs == 0)
+    {
+        close(e->fd);
+        free(e->key);
+        free(e);
+    }
+}
+
+void cache_drain_events()
+{
+    /*
+     * Read all pending inotify events  and
+     * drop every entry whose file changed.
+     * The inotify fd is non blocking so an
+     * empty queue costs a single syscall
+     */
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int len;
+    while ((len = read(cache.ifd, events, sizeof(events))) > 0)
+    {
+        for (char *p = events; p < events + len;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            struct cache_entry *e = cache.head;
+            while (e)
+            {
+                struct cache_entry *next = e->next;
+                if (e->wd == ev->wd)
+                {
+                    cache.invalidations++;
+                    cache_remove(e);
+                }
+                e = next;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+struct cache_entry *cache_lookup(const char *s, int *uncached)
+{
+    /*
+     * Return the cached entry for the requested
+     * path, opening and  inserting  the file on
+     * a miss. NULL means the file was not found,
+     * or, with *uncached set to its descriptor,
+     * that it cannot be watched and so is not
+     * cached (inotify watch limit, file systems
+     * without inotify)
+     */
+    *uncached = -1;
+    if (cache.ifd < 0)
+        return NULL;
+    cache_drain_events();
+
+    unsigned int h = hash_key(s);
+    for (struct cache_entry *e = cache.buckets[h]; e; e = e->hnext)
+    {
+        if (strcmp(e->key, s) == 0)
+        {
+            cache.hits++;
+            lru_unlink(e);
+            lru_push_front(e);
+            return e;
+        }
+    }
+
+    cache.misses++;
+    int fd = open_file(s);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    /*
+     * Watch through /proc so the watch is on the
+     * inode we actually opened, not on whatever
+     * the path points at by now
+     */
+    char proc_path[64];
+    sprintf(proc_path, "/proc/self/fd/%d", fd);
+    int wd = inotify_add_watch(cache.ifd, proc_path,
+                               IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                                   IN_MOVE_SELF | IN_DELETE_SELF);
+    if (wd < 0)
+    {
+        *uncached = fd;
+        return NULL;
+    }
+
+    if (cache.count == CACHE_SIZE)
+    {
+        cache.evictions++;
+        cache_remove(cache.tail);
+    }
+
+    struct cache_entry *e = calloc(1, sizeof(struct cache_entry));
+    e->key = strdup(s);
+    e->fd = fd;
+    e->wd = wd;
+    e->size = st.st_size;
+    e->hnext = cache.buckets[h];
+    cache.buckets[h] = e;
+    lru_push_front(e);
+    cache.count++;
+    return e;
+}
+
+void cache_report()
+{
+    pthread_mutex_lock(&cache.lock);
+    long total = cache.hits + cache.misses;
+    printf("\033[0;33mCache: %d files, %ld hits / %ld lookups (%.1f%%), %ld evictions, %ld invalidations\033[0m\n\n",
+           cache.count, cache.hits, total, total ? 100.0 * cache.hits / total : 0.0,
+           cache.evictions, cache.invalidations);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+//---------------- BANDWIDTH LIMITS ----------------
+
+/*
+ * With -r <rate> every client IP address gets a token
+ * bucket: <rate> bytes per second with a burst of a
+ * quarter second (at least one frame). A frame is
+ * sent only once the bucket holds its size, so all
+ * the connections from one address share the rate.
+ * The buckets are shared by all threads.
+ */
+
+#define IP_BUCKETS 256
+
+struct ip_bucket
+{
+    in_addr_t ip;
+    double tokens;            // bytes that may be sent now
+    double last;              // time of the last refill
+    struct ip_bucket *next;
+};
+
+long rate_limit = 0;          // bytes per second per client IP, 0 = none
+struct ip_bucket *ip_buckets[IP_BUCKETS];
+pthread_mutex_t ip_lock = PTHREAD_MUTEX_INITIALIZER;
+
+double mono_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double bucket_burst()
+{
+    double burst = rate_limit / 4.0;
+    double frame = FX_HEADER_LEN + LZ_BOUND(FX_CHUNK);
+    return burst > frame ? burst : frame;
+}
+
+struct ip_bucket *bucket_for(int sock)
+{
+    /*
+     * The bucket of the peer of sock, NULL when
+     * there is no limit
+     */
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    if (!rate_limit || getpeername(sock, (struct sockaddr *)&peer, &len) < 0 ||
+        peer.sin_family != AF_INET)
+        return NULL;
+
+    pthread_mutex_lock(&ip_lock);
+    struct ip_bucket **pp = &ip_buckets[peer.sin_addr.s_addr % IP_BUCKETS];
+    while (*pp && (*pp)->ip != peer.sin_addr.s_addr)
+        pp = &(*pp)->next;
+    if (!*pp)
+    {
+        *pp = calloc(1, sizeof(struct ip_bucket));
+        (*pp)->ip = peer.sin_addr.s_addr;
+        (*pp)->tokens = bucket_burst();
+        (*pp)->last = mono_time();
+    }
+    struct ip_bucket *b = *pp;
+    pthread_mutex_unlock(&ip_lock);
+    return b;
+}
+
+double bucket_take(struct ip_bucket *b, long n)
+{
+    /*
+     * Take n bytes from the bucket. Returns 0 on
+     * success, otherwise the seconds to wait
+     * before they will be there
+     */
+    if (!b)
+        return 0;
+    pthread_mutex_lock(&ip_lock);
+    double t = mono_time(), wait = 0;
+    b->tokens += (t - b->last) * rate_limit;
+    if (b->tokens > bucket_burst())
+        b->tokens = bucket_burst();
+    b->last = t;
+    if (b->tokens >= n)
+        b->tokens -= n;
+    else
+        wait = (n - b->tokens) / rate_limit;
+    pthread_mutex_unlock(&ip_lock);
+    return wait;
+}
+
+void throttle(struct ip_bucket *b, long n)
+{
+    /*
+     * Blocking senders simply sleep until the
+     * bucket allows n more bytes
+     */
+    double wait;
+    while ((wait = bucket_take(b, n)) > 0)
+    {
+        struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+        nanosleep(&ts, NULL);
+    }
+}
+
+//---------------- REQUEST HANDLING ----------------
+
+int acquire_file(const char *file, struct cache_entry **entry, off_t *size)
+{
+    /*
+     * Serve the file from the hot file cache when
+     * possible. If inotify is unavailable, or the
+     * file cannot be watched, it is opened for
+     * every request instead
+     */
+    int fd = -1, uncached;
+    struct stat st;
+    *size = 0;
+    pthread_mutex_lock(&cache.lock);
+    *entry = cache_lookup(file, &uncached);
+    if (*entry)
+    {
+        (*entry)->refs++;
+        fd = (*entry)->fd;
+        *size = (*entry)->size;
+    }
+    pthread_mutex_unlock(&cache.lock);
+    if (!*entry && uncached >= 0)
+    {
+        fd = uncached;
+        if (fstat(fd, &st) == 0)
+            *size = st.st_size;
+    }
+    else if (!*entry && cache.ifd < 0 && (fd = open_file(file)) >= 0)
+        *size = get_file_size((char *)file);
+    return fd;
+}
+
+void release_file(int fd, struct cache_entry *entry)
+{
+    /*
+     * Cached descriptors stay open for the next
+     * request, uncached ones are closed now
+     */
+    if (!entry && fd >= 0)
+        close(fd);
+    if (!entry)
+        return;
+    pthread_mutex_lock(&cache.lock);
+    if (--entry->refs == 0 && entry->removed)
+    {
+        close(entry->fd);
+        free(entry->key);
+        free(entry);
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+void serve_legacy(int new_socket, const char *file)
+{
+    /*
+     * read the name of client requested file name
+     * if not found in the local directory - close the socket
+     * if found - but an empy file ##################################################################################################
+     * if found - send chunks of data (with a maximum len of MAXLEN)
+     */
+    int status;
+    printf("File Requested by client: \033[0;35m%s\033[0m\n", file);
+
+    struct cache_entry *entry;
+    off_t size;
+    int fd = acquire_file(file, &entry, &size);
+    int FSIZE = size;
+
+    if (fd < 0)
+    {
+        /*
+         * FILE_NOT_FOUND
+         * shutdown the socket - stop transmission and reading through the socket
+         * close the socket
+         */
+
+        perror("\033[0;32m FILE NOT FOUND !!\033[0m\n");
+        char buf[2];
+        sprintf(buf, "E");
+        send(new_socket, buf, strlen(buf), 0);
+        status = shutdown(new_socket, SHUT_RDWR);
+        if (status < 0)
+            perror("\033[0;32mError in terminating the connection!!\033[0m\n");
+        close(new_socket);
+    }
+    else
+    {
+        /*
+         * create a char array of MAXLEN size
+         * continuosly read and send data through the socket
+         * once the entire content is read - shutdown the socket and close it
+         *
+         * The descriptor may be shared with later requests
+         * so we read with pread() and never move its offset
+         */
+        char *msg = "L";
+        send(new_socket, msg, strlen(msg), 0);
+
+        char fsize[MAXLEN];
+        sprintf(fsize, "%d", FSIZE);
+        printf("\033[0;33mSize of File to be sent: %d bytes\033[0m\n", FSIZE);
+        send(new_socket, fsize, strlen(fsize), 0);
+
+        char buf[MAXLEN];
+        off_t offset = 0;
+        struct ip_bucket *bucket = bucket_for(new_socket);
+        while (1)
+        {
+            int len = pread(fd, buf, MAXLEN, offset);
+            if (len > 0)
+            {
+                offset += len;
+                throttle(bucket, len);
+                send(new_socket, buf, len, 0);
+            }
+            else
+            {
+                status = shutdown(new_socket, SHUT_RDWR);
+                if (status < 0)
+                    perror("\033[0;32mError in terminating the connection!!\033[0m\n");
+                close(new_socket);
+                break;
+            }
+        }
+
+        release_file(fd, entry);
+    }
+}
+
+struct conn
+{
+    int sock;
+    int len;                  // bytes buffered in buf
+    char buf[FX_LINE_MAX];    // requests read but not yet served
+};
+
+int conn_take_line(struct conn *c, char *line)
+{
+    /*
+     * Extract the next '\n' terminated request from
+     * the connection buffer if it is complete
+     */
+    char *nl = memchr(c->buf, '\n', c->len);
+    if (!nl)
+        return 0;
+    int n = nl - c->buf;
+    memcpy(line, c->buf, n);
+    line[n] = '\0';
+    if (n > 0 && line[n - 1] == '\r')
+        line[n - 1] = '\0';
+    c->len -= n + 1;
+    memmove(c->buf, nl + 1, c->len);
+    return 1;
+}
+
+int conn_read_line(struct conn *c, char *line)
+{
+    /*
+     * Next request, reading more from the socket
+     * only when no complete line is buffered.
+     * Returns 0 once the client has half closed
+     */
+    while (1)
+    {
+        if (conn_take_line(c, line))
+            return 1;
+        if (c->len == sizeof(c->buf))
+            return 0; // request line too long
+        int len = read(c->sock, c->buf + c->len, sizeof(c->buf) - c->len);
+        if (len <= 0)
+            return 0;
+        c->len += len;
+    }
+}
+
+int conn_read_exact(struct conn *c, void *buf, size_t len)
+{
+    /*
+     * Binary request bodies (SYNC signatures) follow
+     * their line, take what is buffered first
+     */
+    size_t n = (size_t)c->len < len ? (size_t)c->len : len;
+    memcpy(buf, c->buf, n);
+    c->len -= n;
+    memmove(c->buf, c->buf + n, c->len);
+    if (n < len && recv_all(c->sock, (char *)buf + n, len - n) <= 0)
+        return -1;
+    return 0;
+}
+
+int pipelined_verb(struct conn *c)
+{
+    /*
+     * 1 if the buffered bytes start with a verb of
+     * file_proto.h, 0 if they cannot, -1 if it is
+     * too early to tell
+     */
+    const char *verbs[] = {"GET ", "SYNC ", "DIR "};
+    int undecided = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        int n = strlen(verbs[i]);
+        if (strncmp(c->buf, verbs[i], c->len < n ? c->len : n) != 0)
+            continue;
+        if (c->len >= n)
+            return 1;
+        undecided = 1;
+    }
+    return undecided ? -1 : 0;
+}
+
+#define REQ_GET 1
+#define REQ_SYNC 2
+#define REQ_DIR 3
+
+struct request
+{
+    int verb;         // REQ_GET, REQ_SYNC or REQ_DIR
+    char *path;       // requested file or directory
+    int crc;          // send CRC32C checksums
+    int lz;           // compress blocks with lzblock.h
+    int sparse;       // send holes as FX_HOLE
+    off_t off;        // first byte wanted
+    off_t len;        // bytes wanted, -1 for "up to the end"
+    size_t bs;        // SYNC: block size of the signatures
+    long nsig;        // SYNC: number of signatures that follow
+};
+
+int parse_request(char *line, struct request *req)
+{
+    /*
+     * GET <path> [crc] [z=lz] [sparse] [off=<n>] [len=<n>]
+     * SYNC <path> bs=<n> n=<n> [crc] [z=lz]
+     * DIR <path> [crc] [z=lz] [sparse]
+     * returns 0 for a malformed request
+     */
+    memset(req, 0, sizeof(*req));
+    req->len = -1;
+    char *save;
+    char *verb = strtok_r(line, " ", &save);
+    req->path = strtok_r(NULL, " ", &save);
+    if (!verb || !req->path || fx_unquote_path(req->path) < 0)
+        return 0;
+    if (strcmp(verb, "GET") == 0)
+        req->verb = REQ_GET;
+    else if (strcmp(verb, "SYNC") == 0)
+        req->verb = REQ_SYNC;
+    else if (strcmp(verb, "DIR") == 0)
+        req->verb = REQ_DIR;
+    else
+        return 0;
+    for (char *opt = strtok_r(NULL, " ", &save); opt; opt = strtok_r(NULL, " ", &save))
+    {
+        if (strcmp(opt, "crc") == 0)
+            req->crc = 1;
+        else if (strcmp(opt, "z=lz") == 0)
+            req->lz = 1;
+        else if (strcmp(opt, "sparse") == 0)
+            req->sparse = 1;
+        else if (strncmp(opt, "off=", 4) == 0)
+            req->off = atoll(opt + 4);
+        else if (strncmp(opt, "len=", 4) == 0)
+            req->len = atoll(opt + 4);
+        else if (strncmp(opt, "bs=", 3) == 0)
+            req->bs = atol(opt + 3);
+        else if (strncmp(opt, "n=", 2) == 0)
+            req->nsig = atol(opt + 2);
+        else
+            return 0;
+    }
+    if (req->verb == REQ_SYNC &&
+        (req->bs < 64 || req->bs > FX_CHUNK || req->nsig < 0 || req->nsig > FX_SIG_MAX))
+        return 0;
+    return req->off >= 0;
+}
+
+double cpu_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct send_stats
+{
+    long raw_bytes;    // file bytes sent
+    long wire_bytes;   // payload bytes actually on the wire
+    long hole_bytes;   // zero bytes sent as FX_HOLE
+    int holes;
+    int lz_blocks;     // blocks sent compressed
+    int raw_blocks;    // blocks sent as they are
+    double lz_cpu;     // seconds spent compressing
+};
+
+struct stream
+{
+    int sock;
+    const struct request *req;
+    struct send_stats st;
+    uint32_t total_crc;   // CRC32C of every byte of the target so far
+    off_t sent;           // bytes of the target described so far
+    int backoff, skip;    // compression back off (see send_block)
+    struct ip_bucket *bucket; // -r: rate limit of the client
+};
+
+void stream_begin(struct stream *s, int sock, const struct request *req)
+{
+    memset(s, 0, sizeof(*s));
+    s->sock = sock;
+    s->req = req;
+    s->backoff = 1;
+    s->bucket = bucket_for(sock);
+}
+
+const char *frame_block(struct stream *s, const char *buf, int len, off_t offset,
+                        char *zbuf, struct fx_header *hp)
+{
+    /*
+     * Frame one block of at most FX_CHUNK bytes as
+     * FX_DATA. With "crc" the frame carries the
+     * CRC32C of its data and the stream keeps the
+     * CRC32C of everything for FX_END.
+     *
+     * With "z=lz" each block is compressed on its
+     * own into zbuf. A block that saves less than
+     * 1/16 of its size goes raw, and after such a
+     * block the next 1, 2, 4 ... 16 blocks are not
+     * even tried so incompressible files cost almost
+     * no CPU. Returns the payload (buf or zbuf)
+     */
+    const struct request *req = s->req;
+    struct fx_header h = {FX_DATA, 0, len, offset, 0, len};
+    const char *payload = buf;
+    if (req->crc)
+    {
+        h.crc = crc32c(0, buf, len);
+        s->total_crc = crc32c(s->total_crc, buf, len);
+    }
+    if (req->lz && s->skip > 0)
+        s->skip--;
+    else if (req->lz)
+    {
+        double t0 = cpu_time();
+        int zlen = lz_compress(buf, len, zbuf);
+        s->st.lz_cpu += cpu_time() - t0;
+        if (zlen < len - len / 16)
+        {
+            h.flags |= FX_F_LZ;
+            h.len = zlen;
+            payload = zbuf;
+            s->backoff = 1;
+        }
+        else
+        {
+            s->skip = s->backoff;
+            s->backoff = s->backoff < 16 ? 2 * s->backoff : 16;
+        }
+    }
+    if (h.flags & FX_F_LZ)
+        s->st.lz_blocks++;
+    else
+        s->st.raw_blocks++;
+    s->st.raw_bytes += len;
+    s->st.wire_bytes += h.len;
+    s->sent += len;
+    *hp = h;
+    return payload;
+}
+
+int send_block(struct stream *s, const char *buf, int len, off_t offset)
+{
+    static __thread char zbuf[LZ_BOUND(FX_CHUNK)];
+    struct fx_header h;
+    const char *payload = frame_block(s, buf, len, offset, zbuf, &h);
+    throttle(s->bucket, FX_HEADER_LEN + h.len);
+    return fx_send_frame(s->sock, &h, payload);
+}
+
+int frame_hole(struct stream *s, off_t offset, off_t len, unsigned char *frame)
+{
+    /*
+     * Write the FX_HOLE frame for len zero bytes at
+     * offset (FX_HEADER_LEN + 8 bytes) to frame,
+     * returns its size
+     */
+    struct fx_header h = {FX_HOLE, 0, 8, offset, 0, 0};
+    fx_pack(frame, &h);
+    fx_put64(frame + FX_HEADER_LEN, len);
+    if (s->req->crc)
+        s->total_crc = crc32c_zeros(s->total_crc, len);
+    s->st.hole_bytes += len;
+    s->st.holes++;
+    s->st.wire_bytes += 8;
+    s->sent += len;
+    return FX_HEADER_LEN + 8;
+}
+
+off_t next_extent(int fd, off_t offset, off_t end, off_t *data_end)
+{
+    /*
+     * Where the data at or after offset begins and
+     * (data_end) where it stops, both capped at end.
+     * Without SEEK_DATA support (EINVAL) the whole
+     * range is data, ENXIO means only a hole is left
+     */
+    off_t data = lseek(fd, offset, SEEK_DATA);
+    if (data < 0)
+        data = errno == ENXIO ? end : offset;
+    if (data > end)
+        data = end;
+    off_t hole = data < end ? lseek(fd, data, SEEK_HOLE) : end;
+    *data_end = hole < data || hole > end ? end : hole;
+    return data;
+}
+
+int stream_end(struct stream *s)
+{
+    struct fx_header h = {FX_END, 0, 0, s->sent, s->total_crc, 0};
+    return fx_send_frame(s->sock, &h, NULL);
+}
+
+void request_range(const struct request *req, off_t size, off_t *offset, off_t *end)
+{
+    *offset = req->off < size ? req->off : size;
+    *end = (req->len < 0 || *offset + req->len > size) ? size : *offset + req->len;
+}
+
+void report_stream(const struct request *req, const struct send_stats *st)
+{
+    if (st->holes)
+        printf("\033[0;33mSparse: %ld bytes of holes sent as %d FX_HOLE frame(s)\033[0m\n",
+               st->hole_bytes, st->holes);
+    if (req->lz)
+        printf("\033[0;33mCompression: %ld -> %ld bytes on the wire (%.1f%%), %d/%d blocks compressed, %.3f ms CPU\033[0m\n",
+               st->raw_bytes, st->wire_bytes,
+               st->raw_bytes ? 100.0 * st->wire_bytes / st->raw_bytes : 100.0,
+               st->lz_blocks, st->lz_blocks + st->raw_blocks, st->lz_cpu * 1e3);
+}
+
+int send_file(struct stream *s, int fd, off_t size)
+{
+    /*
+     * Stream the requested range as FX_DATA frames
+     * of at most FX_CHUNK bytes, with "sparse" holes
+     * as FX_HOLE. The descriptor is shared with the
+     * cache so we always pread()
+     */
+    static __thread char buf[FX_CHUNK];
+    off_t offset, end, data_end;
+    request_range(s->req, size, &offset, &end);
+    data_end = s->req->sparse ? offset : end;
+    while (offset < end)
+    {
+        if (offset >= data_end)
+        {
+            off_t data = next_extent(fd, offset, end, &data_end);
+            if (data > offset)
+            {
+                unsigned char frame[FX_HEADER_LEN + 8];
+                int n = frame_hole(s, offset, data - offset, frame);
+                throttle(s->bucket, n);
+                if (send_all(s->sock, frame, n) < 0)
+                    return -1;
+                offset = data;
+                continue;
+            }
+        }
+        int want = data_end - offset < FX_CHUNK ? data_end - offset : FX_CHUNK;
+        int len = pread(fd, buf, want, offset);
+        if (len <= 0)
+            break;
+        if (send_block(s, buf, len, offset) < 0)
+            return -1;
+        offset += len;
+    }
+    return stream_end(s);
+}
+
+//---------------- DELTA TRANSFER ------------------
+
+/*
+ * SYNC: the client already has an old copy of the
+ * file and sends the weak/strong checksums of its
+ * blocks (rsum.h). We slide a window over our file:
+ * where it matches one of the client's blocks we send
+ * an FX_COPY frame (payload: first block, number of
+ * blocks, both 32 bit) and everything in between as
+ * ordinary FX_DATA literals. Consecutive blocks that
+ * are consecutive on the client too become one frame.
+ */
+
+struct delta
+{
+    struct stream *s;
+    const char *p;        // our file, mapped
+    size_t bs;
+    off_t run_off;        // target offset of the pending copy run
+    uint32_t run_first;   // first client block of the run
+    uint32_t run_count;   // blocks in the run (0 = none)
+    long copied;          // bytes described by FX_COPY frames
+};
+
+int flush_copy(struct delta *d)
+{
+    if (!d->run_count)
+        return 0;
+    unsigned char payload[8];
+    fx_put32(payload, d->run_first);
+    fx_put32(payload + 4, d->run_count);
+    uint32_t len = d->run_count * d->bs; // send_delta() keeps it below 4 GB
+    struct fx_header h = {FX_COPY, 0, 8, d->run_off, 0, len};
+    if (d->s->req->crc)
+        d->s->total_crc = crc32c(d->s->total_crc, d->p + d->run_off, len);
+    d->s->sent += len;
+    d->s->st.wire_bytes += 8;
+    d->copied += len;
+    d->run_count = 0;
+    throttle(d->s->bucket, FX_HEADER_LEN + 8);
+    return fx_send_frame(d->s->sock, &h, payload);
+}
+
+int flush_literal(struct delta *d, off_t from, off_t to)
+{
+    if (flush_copy(d) < 0)
+        return -1;
+    for (; from < to; from += FX_CHUNK)
+        if (send_block(d->s, d->p + from, to - from < FX_CHUNK ? to - from : FX_CHUNK, from) < 0)
+            return -1;
+    return 0;
+}
+
+int send_delta(struct stream *s, int fd, off_t size, struct rs_sig *sigs, long nsig, long *copied)
+{
+    size_t bs = s->req->bs;
+    struct delta d = {s, NULL, bs, 0, 0, 0, 0};
+    if (size > 0)
+    {
+        d.p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (d.p == MAP_FAILED)
+            return -1;
+        madvise((void *)d.p, size, MADV_SEQUENTIAL);
+    }
+
+    /*
+     * Chained hash table of the client's blocks keyed
+     * by weak checksum, lowest block number first
+     */
+    long nb = 1;
+    while (nb < 2 * nsig)
+        nb <<= 1;
+    long *head = malloc(nb * sizeof(long));
+    long *next = malloc((nsig ? nsig : 1) * sizeof(long));
+    if (!head || !next)
+    {
+        free(head);
+        free(next);
+        if (size > 0)
+            munmap((void *)d.p, size);
+        return -1;
+    }
+    for (long i = 0; i < nb; i++)
+        head[i] = -1;
+    for (long i = nsig - 1; i >= 0; i--)
+    {
+        long b = (sigs[i].weak * 2654435761u) & (nb - 1);
+        next[i] = head[b];
+        head[b] = i;
+    }
+
+    int status = 0;
+    off_t i = 0, lit = 0;
+    uint32_t weak = 0;
+    int have_weak = 0;
+    while (status == 0 && nsig > 0 && i + (off_t)bs <= size)
+    {
+        if (!have_weak)
+        {
+            weak = rs_weak((const unsigned char *)d.p + i, bs);
+            have_weak = 1;
+        }
+
+        /*
+         * Prefer the block that extends the current
+         * run, then any block with the same checksums
+         */
+        long match = -1;
+        uint64_t strong = 0;
+        int have_strong = 0;
+        long want = d.run_count ? (long)(d.run_first + d.run_count) : -1;
+        for (long k = head[(weak * 2654435761u) & (nb - 1)]; k >= 0; k = next[k])
+        {
+            if (sigs[k].weak != weak)
+                continue;
+            if (!have_strong)
+            {
+                strong = rs_strong((const unsigned char *)d.p + i, bs);
+                have_strong = 1;
+            }
+            if (sigs[k].strong != strong)
+                continue;
+            if (match < 0 || k == want)
+                match = k;
+            if (k == want)
+                break;
+        }
+
+        if (match >= 0)
+        {
+            /*
+             * A run ends where it stops being contiguous,
+             * or before its length outgrows the 32 bit
+             * raw field of the FX_COPY header
+             */
+            if (lit < i)
+                status = flush_literal(&d, lit, i);
+            if (status == 0 && d.run_count &&
+                (match != want || d.run_off + (off_t)d.run_count * bs != i ||
+                 (uint64_t)(d.run_count + 1) * bs > UINT32_MAX))
+                status = flush_copy(&d);
+            if (!d.run_count)
+            {
+                d.run_off = i;
+                d.run_first = match;
+            }
+            d.run_count++;
+            i += bs;
+            lit = i;
+            have_weak = 0;
+            continue;
+        }
+
+        if (i + (off_t)bs < size)
+            weak = rs_roll(weak, d.p[i], d.p[i + bs], bs);
+        i++;
+        if (i - lit >= FX_CHUNK)
+        {
+            status = flush_literal(&d, lit, i);
+            lit = i;
+        }
+    }
+    if (status == 0)
+        status = flush_literal(&d, lit, size);
+    if (status == 0)
+        status = stream_end(s);
+
+    *copied = d.copied;
+    free(head);
+    free(next);
+    if (size > 0)
+        munmap((void *)d.p, size);
+    return status;
+}
+
+struct rs_sig *read_signatures(struct conn *c, long n)
+{
+    unsigned char rec[RS_SIG_LEN];
+    struct rs_sig *sigs = malloc((n ? n : 1) * sizeof(struct rs_sig));
+    if (!sigs)
+    {
+        printf("\033[1;31mNo memory for %ld signatures\033[0m\n", n);
+        return NULL;
+    }
+    for (long i = 0; i < n; i++)
+    {
+        if (conn_read_exact(c, rec, RS_SIG_LEN) < 0)
+        {
+            free(sigs);
+            return NULL;
+        }
+        sigs[i].weak = fx_get32(rec);
+        sigs[i].strong = fx_get64(rec + 4);
+    }
+    return sigs;
+}
+
+int not_found(int sock)
+{
+    char *err = "FILE_NOT_FOUND";
+    return fx_send(sock, FX_ERR, 0, err, strlen(err)) < 0 ? -1 : 0;
+}
+
+int serve_file(int sock, const struct request *req, const char *path, struct rs_sig *sigs)
+{
+    /*
+     * Answer one GET or SYNC from the local file at
+     * path. Returns 1 when the file was sent, 0 when
+     * it was not found, -1 if the connection broke
+     */
+    struct cache_entry *entry;
+    off_t size;
+    int fd = acquire_file(path, &entry, &size);
+    if (fd < 0)
+    {
+        return not_found(sock);
+    }
+
+    printf("\033[0;33mSize of File to be sent: %ld bytes\033[0m\n", (long)size);
+    struct stream s;
+    stream_begin(&s, sock, req);
+    long copied = 0;
+    int status = fx_send(sock, FX_OPEN, size, NULL, 0);
+    if (status == 0 && req->verb == REQ_SYNC)
+        status = send_delta(&s, fd, size, sigs, req->nsig, &copied);
+    else if (status == 0)
+        status = send_file(&s, fd, size);
+    release_file(fd, entry);
+    if (status == 0 && req->verb == REQ_SYNC)
+        printf("\033[0;33mDelta: %ld bytes matched the client's copy, %ld literal, %ld bytes on the wire\033[0m\n",
+               copied, s.st.raw_bytes, s.st.wire_bytes);
+    if (status == 0)
+        report_stream(req, &s.st);
+    return status < 0 ? -1 : 1;
+}
+
+//---------------- DIRECTORY ARCHIVES --------------
+
+/*
+ * DIR <path> sends every file below a directory as
+ * one archive (see file_proto.h), so a tree of many
+ * small files costs one request instead of one per
+ * file and goes as fast as the connection allows.
+ *
+ * DIR_WALKERS threads read the directories in
+ * parallel. Every regular file they find is opened
+ * at once and announced to the kernel with
+ * posix_fadvise(WILLNEED), so its pages are read in
+ * while the files before it are being sent. Up to
+ * DIR_AHEAD opened files wait in a ring for the
+ * connection's thread, which sends them one after
+ * the other like GET responses.
+ */
+
+#define DIR_WALKERS 4
+#define DIR_AHEAD 64
+
+struct dir_item
+{
+    char *rel;        // path below the requested directory
+    int fd;           // -1 for a directory
+    off_t size;
+    mode_t mode;
+};
+
+struct dir_walk
+{
+    const char *root;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    char **dirs;                    // directories still to be read
+    int ndirs, dircap;
+    int busy;                       // walkers reading a directory
+    struct dir_item ready[DIR_AHEAD]; // opened, waiting to be sent
+    int head, count;
+    int done;                       // nothing left to read
+    int stop;                       // the connection broke
+};
+
+void walk_push_dir(struct dir_walk *wk, char *rel)
+{
+    if (wk->ndirs == wk->dircap)
+    {
+        wk->dircap = wk->dircap ? 2 * wk->dircap : 64;
+        wk->dirs = realloc(wk->dirs, wk->dircap * sizeof(char *));
+    }
+    wk->dirs[wk->ndirs++] = rel;
+}
+
+int walk_push_item(struct dir_walk *wk, struct dir_item *it)
+{
+    /*
+     * Blocks while DIR_AHEAD items are waiting, which
+     * also bounds the descriptors held open
+     */
+    pthread_mutex_lock(&wk->lock);
+    while (wk->count == DIR_AHEAD && !wk->stop)
+        pthread_cond_wait(&wk->changed, &wk->lock);
+    int ok = !wk->stop;
+    if (ok)
+    {
+        wk->ready[(wk->head + wk->count) % DIR_AHEAD] = *it;
+        wk->count++;
+        if (it->fd < 0)
+            walk_push_dir(wk, strdup(it->rel));
+        pthread_cond_broadcast(&wk->changed);
+    }
+    pthread_mutex_unlock(&wk->lock);
+    return ok;
+}
+
+void walk_dir(struct dir_walk *wk, const char *rel)
+{
+    char path[2 * FX_LINE_MAX];
+    snprintf(path, sizeof(path), "%s/%s", wk->root, rel);
+    DIR *d = opendir(path);
+    if (!d)
+        return;
+    struct dirent *de;
+    while ((de = readdir(d)))
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        struct dir_item it = {NULL, -1, 0, 0};
+        it.rel = malloc(strlen(rel) + strlen(de->d_name) + 2);
+        sprintf(it.rel, "%s%s%s", rel, *rel ? "/" : "", de->d_name);
+        snprintf(path, sizeof(path), "%s/%s", wk->root, it.rel);
+
+        /*
+         * Symbolic links and special files are left
+         * out, a link could lead out of the tree
+         */
+        struct stat st;
+        int ok = strlen(it.rel) < FX_LINE_MAX && lstat(path, &st) == 0;
+        if (ok && S_ISREG(st.st_mode))
+        {
+            ok = (it.fd = open(path, O_RDONLY)) >= 0 && fstat(it.fd, &st) == 0;
+            if (ok)
+                posix_fadvise(it.fd, 0, 0, POSIX_FADV_WILLNEED);
+        }
+        else if (ok)
+            ok = S_ISDIR(st.st_mode);
+        it.size = ok ? st.st_size : 0;
+        it.mode = ok ? st.st_mode : 0;
+        if (!ok || !walk_push_item(wk, &it))
+        {
+            if (it.fd >= 0)
+                close(it.fd);
+            free(it.rel);
+        }
+    }
+    closedir(d);
+}
+
+void *walker_main(void *arg)
+{
+    /*
+     * Take directories until none is left and no
+     * other walker can find more
+     */
+    struct dir_walk *wk = arg;
+    pthread_mutex_lock(&wk->lock);
+    while (!wk->stop)
+    {
+        if (!wk->ndirs && wk->busy)
+        {
+            pthread_cond_wait(&wk->changed, &wk->lock);
+            continue;
+        }
+        if (!wk->ndirs)
+            break;
+        char *rel = wk->dirs[--wk->ndirs];
+        wk->busy++;
+        pthread_mutex_unlock(&wk->lock);
+        walk_dir(wk, rel);
+        free(rel);
+        pthread_mutex_lock(&wk->lock);
+        wk->busy--;
+        pthread_cond_broadcast(&wk->changed);
+    }
+    if (!wk->ndirs && !wk->busy)
+        wk->done = 1;
+    pthread_cond_broadcast(&wk->changed);
+    pthread_mutex_unlock(&wk->lock);
+    return NULL;
+}
+
+int send_entry(int sock, const struct dir_item *it)
+{
+    unsigned char payload[4 + FX_LINE_MAX];
+    uint32_t len = strlen(it->rel);
+    fx_put32(payload, it->mode & 07777);
+    memcpy(payload + 4, it->rel, len);
+    struct fx_header h = {FX_ENTRY, it->fd < 0 ? FX_F_DIR : 0, 4 + len, it->size, 0, 0};
+    return fx_send_frame(sock, &h, payload);
+}
+
+int serve_dir(int sock, const struct request *req)
+{
+    /*
+     * Answer DIR: FX_OPEN, every member as FX_ENTRY
+     * (files followed by their DATA and END frames)
+     * and a last FX_END flagged FX_F_LAST.
+     * Same return values as serve_file()
+     */
+    struct stat st;
+    if (stat(req->path, &st) < 0 || !S_ISDIR(st.st_mode))
+        return not_found(sock);
+
+    struct dir_walk wk;
+    memset(&wk, 0, sizeof(wk));
+    wk.root = req->path;
+    pthread_mutex_init(&wk.lock, NULL);
+    pthread_cond_init(&wk.changed, NULL);
+    walk_push_dir(&wk, strdup(""));
+    pthread_t walkers[DIR_WALKERS];
+    int nwalkers = 0;
+    while (nwalkers < DIR_WALKERS && pthread_create(&walkers[nwalkers], NULL, walker_main, &wk) == 0)
+        nwalkers++;
+    if (!nwalkers)
+    {
+        free(wk.dirs[0]);
+        free(wk.dirs);
+        char *err = "SERVER_BUSY";
+        return fx_send(sock, FX_ERR, 0, err, strlen(err)) < 0 ? -1 : 0;
+    }
+
+    /*
+     * Every member is a whole file, whatever
+     * off/len came with the request
+     */
+    struct request member = *req;
+    member.off = 0;
+    member.len = -1;
+    struct send_stats total;
+    memset(&total, 0, sizeof(total));
+    long files = 0, dirs = 0;
+    int status = fx_send(sock, FX_OPEN, 0, NULL, 0);
+    while (status == 0)
+    {
+        pthread_mutex_lock(&wk.lock);
+        while (!wk.count && !wk.done)
+            pthread_cond_wait(&wk.changed, &wk.lock);
+        if (!wk.count)
+        {
+            pthread_mutex_unlock(&wk.lock);
+            break;
+        }
+        struct dir_item it = wk.ready[wk.head];
+        wk.head = (wk.head + 1) % DIR_AHEAD;
+        wk.count--;
+        pthread_cond_broadcast(&wk.changed);
+        pthread_mutex_unlock(&wk.lock);
+
+        status = send_entry(sock, &it);
+        if (status == 0 && it.fd >= 0)
+        {
+            struct stream s;
+            stream_begin(&s, sock, &member);
+            status = send_file(&s, it.fd, it.size);
+            total.raw_bytes += s.st.raw_bytes;
+            total.wire_bytes += s.st.wire_bytes;
+            total.lz_blocks += s.st.lz_blocks;
+            total.raw_blocks += s.st.raw_blocks;
+            total.lz_cpu += s.st.lz_cpu;
+            total.hole_bytes += s.st.hole_bytes;
+            total.holes += s.st.holes;
+            files++;
+        }
+        else if (status == 0)
+            dirs++;
+        if (it.fd >= 0)
+            close(it.fd);
+        free(it.rel);
+    }
+    if (status == 0)
+    {
+        struct fx_header h = {FX_END, FX_F_LAST, 0, files, 0, 0};
+        status = fx_send_frame(sock, &h, NULL);
+    }
+
+    /*
+     * On a broken connection the walkers are told to
+     * stop and whatever they opened is dropped
+     */
+    pthread_mutex_lock(&wk.lock);
+    wk.stop = 1;
+    pthread_cond_broadcast(&wk.changed);
+    pthread_mutex_unlock(&wk.lock);
+    for (int i = 0; i < nwalkers; i++)
+        pthread_join(walkers[i], NULL);
+    for (; wk.count; wk.count--, wk.head = (wk.head + 1) % DIR_AHEAD)
+    {
+        if (wk.ready[wk.head].fd >= 0)
+            close(wk.ready[wk.head].fd);
+        free(wk.ready[wk.head].rel);
+    }
+    for (int i = 0; i < wk.ndirs; i++)
+        free(wk.dirs[i]);
+    free(wk.dirs);
+    pthread_mutex_destroy(&wk.lock);
+    pthread_cond_destroy(&wk.changed);
+
+    if (status == 0)
+    {
+        printf("\033[0;33mArchive: %ld file(s), %ld directories, %ld bytes\033[0m\n",
+               files, dirs, total.raw_bytes);
+        report_stream(req, &total);
+    }
+    return status < 0 ? -1 : 1;
+}
+
+//---------------- CACHING PROXY -------------------
+
+/*
+ * With -u <host:port> the server is a caching proxy in
+ * front of another file server. A requested file that
+ * is complete in PROXY_DIR is served like any local
+ * file. On a miss the connection's thread becomes the
+ * leader of a fetch: it asks upstream for the file
+ * (with checksums) and every block it receives is
+ * written to the cache and sent to its own client out
+ * of the same buffer.
+ *
+ * A request for a file that is being fetched does
+ * not go upstream again. It follows the fetch: the
+ * leader publishes how much of the file is on disk
+ * and the follower streams from the partial cache
+ * file up to there, waiting for more on a condition
+ * variable. The file is renamed into place when the
+ * fetch is complete and verified.
+ */
+
+#define PROXY_DIR "proxy_cache"
+#define PROXY_NAME_MAX 200 // bytes of a file name in PROXY_DIR
+
+#define FETCH_RUNNING 0
+#define FETCH_DONE 1
+#define FETCH_FAILED 2
+
+struct fetch
+{
+    char *path;               // path as requested from upstream
+    char file[FX_LINE_MAX * 3 + 32]; // complete copy in PROXY_DIR
+    char part[FX_LINE_MAX * 3 + 40]; // file + ".part" while fetching
+    off_t size;               // from upstream FX_OPEN, -1 until known
+    off_t done;               // bytes of the file written so far
+    int state;
+    int refs;                 // leader + followers
+    pthread_cond_t progress;
+    struct fetch *next;
+};
+
+struct sockaddr_in upstream;  // -u: server we are a proxy for
+int proxy_mode = 0;
+struct fetch *fetches;        // fetches in progress
+pthread_mutex_t proxy_lock = PTHREAD_MUTEX_INITIALIZER;
+long proxy_hits, proxy_misses, proxy_coalesced, upstream_bytes;
+
+void proxy_file_name(const char *path, char *out)
+{
+    /*
+     * One flat directory: every byte of the path
+     * that is not a letter, digit, '-', '_' or a
+     * '.' other than the first is %XX encoded.
+     * A name longer than PROXY_NAME_MAX (room left
+     * for ".part" or ".missing" under NAME_MAX) is
+     * cut and ends in '~' and the XXH64 of the
+     * path instead, '~' is never left unencoded
+     */
+    out += sprintf(out, "%s/", PROXY_DIR);
+    char *name = out;
+    for (int i = 0; path[i]; i++)
+    {
+        unsigned char ch = path[i];
+        if (isalnum(ch) || ch == '-' || ch == '_' || (ch == '.' && i > 0))
+            *out++ = ch;
+        else
+            out += sprintf(out, "%%%02X", ch);
+    }
+    *out = '\0';
+    if (out - name > PROXY_NAME_MAX)
+    {
+        int keep = PROXY_NAME_MAX - 17;
+        while (keep > 0 && (name[keep - 1] == '%' || (keep > 1 && name[keep - 2] == '%')))
+            keep--; // no half %XX before the hash
+        sprintf(name + keep, "~%016llx",
+                (unsigned long long)rs_strong((const unsigned char *)path, strlen(path)));
+    }
+}
+
+int connect_upstream()
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock >= 0 && connect(sock, (struct sockaddr *)&upstream, sizeof(upstream)) < 0)
+    {
+        perror("\033[0;31mupstream connection failed\033[0m\n");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+void fetch_release(struct fetch *f)
+{
+    pthread_mutex_lock(&proxy_lock);
+    int last = --f->refs == 0;
+    pthread_mutex_unlock(&proxy_lock);
+    if (last)
+    {
+        pthread_cond_destroy(&f->progress);
+        free(f->path);
+        free(f);
+    }
+}
+
+struct fetch *fetch_join(const char *path, int *leader)
+{
+    /*
+     * NULL when the file is complete in the cache,
+     * otherwise the fetch in progress (joined as a
+     * follower) or a new one we lead
+     */
+    char file[sizeof(((struct fetch *)0)->file)];
+    proxy_file_name(path, file);
+    struct stat st;
+    struct fetch *f;
+    pthread_mutex_lock(&proxy_lock);
+    for (f = fetches; f && strcmp(f->path, path) != 0; f = f->next)
+        ;
+    *leader = 0;
+    if (f)
+        proxy_coalesced++;
+    else if (stat(file, &st) == 0 && S_ISREG(st.st_mode))
+        proxy_hits++;
+    else
+    {
+        f = calloc(1, sizeof(struct fetch));
+        f->path = strdup(path);
+        strcpy(f->file, file);
+        sprintf(f->part, "%s.part", file);
+        f->size = -1;
+        pthread_cond_init(&f->progress, NULL);
+        f->next = fetches;
+        fetches = f;
+        proxy_misses++;
+        *leader = 1;
+    }
+    if (f)
+        f->refs++;
+    pthread_mutex_unlock(&proxy_lock);
+    return f;
+}
+
+void fetch_publish(struct fetch *f, off_t size, off_t done, int state)
+{
+    pthread_mutex_lock(&proxy_lock);
+    f->size = size;
+    f->done = done;
+    if (state != FETCH_RUNNING)
+    {
+        /*
+         * Finished: rename while holding the lock so
+         * a follower opens either the part file or
+         * the complete one, and let new requests see
+         * the cache instead of this fetch
+         */
+        if (state == FETCH_DONE && rename(f->part, f->file) < 0)
+            state = FETCH_FAILED;
+        if (state == FETCH_FAILED)
+            unlink(f->part);
+        struct fetch **pp = &fetches;
+        while (*pp != f)
+            pp = &(*pp)->next;
+        *pp = f->next;
+    }
+    f->state = state;
+    pthread_cond_broadcast(&f->progress);
+    pthread_mutex_unlock(&proxy_lock);
+}
+
+int lead_fetch(struct fetch *f, int sock, const struct request *req)
+{
+    /*
+     * Fetch the file into the cache. With sock >= 0
+     * the requested range also goes to that client
+     * from the buffer each block was received into.
+     * Returns like serve_file()
+     */
+    static __thread char buf[FX_CHUNK];
+    struct fx_header h;
+    struct stream s;
+    off_t offset = 0, end = 0, size = -1, done = 0;
+    int fd = -1, client = sock >= 0, ok = 0;
+    uint32_t crc = 0;
+
+    char line[3 * FX_LINE_MAX + 16], quoted[3 * FX_LINE_MAX + 1];
+    int up = connect_upstream();
+    snprintf(line, sizeof(line), "GET %s crc\n", fx_quote_path(quoted, f->path));
+    if (up >= 0 && send_all(up, line, strlen(line)) == 0 && shutdown(up, SHUT_WR) == 0 &&
+        fx_recv(up, &h) > 0 && h.type == FX_OPEN &&
+        (fd = open(f->part, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0)
+    {
+        size = h.off;
+        fetch_publish(f, size, 0, FETCH_RUNNING);
+        if (client)
+        {
+            stream_begin(&s, sock, req);
+            request_range(req, size, &offset, &end);
+            client = fx_send(sock, FX_OPEN, size, NULL, 0) == 0;
+        }
+        printf("\033[0;33mFetching %s (%ld bytes) from upstream\033[0m\n", f->path, (long)size);
+
+        /*
+         * Blocks arrive in order, each one checked
+         * before it is written or forwarded. A client
+         * that goes away does not stop the fetch, the
+         * followers still need it
+         */
+        while (fx_recv(up, &h) > 0)
+        {
+            if (h.type == FX_END)
+            {
+                ok = h.crc == crc && done == size;
+                break;
+            }
+            if (h.type != FX_DATA || h.flags || h.len > FX_CHUNK || h.len != h.raw ||
+                (off_t)h.off != done || recv_all(up, buf, h.len) <= 0 ||
+                crc32c(0, buf, h.len) != h.crc || pwrite(fd, buf, h.len, h.off) != (ssize_t)h.len)
+                break;
+            crc = crc32c(crc, buf, h.len);
+            done += h.len;
+            fetch_publish(f, size, done, FETCH_RUNNING);
+
+            off_t lo = (off_t)h.off > offset ? (off_t)h.off : offset;
+            off_t hi = done < end ? done : end;
+            if (client && lo < hi)
+                client = send_block(&s, buf + (lo - h.off), hi - lo, lo) == 0;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    if (up >= 0)
+        close(up);
+    fetch_publish(f, size, done, ok ? FETCH_DONE : FETCH_FAILED);
+    pthread_mutex_lock(&proxy_lock);
+    upstream_bytes += done;
+    pthread_mutex_unlock(&proxy_lock);
+
+    if (sock < 0)
+        return ok;
+    if (size < 0)
+    {
+        return not_found(sock);
+    }
+    if (!client || !ok || stream_end(&s) < 0)
+        return -1;
+    report_stream(req, &s.st);
+    return 1;
+}
+
+int follow_fetch(struct fetch *f, int sock, const struct request *req)
+{
+    /*
+     * Stream the requested range from the cache file
+     * as the leader writes it. Returns like
+     * serve_file()
+     */
+    static __thread char buf[FX_CHUNK];
+    pthread_mutex_lock(&proxy_lock);
+    while (f->state == FETCH_RUNNING && f->size < 0)
+        pthread_cond_wait(&f->progress, &proxy_lock);
+    off_t size = f->size;
+    int fd = size < 0 ? -1 : open(f->state == FETCH_DONE ? f->file : f->part, O_RDONLY);
+    pthread_mutex_unlock(&proxy_lock);
+    if (size < 0)
+    {
+        return not_found(sock);
+    }
+    if (fd < 0)
+        return -1;
+
+    struct stream s;
+    off_t offset, end;
+    stream_begin(&s, sock, req);
+    request_range(req, size, &offset, &end);
+    int status = fx_send(sock, FX_OPEN, size, NULL, 0);
+    while (status == 0 && offset < end)
+    {
+        pthread_mutex_lock(&proxy_lock);
+        while (f->state == FETCH_RUNNING && f->done <= offset)
+            pthread_cond_wait(&f->progress, &proxy_lock);
+        off_t avail = f->done < end ? f->done : end;
+        pthread_mutex_unlock(&proxy_lock);
+        if (avail <= offset)
+            status = -1; // the fetch failed
+        for (; status == 0 && offset < avail; offset += FX_CHUNK)
+        {
+            int want = avail - offset < FX_CHUNK ? avail - offset : FX_CHUNK;
+            if (pread(fd, buf, want, offset) != want)
+                status = -1;
+            else
+                status = send_block(&s, buf, want, offset);
+        }
+        if (offset > avail)
+            offset = avail;
+    }
+    close(fd);
+    if (status < 0 || stream_end(&s) < 0)
+        return -1;
+    report_stream(req, &s.st);
+    return 1;
+}
+
+int fetch_wait(struct fetch *f, int leader)
+{
+    /*
+     * Make sure the file is complete in the cache
+     * (SYNC and the original protocol are served
+     * from there). Returns 1 if it is
+     */
+    if (leader)
+        return lead_fetch(f, -1, NULL);
+    pthread_mutex_lock(&proxy_lock);
+    while (f->state == FETCH_RUNNING)
+        pthread_cond_wait(&f->progress, &proxy_lock);
+    int ok = f->state == FETCH_DONE;
+    pthread_mutex_unlock(&proxy_lock);
+    return ok;
+}
+
+int proxy_request(int sock, const struct request *req, struct rs_sig *sigs)
+{
+    /*
+     * Directory archives are not cached, the
+     * client has to ask the origin server
+     */
+    if (req->verb == REQ_DIR)
+    {
+        char *err = "NOT_SUPPORTED";
+        return fx_send(sock, FX_ERR, 0, err, strlen(err)) < 0 ? -1 : 0;
+    }
+    int leader;
+    char file[sizeof(((struct fetch *)0)->file)];
+    proxy_file_name(req->path, file);
+    struct fetch *f = fetch_join(req->path, &leader);
+    int status;
+    if (!f)
+        status = serve_file(sock, req, file, sigs);
+    else if (req->verb == REQ_GET)
+        status = leader ? lead_fetch(f, sock, req) : follow_fetch(f, sock, req);
+    else
+        status = fetch_wait(f, leader) ? serve_file(sock, req, file, sigs) : not_found(sock);
+    if (f)
+        fetch_release(f);
+    return status;
+}
+
+const char *proxy_legacy_file(const char *file, char *out)
+{
+    /*
+     * The original protocol is served from the
+     * complete cache copy of the file. If there
+     * is none we name a file that does not exist
+     * and serve_legacy() says so
+     */
+    int leader;
+    struct fetch *f = fetch_join(file, &leader);
+    proxy_file_name(file, out);
+    if (f)
+    {
+        if (!fetch_wait(f, leader))
+            strcat(out, ".missing");
+        fetch_release(f);
+    }
+    return out;
+}
+
+void proxy_report()
+{
+    pthread_mutex_lock(&proxy_lock);
+    long total = proxy_hits + proxy_misses + proxy_coalesced;
+    printf("\033[0;33mProxy: %ld hits, %ld misses, %ld coalesced / %ld requests, %ld bytes from upstream\033[0m\n",
+           proxy_hits, proxy_misses, proxy_coalesced, total, upstream_bytes);
+    pthread_mutex_unlock(&proxy_lock);
+}
+
+void serve_pipelined(struct conn *c)
+{
+    /*
+     * Answer requests in the order they were sent
+     * until the client half closes the connection
+     * or says BYE. Responses go back to back, the
+     * client never waits for a round trip between
+     * two files
+     */
+    char line[FX_LINE_MAX];
+    int served = 0;
+    while (conn_read_line(c, line))
+    {
+        if (strcmp(line, "BYE") == 0)
+            break;
+        struct request req;
+        if (!parse_request(line, &req))
+        {
+            char *err = "BAD_REQUEST";
+            if (fx_send(c->sock, FX_ERR, 0, err, strlen(err)) < 0)
+                break;
+            continue;
+        }
+
+        printf("File Requested by client: \033[0;35m%s\033[0m\n", req.path);
+
+        /*
+         * The signatures of a SYNC request have to be
+         * consumed even when the file does not exist
+         */
+        struct rs_sig *sigs = NULL;
+        if (req.verb == REQ_SYNC && !(sigs = read_signatures(c, req.nsig)))
+            break;
+
+        int status;
+        if (proxy_mode)
+            status = proxy_request(c->sock, &req, sigs);
+        else if (req.verb == REQ_DIR)
+            status = serve_dir(c->sock, &req);
+        else
+            status = serve_file(c->sock, &req, req.path, sigs);
+        free(sigs);
+        if (status < 0)
+            break;
+        served += status;
+    }
+
+    printf("\033[0;32mServed %d file(s) on this connection\033[0m\n", served);
+    shutdown(c->sock, SHUT_RDWR);
+    close(c->sock);
+}
+
+void serve_connection(struct conn *c)
+{
+    /*
+     * Read the first request. A connection that
+     * starts with "GET ", "SYNC " or "DIR " speaks
+     * the pipelined protocol of file_proto.h,
+     * anything else is the file name of the
+     * original protocol
+     */
+    int len;
+    while (pipelined_verb(c) < 0 && (len = read(c->sock, c->buf + c->len, sizeof(c->buf) - c->len)) > 0)
+        c->len += len;
+
+    if (pipelined_verb(c) > 0)
+        serve_pipelined(c);
+    else
+    {
+        char file[MAXLEN];
+        len = c->len < MAXLEN ? c->len : MAXLEN - 1;
+        memcpy(file, c->buf, len);
+        file[len] = '\0';
+        char cached[sizeof(((struct fetch *)0)->file) + 16];
+        serve_legacy(c->sock, proxy_mode ? proxy_legacy_file(file, cached) : file);
+    }
+    cache_report();
+    if (proxy_mode)
+        proxy_report();
+}
+
+//---------------- ASYNC ENGINE (io_uring) ---------
+
+/*
+ * A few worker threads, each with its own io_uring,
+ * serve all the connections. Every worker keeps an
+ * accept posted on the shared listening socket and
+ * streams a GET as a pipeline
+ *
+ *      READ_FIXED (x READ_AHEAD)  ->  crc / lz  ->  SEND
+ *
+ * i.e. up to READ_AHEAD blocks of the file are read
+ * into registered buffers ahead of the socket. The
+ * frames of a response must reach the TCP stream in
+ * file order and must not interleave, so a connection
+ * has one send in flight and completed reads wait in
+ * a window in file order. A raw frame is sent from
+ * the slot it was read into (the header is written
+ * in front of the data), a compressed one from the
+ * connection's own buffer.
+ *
+ * Ready frames are not sent at once. They queue for
+ * a deficit round robin over the connections: every
+ * visit credits a connection with QUANTUM bytes and
+ * a frame leaves when the credit covers it, while at
+ * most SEND_BUDGET bytes per worker sit in the kernel.
+ * A small response thus gets its frames out in the
+ * first round even next to large downloads, and
+ * every download gets the same share of bytes. With
+ * -r a connection whose client IP has used up its
+ * bucket waits off the round for an io_uring timeout.
+ *
+ * SYNC requests (they need the whole file mapped),
+ * DIR requests (they walk the tree with threads)
+ * and connections of the original protocol are
+ * handed to a thread of their own running the
+ * blocking code above.
+ */
+
+#define WORKERS_MAX 8
+#define RING_DEPTH 256
+#define SLOTS 64            // registered read buffers per worker
+#define READ_AHEAD 4        // disk reads in flight per response
+#define SLOT_SIZE (FX_HEADER_LEN + FX_CHUNK)
+#define QUANTUM (16 * 1024)             // DRR credit per round
+#define SEND_BUDGET (256 * 1024)        // bytes in send per worker
+
+#define OP_ACCEPT 0
+#define OP_RECV 1
+#define OP_READ 2
+#define OP_SEND 3
+#define OP_TIMER 4
+#define OP_MASK 7
+
+#define PH_IDLE 0           // waiting for the next request
+#define PH_DATA 1           // streaming OPEN and DATA frames
+#define PH_LAST 2           // END or ERR frame in flight
+
+struct aconn;
+
+struct slot
+{
+    struct aconn *owner;
+    char *buf;              // room for a frame header + FX_CHUNK bytes
+    int index;              // registered buffer index
+    off_t off;              // file offset read into buf
+    int want, len;          // bytes asked for / read (-1 in flight)
+    off_t hole;             // "sparse": bytes of hole at off, no read
+    struct slot *next;      // free list
+};
+
+struct worker
+{
+    struct uring ring;
+    int listen_fd;
+    int fixed;              // slots are registered buffers
+    char *arena;
+    struct slot slots[SLOTS];
+    struct slot *free_slots;
+    struct aconn *waiting;  // connections waiting for a free slot
+    struct aconn *rr_head, *rr_tail;  // frames ready, DRR order
+    struct aconn *throttled;          // over their IP's rate
+    long send_inflight;     // bytes handed to the kernel
+    int timers;             // timeouts posted
+    double timer_at;        // earliest of them
+    struct __kernel_timespec ts;
+    pthread_t thread;
+};
+
+struct aconn
+{
+    struct conn c;                      // socket and buffered requests
+    struct worker *w;
+    char line[FX_LINE_MAX];
+    struct request req;
+    struct stream s;
+    struct cache_entry *entry;
+    int fd;                             // file being sent or -1
+    off_t next_read, end;               // next offset to read, end of range
+    off_t data_end;                     // "sparse": end of the data extent
+    struct slot *window[READ_AHEAD];    // reads in file order
+    int whead, wcount;
+    int phase;
+    int sending;                        // a frame is queued or in flight
+    int posted;                         // handed to the kernel
+    const char *out;                    // its data
+    size_t out_left, out_total;
+    struct slot *out_slot;              // slot it is sent from
+    long deficit;                       // DRR credit in bytes
+    int queued;                         // on the DRR or throttled list
+    struct aconn *rr_next;
+    struct ip_bucket *bucket;           // -r: rate of the client IP
+    double wake_at;                     // throttled until
+    double throttled_since, throttled_time;
+    char ctrl[FX_HEADER_LEN + 32];      // OPEN / END / ERR frames
+    char *zbuf;                         // header + LZ_BOUND(FX_CHUNK), z=lz
+    int inflight;                       // operations the kernel still owns
+    int started, eof, dead;
+    int waiting;                        // on the worker's waiting list
+    struct aconn *wait_next;
+    int served;
+};
+
+struct io_uring_sqe *next_sqe(struct worker *w)
+{
+    struct io_uring_sqe *sqe = uring_sqe(&w->ring);
+    if (!sqe)
+    {
+        perror("\033[0;31mio_uring submission failed\033[0m\n");
+        exit(EXIT_FAILURE);
+    }
+    return sqe;
+}
+
+uint64_t op_data(void *p, int op)
+{
+    return (uint64_t)(uintptr_t)p | op;
+}
+
+void post_accept(struct worker *w)
+{
+    struct io_uring_sqe *sqe = next_sqe(w);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = w->listen_fd;
+    sqe->user_data = op_data(NULL, OP_ACCEPT);
+}
+
+void post_recv(struct aconn *a)
+{
+    struct io_uring_sqe *sqe = next_sqe(a->w);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = a->c.sock;
+    sqe->addr = (uintptr_t)(a->c.buf + a->c.len);
+    sqe->len = sizeof(a->c.buf) - a->c.len;
+    sqe->user_data = op_data(a, OP_RECV);
+    a->inflight++;
+}
+
+void post_read(struct aconn *a, struct slot *sl)
+{
+    struct io_uring_sqe *sqe = next_sqe(a->w);
+    sqe->opcode = a->w->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = a->fd;
+    sqe->addr = (uintptr_t)(sl->buf + FX_HEADER_LEN);
+    sqe->len = sl->want;
+    sqe->off = sl->off;
+    sqe->buf_index = sl->index;
+    sqe->user_data = op_data(sl, OP_READ);
+    a->inflight++;
+}
+
+void post_timer(struct worker *w, double wait)
+{
+    struct io_uring_sqe *sqe = next_sqe(w);
+    w->ts.tv_sec = (long long)wait;
+    w->ts.tv_nsec = (long long)((wait - (long long)wait) * 1e9);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uintptr_t)&w->ts;
+    sqe->len = 1;
+    sqe->user_data = op_data(NULL, OP_TIMER);
+    w->timers++;
+}
+
+void post_send(struct aconn *a, const char *buf, size_t len)
+{
+    struct io_uring_sqe *sqe = next_sqe(a->w);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = a->c.sock;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = op_data(a, OP_SEND);
+    a->out = buf;
+    a->out_left = len;
+    a->inflight++;
+}
+
+void release_slot(struct worker *w, struct slot *sl)
+{
+    sl->owner = NULL;
+    sl->next = w->free_slots;
+    w->free_slots = sl;
+}
+
+void rr_push(struct worker *w, struct aconn *a)
+{
+    a->rr_next = NULL;
+    if (w->rr_tail)
+        w->rr_tail->rr_next = a;
+    else
+        w->rr_head = a;
+    w->rr_tail = a;
+}
+
+struct aconn *rr_pop(struct worker *w)
+{
+    struct aconn *a = w->rr_head;
+    w->rr_head = a->rr_next;
+    if (!w->rr_head)
+        w->rr_tail = NULL;
+    return a;
+}
+
+void queue_send(struct aconn *a, const char *buf, size_t len, struct slot *sl)
+{
+    /*
+     * The next frame of the connection, sent when
+     * the scheduler gets to it
+     */
+    a->sending = 1;
+    a->posted = 0;
+    a->out = buf;
+    a->out_left = a->out_total = len;
+    a->out_slot = sl;
+    a->queued = 1;
+    rr_push(a->w, a);
+}
+
+void schedule(struct worker *w)
+{
+    /*
+     * Deficit round robin: a connection at the head
+     * gets QUANTUM more bytes of credit if its frame
+     * costs more than it has, and goes to the back
+     * until the credit is enough
+     */
+    double t = 0;
+    while (w->rr_head && w->send_inflight < SEND_BUDGET)
+    {
+        struct aconn *a = rr_pop(w);
+        if (a->deficit < (long)a->out_total)
+        {
+            a->deficit += QUANTUM;
+            if (a->deficit < (long)a->out_total)
+            {
+                rr_push(w, a);
+                continue;
+            }
+        }
+        double wait = bucket_take(a->bucket, a->out_total);
+        if (wait > 0)
+        {
+            if (!t)
+                t = mono_time();
+            a->wake_at = t + wait;
+            a->throttled_since = t;
+            a->rr_next = w->throttled;
+            w->throttled = a;
+            if (!w->timers || a->wake_at < w->timer_at)
+            {
+                post_timer(w, wait);
+                w->timer_at = a->wake_at;
+            }
+            continue;
+        }
+        a->deficit -= a->out_total;
+        a->queued = 0;
+        a->posted = 1;
+        w->send_inflight += a->out_total;
+        post_send(a, a->out, a->out_total);
+    }
+}
 
-//---------------- UTILITY FUNCTIONS ---------------
+void timer_done(struct worker *w)
+{
+    /*
+     * Throttled connections whose time has come
+     * rejoin the round, a timeout is posted for
+     * the earliest of the others
+     */
+    double t = mono_time(), next = 0;
+    if (--w->timers == 0)
+        w->timer_at = 0;
+    for (struct aconn **pp = &w->throttled; *pp;)
+    {
+        struct aconn *a = *pp;
+        if (a->wake_at <= t)
+        {
+            *pp = a->rr_next;
+            a->throttled_time += t - a->throttled_since;
+            rr_push(w, a);
+        }
+        else
+        {
+            if (!next || a->wake_at < next)
+                next = a->wake_at;
+            pp = &a->rr_next;
+        }
+    }
+    if (next && (!w->timers || next < w->timer_at))
+    {
+        post_timer(w, next - t);
+        w->timer_at = next;
+    }
+}
 
-int open_file(const char *s)
+void unqueue(struct aconn *a)
 {
     /*
-     * Find the path of the requested file
-     * if it exists somewhere on the server
+     * Take a dying connection off the DRR round
+     * or the throttled list
      */
+    struct worker *w = a->w;
+    struct aconn **lists[] = {&w->rr_head, &w->throttled};
+    for (int i = 0; i < 2 && a->queued; i++)
+        for (struct aconn **pp = lists[i]; *pp; pp = &(*pp)->rr_next)
+            if (*pp == a)
+            {
+                *pp = a->rr_next;
+                a->queued = 0;
+                break;
+            }
+    w->rr_tail = NULL;
+    for (struct aconn *it = w->rr_head; it; it = it->rr_next)
+        w->rr_tail = it;
+    if (a->out_slot && !a->posted)
+    {
+        release_slot(w, a->out_slot);
+        a->out_slot = NULL;
+    }
+}
 
-    char *path = realpath(s, NULL);
+void send_ctrl(struct aconn *a, int type, off_t off, uint32_t crc, const char *msg)
+{
+    /*
+     * OPEN, END and ERR frames never overlap in
+     * time, they share the ctrl buffer
+     */
+    int len = msg ? strlen(msg) : 0;
+    struct fx_header h = {type, 0, len, off, crc, len};
+    fx_pack((unsigned char *)a->ctrl, &h);
+    memcpy(a->ctrl + FX_HEADER_LEN, msg, len);
+    queue_send(a, a->ctrl, FX_HEADER_LEN + len, NULL);
+}
+
+void unwait(struct aconn *a)
+{
+    struct aconn **pp = &a->w->waiting;
+    while (a->waiting && *pp)
+    {
+        if (*pp == a)
+        {
+            *pp = a->wait_next;
+            a->waiting = 0;
+        }
+        else
+            pp = &(*pp)->wait_next;
+    }
+}
 
+void fill_reads(struct aconn *a)
+{
     /*
-     * If the file doesn't exist on  the 
-     * server then return return -1  for
-     * indication file not found
+     * Keep READ_AHEAD reads in flight. When the
+     * worker is out of slots the connection waits
+     * for one to be released (wake_waiters)
      */
+    struct worker *w = a->w;
+    while (!a->dead && a->wcount < READ_AHEAD && a->next_read < a->end)
+    {
+        struct slot *sl = w->free_slots;
+        if (!sl)
+        {
+            if (!a->waiting)
+            {
+                a->waiting = 1;
+                a->wait_next = w->waiting;
+                w->waiting = a;
+            }
+            return;
+        }
+        w->free_slots = sl->next;
+        sl->owner = a;
+        sl->off = a->next_read;
+        sl->hole = 0;
+        a->window[(a->whead + a->wcount++) % READ_AHEAD] = sl;
 
-    if (!path)
+        /*
+         * A hole takes a slot without a read, so its
+         * FX_HOLE keeps its place in file order
+         */
+        if (a->next_read >= a->data_end)
+        {
+            off_t data = next_extent(a->fd, a->next_read, a->end, &a->data_end);
+            if (data > a->next_read)
+            {
+                sl->hole = data - a->next_read;
+                sl->want = sl->len = 0;
+                a->next_read = data;
+                continue;
+            }
+        }
+        sl->want = a->data_end - a->next_read < FX_CHUNK ? a->data_end - a->next_read : FX_CHUNK;
+        sl->len = -1;
+        a->next_read += sl->want;
+        post_read(a, sl);
+    }
+}
+
+void pump(struct aconn *a)
+{
+    /*
+     * Start the next send of the response unless
+     * one is in flight: the DATA frames in file
+     * order as their reads complete, then END
+     */
+    if (a->sending || a->dead || a->phase != PH_DATA)
+        return;
+    while (a->wcount)
     {
-        printf("\033[1;36mRequested File Not Found\033[0m\n\n");
-        return -1;
+        struct slot *sl = a->window[a->whead];
+        if (sl->len < 0)
+            return; // still reading
+        a->whead = (a->whead + 1) % READ_AHEAD;
+        a->wcount--;
+        if (sl->off >= a->end || (sl->len == 0 && !sl->hole))
+        {
+            release_slot(a->w, sl); // past a short read
+            continue;
+        }
+        if (sl->hole)
+        {
+            int n = frame_hole(&a->s, sl->off, sl->hole, (unsigned char *)sl->buf);
+            queue_send(a, sl->buf, n, sl);
+            return;
+        }
+
+        struct fx_header h;
+        char *data = sl->buf + FX_HEADER_LEN;
+        char *zdata = a->zbuf ? a->zbuf + FX_HEADER_LEN : NULL;
+        const char *payload = frame_block(&a->s, data, sl->len, sl->off, zdata, &h);
+        if (payload == data)
+        {
+            fx_pack((unsigned char *)sl->buf, &h);
+            queue_send(a, sl->buf, FX_HEADER_LEN + h.len, sl);
+        }
+        else
+        {
+            fx_pack((unsigned char *)a->zbuf, &h);
+            queue_send(a, a->zbuf, FX_HEADER_LEN + h.len, NULL);
+            release_slot(a->w, sl);
+            fill_reads(a);
+        }
+        return;
+    }
+    if (a->next_read >= a->end)
+    {
+        a->phase = PH_LAST;
+        send_ctrl(a, FX_END, a->s.sent, a->s.total_crc, NULL);
+    }
+}
+
+void kill_conn(struct aconn *a)
+{
+    /*
+     * Drop the connection. Reads and sends still
+     * in flight release their slots when they
+     * complete, the connection is freed after
+     * the last of them
+     */
+    if (a->dead)
+        return;
+    a->dead = 1;
+    unqueue(a);
+    for (; a->wcount; a->wcount--, a->whead = (a->whead + 1) % READ_AHEAD)
+        if (a->window[a->whead]->len >= 0)
+            release_slot(a->w, a->window[a->whead]);
+    if (a->fd >= 0)
+        release_file(a->fd, a->entry);
+    a->fd = -1;
+    if (a->c.sock >= 0)
+        shutdown(a->c.sock, SHUT_RDWR);
+}
+
+void free_conn(struct aconn *a)
+{
+    if (a->c.sock >= 0)
+    {
+        printf("\033[0;32mServed %d file(s) on this connection\033[0m\n", a->served);
+        if (rate_limit)
+            printf("\033[0;33mThrottled for %.3f s by the rate limit\033[0m\n", a->throttled_time);
+        close(a->c.sock);
+        cache_report();
     }
+    unwait(a);
+    free(a->zbuf);
+    free(a);
+}
+
+void *blocking_main(void *arg)
+{
+    struct conn *c = arg;
+    serve_connection(c);
+    free(c);
+    return NULL;
+}
+
+void hand_off(struct aconn *a)
+{
+    /*
+     * The rest of the connection is served by the
+     * blocking code on a thread of its own
+     */
+    struct conn *c = malloc(sizeof(struct conn));
+    *c = a->c;
+    pthread_t t;
+    if (pthread_create(&t, NULL, blocking_main, c) == 0)
+        pthread_detach(t);
     else
-        printf("Resource requested found at location:\n\
-        \033[1;36m%s\033[0m\n\n",
-               path);
+    {
+        close(c->sock);
+        free(c);
+    }
+    a->c.sock = -1;
+    a->dead = 1;
+}
+
+void start_request(struct aconn *a)
+{
+    if (!parse_request(a->line, &a->req))
+    {
+        a->phase = PH_LAST;
+        send_ctrl(a, FX_ERR, 0, 0, "BAD_REQUEST");
+        return;
+    }
+    printf("File Requested by client: \033[0;35m%s\033[0m\n", a->req.path);
+
+    off_t size;
+    a->fd = acquire_file(a->req.path, &a->entry, &size);
+    if (a->fd < 0)
+    {
+        a->phase = PH_LAST;
+        send_ctrl(a, FX_ERR, 0, 0, "FILE_NOT_FOUND");
+        return;
+    }
+    printf("\033[0;33mSize of File to be sent: %ld bytes\033[0m\n", (long)size);
+
+    stream_begin(&a->s, a->c.sock, &a->req);
+    request_range(&a->req, size, &a->next_read, &a->end);
+    a->data_end = a->req.sparse ? a->next_read : a->end;
+    if (a->req.lz && !a->zbuf)
+        a->zbuf = malloc(FX_HEADER_LEN + LZ_BOUND(FX_CHUNK));
+    a->phase = PH_DATA;
+    send_ctrl(a, FX_OPEN, size, 0, NULL);
+    fill_reads(a);
+}
 
+void next_request(struct aconn *a)
+{
     /*
-     * If the path of the file  is  found
-     * Then open the file and return  the
-     * File descriptor after opening  the 
-     * file in read mode
+     * Between responses: take the next request line
+     * from the buffer or receive more of them
      */
+    if (a->dead)
+        return;
+    if (!a->started)
+    {
+        int verb = pipelined_verb(&a->c);
+        if (verb < 0 && !a->eof)
+        {
+            post_recv(a);
+            return;
+        }
+        if (verb <= 0)
+        {
+            hand_off(a); // original protocol
+            return;
+        }
+        a->started = 1;
+    }
+    if ((a->c.len >= 5 && strncmp(a->c.buf, "SYNC ", 5) == 0) ||
+        (a->c.len >= 4 && strncmp(a->c.buf, "DIR ", 4) == 0))
+    {
+        hand_off(a);
+        return;
+    }
+    if (!conn_take_line(&a->c, a->line))
+    {
+        if (a->eof || a->c.len == sizeof(a->c.buf))
+            kill_conn(a);
+        else
+            post_recv(a);
+        return;
+    }
+    if (strcmp(a->line, "BYE") == 0)
+        kill_conn(a);
+    else
+        start_request(a);
+}
 
-    int fd = open(path, O_RDONLY, 0666);
-    return fd;
+void finish_request(struct aconn *a)
+{
+    if (a->fd >= 0)
+    {
+        release_file(a->fd, a->entry);
+        a->fd = -1;
+        report_stream(&a->req, &a->s.st);
+        a->served++;
+    }
+    a->phase = PH_IDLE;
+    a->deficit = 0; // nothing left to send
 }
 
-int get_file_size(char *filename)
+void accept_done(struct worker *w, int res)
 {
-    /**
-     * To get the size of the file we make 
-     * use of the stat system  call  which
-     * will return  the stats of the  file
-     * along with file size as one  of the
-     * return values.
+    post_accept(w);
+    if (res < 0)
+    {
+        errno = -res;
+        perror("\033[0;32maccept failure!!\033[0m\n");
+        return;
+    }
+    printf("\
+    \033[0;32mConnection Successfull !!\033[0m\n\n");
+    struct aconn *a = calloc(1, sizeof(struct aconn));
+    a->c.sock = res;
+    a->w = w;
+    a->fd = -1;
+    a->bucket = bucket_for(res);
+    next_request(a);
+}
+
+void read_done(struct aconn *a, struct slot *sl, int res)
+{
+    if (res < 0)
+    {
+        release_slot(a->w, sl);
+        kill_conn(a);
+        return;
+    }
+    sl->len = res;
+    if (res < sl->want && sl->off + res < a->end)
+        a->end = sl->off + res; // the file shrank
+    pump(a);
+}
+
+void send_done(struct aconn *a, int res)
+{
+    if (res < 0)
+    {
+        a->w->send_inflight -= a->out_total;
+        if (a->out_slot)
+            release_slot(a->w, a->out_slot);
+        a->out_slot = NULL;
+        kill_conn(a);
+        return;
+    }
+    if ((size_t)res < a->out_left)
+    {
+        post_send(a, a->out + res, a->out_left - res);
+        return;
+    }
+    a->sending = 0;
+    a->w->send_inflight -= a->out_total;
+    if (a->out_slot)
+    {
+        release_slot(a->w, a->out_slot);
+        a->out_slot = NULL;
+    }
+    if (a->phase == PH_LAST)
+    {
+        finish_request(a);
+        next_request(a);
+        return;
+    }
+    fill_reads(a);
+    pump(a);
+}
+
+void recv_done(struct aconn *a, int res)
+{
+    if (res < 0)
+    {
+        kill_conn(a);
+        return;
+    }
+    if (res == 0)
+        a->eof = 1;
+    a->c.len += res;
+    next_request(a);
+}
+
+void complete(struct worker *w, uint64_t data, int res)
+{
+    struct aconn *a = NULL;
+    void *p = (void *)(uintptr_t)(data & ~(uint64_t)OP_MASK);
+    switch (data & OP_MASK)
+    {
+    case OP_ACCEPT:
+        accept_done(w, res);
+        return;
+    case OP_TIMER:
+        timer_done(w);
+        return;
+    case OP_RECV:
+        a = p;
+        a->inflight--;
+        if (!a->dead)
+            recv_done(a, res);
+        break;
+    case OP_READ:
+    {
+        struct slot *sl = p;
+        a = sl->owner;
+        a->inflight--;
+        if (a->dead)
+            release_slot(w, sl);
+        else
+            read_done(a, sl, res);
+        break;
+    }
+    case OP_SEND:
+        a = p;
+        a->inflight--;
+        if (!a->dead)
+            send_done(a, res);
+        else
+        {
+            w->send_inflight -= a->out_total; // never continued
+            if (a->out_slot)
+                release_slot(w, a->out_slot);
+            a->out_slot = NULL;
+        }
+        break;
+    }
+    if (a->dead && a->inflight == 0)
+        free_conn(a);
+}
+
+void wake_waiters(struct worker *w)
+{
+    while (w->free_slots && w->waiting)
+    {
+        struct aconn *a = w->waiting;
+        w->waiting = a->wait_next;
+        a->waiting = 0;
+        fill_reads(a);
+        pump(a);
+    }
+}
+
+void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    post_accept(w);
+    while (1)
+    {
+        if (uring_enter(&w->ring, 1) < 0 && errno != EBUSY)
+        {
+            perror("\033[0;31mio_uring_enter failed\033[0m\n");
+            exit(EXIT_FAILURE);
+        }
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_cqe(&w->ring)))
+        {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            uring_cqe_seen(&w->ring);
+            complete(w, data, res);
+        }
+        wake_waiters(w);
+        schedule(w);
+    }
+    return NULL;
+}
+
+int worker_init(struct worker *w, int listen_fd)
+{
+    static const unsigned char ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+                                        IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_TIMEOUT};
+    memset(w, 0, sizeof(*w));
+    if (uring_init(&w->ring, RING_DEPTH) < 0)
+        return -1;
+    if (!uring_supports(&w->ring, ops, sizeof(ops)))
+    {
+        uring_exit(&w->ring);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    w->listen_fd = listen_fd;
+    if (posix_memalign((void **)&w->arena, 4096, (size_t)SLOTS * SLOT_SIZE) != 0)
+        return -1;
+
+    /*
+     * Registered buffers are pinned once instead
+     * of on every read. If the memlock limit says
+     * no, plain reads into the same slots will do
      */
+    struct iovec iov[SLOTS];
+    for (int i = SLOTS - 1; i >= 0; i--)
+    {
+        struct slot *sl = &w->slots[i];
+        sl->buf = w->arena + (size_t)i * SLOT_SIZE;
+        sl->index = i;
+        sl->next = w->free_slots;
+        w->free_slots = sl;
+        iov[i].iov_base = sl->buf;
+        iov[i].iov_len = SLOT_SIZE;
+    }
+    w->fixed = uring_register_buffers(&w->ring, iov, SLOTS) == 0;
+    return 0;
+}
 
-    struct stat st;
-    stat(filename, &st);
-    int size = st.st_size;
-    return size;
+int serve_async(int server_fd)
+{
+    /*
+     * One worker per CPU (at most WORKERS_MAX).
+     * Returns -1 if io_uring cannot be used, the
+     * caller then runs a thread per connection
+     */
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = ncpu < 1 ? 1 : ncpu > WORKERS_MAX ? WORKERS_MAX : ncpu;
+    struct worker *workers = calloc(n, sizeof(struct worker));
+    for (int i = 0; i < n; i++)
+        if (worker_init(&workers[i], server_fd) < 0)
+        {
+            if (i == 0)
+            {
+                free(workers);
+                return -1;
+            }
+            n = i;
+        }
+    printf("\033[0;33m%d io_uring worker(s), %s read buffers\033[0m\n\n", n,
+           workers[0].fixed ? "registered" : "plain");
+    for (int i = 0; i < n; i++)
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    for (int i = 0; i < n; i++)
+        pthread_join(workers[i].thread, NULL);
+    return 0;
 }
 
 /**         DRIVER CODE         **/
 
 int main(int argc, char const *argv[])
 {
+    /*
+     * -r <rate>: limit every client IP address to
+     * <rate> bytes per second (suffix k, m or g)
+     * -u <host:port>: caching proxy for that server
+     * -P <port>: listen on another port than PORT
+     */
+    int port = PORT;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            char *unit;
+            double rate = strtod(argv[++i], &unit);
+            rate *= *unit == 'k' ? 1e3 : *unit == 'm' ? 1e6 : *unit == 'g' ? 1e9 : 1;
+            rate_limit = rate;
+        }
+        else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+        {
+            char host[64];
+            int up_port;
+            if (sscanf(argv[++i], "%63[^:]:%d", host, &up_port) != 2 ||
+                inet_pton(AF_INET, host, &upstream.sin_addr) <= 0)
+            {
+                printf("Upstream must be given as <IPv4 address>:<port>\n");
+                return 1;
+            }
+            upstream.sin_family = AF_INET;
+            upstream.sin_port = htons(up_port);
+            proxy_mode = 1;
+        }
+        else
+        {
+            printf("Usage: %s [-r <bytes per second>[k|m|g]] [-u <host:port>] [-P <port>]\n", argv[0]);
+            return 1;
+        }
+    }
+
     /*
      * First we need to setup the TCP  socket
      * after which we will bind the socket to
@@ -134,13 +2839,13 @@ int main(int argc, char const *argv[])
      *
      * 2. AF_INET -> Using IPv4 addresses
      *
-     * 3. PORT -> Running on port 8080
+     * 3. PORT -> Running on port 8080 (or -P)
      */
     struct sockaddr_in address;
     int addrlen = sizeof(address);
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    address.sin_port = htons(port);
 
     /*
      * The bind function assigns a local protocol address to a socket
@@ -181,96 +2886,61 @@ int main(int argc, char const *argv[])
     \033[0m\n\
     Waiting for client connection ...\n\n");
 
+    cache_init();
+    crc32c_init();
+
     /*
-     * server listens continuously
-     * unless signal SIGINT (ctrl + C) is provided
+     * A client that goes away mid response must
+     * not take the whole server down with it
      */
-    while (1)
+    signal(SIGPIPE, SIG_IGN);
+
+    /*
+     * Serve with the io_uring workers, or with a
+     * thread per connection where io_uring (or one
+     * of its opcodes) is not available. The proxy
+     * waits on upstream and on other connections'
+     * fetches, it always runs a thread per connection
+     */
+    if (proxy_mode)
     {
-        /*
-         * The accept() call is used by a server to accept a connection request from a client.
-         * When a connection is available, the socket created is ready for use to read data from the process that requested the connection.
-         * The call accepts the first connection on its queue of pending connections for the given socket socket.
-         */
-        int new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen);
-        if (new_socket < 0)
-        {
-            perror("\033[0;32maccept failure!!\033[0m\n");
-            exit(EXIT_FAILURE);
-        }
-        // successfully connected
-        printf("\
-    \033[0;32mConnection Successfull !!\033[0m\n\n");
+        mkdir(PROXY_DIR, 0755);
+        printf("\033[0;33mCaching proxy, files are kept in %s/\033[0m\n\n", PROXY_DIR);
+    }
+    if (proxy_mode || serve_async(server_fd) < 0)
+    {
+        if (!proxy_mode)
+            perror("\033[0;33mio_uring unavailable, one thread per connection\033[0m\n");
 
         /*
-         * read the name of client requested file name
-         * if not found in the local directory - close the socket
-         * if found - but an empy file ##################################################################################################
-         * if found - send chunks of data (with a maximum len of MAXLEN)
+         * server listens continuously
+         * unless signal SIGINT (ctrl + C) is provided
          */
-        char file[MAXLEN];
-        int len = read(new_socket, file, MAXLEN);
-        file[len] = '\0';
-        printf("File Requested by client: \033[0;35m%s\033[0m\n", file);
-
-        int fd = open_file(file);
-        if (fd < 0)
+        while (1)
         {
             /*
-             * FILE_NOT_FOUND
-             * shutdown the socket - stop transmission and reading through the socket
-             * close the socket
+             * The accept() call is used by a server to accept a connection request from a client.
+             * When a connection is available, the socket created is ready for use to read data from the process that requested the connection.
+             * The call accepts the first connection on its queue of pending connections for the given socket socket.
              */
-
-            perror("\033[0;32m FILE NOT FOUND !!\033[0m\n");
-            char buf[2];
-            sprintf(buf, "E");
-            send(new_socket, buf, strlen(buf), 0);
-            status = shutdown(new_socket, SHUT_RDWR);
-            if (status < 0)
+            int new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen);
+            if (new_socket < 0)
             {
-                perror("\033[0;32mError in terminating the connection!!\033[0m\n");
+                perror("\033[0;32maccept failure!!\033[0m\n");
                 exit(EXIT_FAILURE);
             }
-            close(new_socket);
-        }
-        else
-        {
-            /*
-             * create a char array of MAXLEN size
-             * continuosly read and send data through the socket
-             * once the entire content is read - shutdown the socket and close it
-             */
-            char *msg = "L";
-            send(new_socket, msg, strlen(msg), 0);
-
-            int FSIZE = get_file_size(file);
-            char fsize[MAXLEN];
-            sprintf(fsize, "%d", FSIZE);
-            printf("\033[0;33mSize of File to be sent: %d bytes\033[0m\n", FSIZE);
-            send(new_socket, fsize, strlen(fsize), 0);
+            // successfully connected
+            printf("\
+    \033[0;32mConnection Successfull !!\033[0m\n\n");
 
-            char buf[MAXLEN];
-            while (1)
-            {
-                int len = read(fd, buf, MAXLEN);
-                buf[len] = '\0';
-                if (len > 0)
-                {
-                    send(new_socket, buf, strlen(buf), 0);
-                }
-                else
-                {
-                    status = shutdown(new_socket, SHUT_RDWR);
-                    if (status < 0)
-                    {
-                        perror("\033[0;32mError in terminating the connection!!\033[0m\n");
-                        exit(EXIT_FAILURE);
-                    }
-                    close(new_socket);
-                    break;
-                }
-            }
+            struct conn *c = malloc(sizeof(struct conn));
+            c->sock = new_socket;
+            c->len = 0;
+            pthread_t t;
+            if (pthread_create(&t, NULL, blocking_main, c) == 0)
+                pthread_detach(t);
+            else
+                blocking_main(c);
         }
     }
 
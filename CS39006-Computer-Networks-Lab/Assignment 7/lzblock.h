@@ -0,0 +1,193 @@
+/**
+ *
+ *       Network Assignment-7
+ *
+ *     *--------------------------------*
+ *     *   LZ block compression         *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @file:        lzblock.h
+ *
+ *      A small LZ77 codec in the spirit of LZ4, used to
+ *      compress each FX_DATA block independently so the
+ *      compression pipelines with the network I/O.
+ *
+ *      A block is a list of sequences:
+ *
+ *          token (literals:4 | match - 4:4)
+ *          [extra literal length bytes]
+ *          literals
+ *          offset (2 bytes, little endian)
+ *          [extra match length bytes]
+ *
+ *      A length nibble of 15 is followed by bytes that are
+ *      added to it until one is below 255. The last
+ *      sequence has literals only.
+ */
+
+#ifndef LZBLOCK_H
+#define LZBLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_MAX_OFFSET 65535
+
+/* worst case output size for n input bytes */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+static inline uint32_t lz_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline unsigned char *lz_put_length(unsigned char *op, int len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+static inline unsigned char *lz_put_sequence(unsigned char *op, const unsigned char *lit, int nlit, int offset, int match)
+{
+    unsigned char *token = op++;
+    int ml = match ? match - LZ_MIN_MATCH : 0;
+    *token = (nlit < 15 ? nlit : 15) << 4 | (ml < 15 ? ml : 15);
+    if (nlit >= 15)
+        op = lz_put_length(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (match)
+    {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        if (ml >= 15)
+            op = lz_put_length(op, ml - 15);
+    }
+    return op;
+}
+
+static inline int lz_compress(const void *src, int n, void *dst)
+{
+    /*
+     * Greedy matching with a single-entry hash table
+     * of 4 byte prefixes. Bytes without a match are
+     * skipped faster and faster (as in LZ4) so that
+     * incompressible input costs little time.
+     * Returns the compressed size
+     */
+    const unsigned char *in = src, *ip = in, *anchor = in;
+    const unsigned char *limit = in + n - LZ_MIN_MATCH;
+    unsigned char *op = dst;
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    int misses = 0;
+    while (ip < limit)
+    {
+        uint32_t h = lz_hash(lz_read32(ip));
+        const unsigned char *ref = in + table[h];
+        table[h] = ip - in;
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != lz_read32(ip))
+        {
+            ip += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+
+        const unsigned char *end = in + n;
+        int match = LZ_MIN_MATCH;
+        while (ip + match < end && ref[match] == ip[match])
+            match++;
+
+        op = lz_put_sequence(op, anchor, ip - anchor, ip - ref, match);
+        ip += match;
+        anchor = ip;
+    }
+    op = lz_put_sequence(op, anchor, in + n - anchor, 0, 0);
+    return op - (unsigned char *)dst;
+}
+
+static inline int lz_get_length(const unsigned char **ip, const unsigned char *end, int *len)
+{
+    unsigned char b;
+    do
+    {
+        if (*ip >= end)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+static inline int lz_decompress(const void *src, int n, void *dst, int cap)
+{
+    /*
+     * Decode a block produced by lz_compress() into
+     * at most cap bytes. Every length and offset is
+     * checked so a corrupt block cannot write out of
+     * bounds. Returns the decoded size or -1
+     */
+    const unsigned char *ip = src, *end = ip + n;
+    unsigned char *op = dst, *out = dst, *oend = out + cap;
+
+    while (ip < end)
+    {
+        int token = *ip++;
+        int nlit = token >> 4;
+        if (nlit == 15 && lz_get_length(&ip, end, &nlit) < 0)
+            return -1;
+        if (nlit > end - ip || nlit > oend - op)
+            return -1;
+        memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == end)
+            break; // last sequence, literals only
+
+        if (end - ip < 2)
+            return -1;
+        int offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        int match = token & 15;
+        if (match == 15 && lz_get_length(&ip, end, &match) < 0)
+            return -1;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op - out || match > oend - op)
+            return -1;
+
+        /*
+         * Overlapping copies (offset < match) repeat
+         * the pattern, so copy byte by byte
+         */
+        const unsigned char *ref = op - offset;
+        if (offset >= match)
+            memcpy(op, ref, match);
+        else
+            for (int i = 0; i < match; i++)
+                op[i] = ref[i];
+        op += match;
+    }
+    return op - out;
+}
+
+#endif
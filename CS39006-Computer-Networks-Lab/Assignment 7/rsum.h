@@ -0,0 +1,190 @@
+/**
+ *
+ *       Network Assignment-7
+ *
+ *     *--------------------------------*
+ *     *   Block signatures for delta   *
+ *     *   transfers (rsync algorithm)  *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @file:        rsum.h
+ *
+ *      Weak checksum: the Adler style rolling sum of
+ *      rsync. For a window x[0..L-1]
+ *
+ *          a = sum x[i]              (mod 2^16)
+ *          b = sum (L - i) * x[i]    (mod 2^16)
+ *          weak = a | b << 16
+ *
+ *      and sliding the window by one byte is O(1). The
+ *      full sum of a block is computed 16 bytes at a time
+ *      (psadbw for a, pmaddwd for b) with SSE2.  Every
+ *      sum is kept mod 2^32, which is exact mod 2^16.
+ *
+ *      Strong checksum: XXH64 of the block, only looked
+ *      at when the weak sums match.
+ */
+
+#ifndef RSUM_H
+#define RSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RSUM_SSE2 1
+#endif
+
+/* one block of the receiver's copy as sent on the wire */
+#define RS_SIG_LEN 12 // weak(4) strong(8)
+
+struct rs_sig
+{
+    uint32_t weak;
+    uint64_t strong;
+};
+
+//---------------- ROLLING (WEAK) SUM --------------
+
+static inline uint32_t rs_weak(const unsigned char *p, size_t len)
+{
+    uint32_t a = 0, b = 0;
+    size_t i = 0;
+#ifdef RSUM_SSE2
+    /*
+     * For the 16 bytes at offset j the weights are
+     * L - j - k, i.e. (L - j) * sum - sum k * x[k]
+     */
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i klo = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m128i khi = _mm_setr_epi16(8, 9, 10, 11, 12, 13, 14, 15);
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i sad = _mm_sad_epu8(v, zero);
+        uint32_t sum = _mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+        __m128i w = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(v, zero), klo),
+                                  _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), khi));
+        w = _mm_add_epi32(w, _mm_srli_si128(w, 8));
+        w = _mm_add_epi32(w, _mm_srli_si128(w, 4));
+        uint32_t ksum = _mm_cvtsi128_si32(w);
+        a += sum;
+        b += (uint32_t)(len - i) * sum - ksum;
+    }
+#endif
+    for (; i < len; i++)
+    {
+        a += p[i];
+        b += (uint32_t)(len - i) * p[i];
+    }
+    return (a & 0xffff) | (b & 0xffff) << 16;
+}
+
+static inline uint32_t rs_roll(uint32_t weak, unsigned char out, unsigned char in, size_t len)
+{
+    /*
+     * Slide the window one byte: drop  out  from the
+     * front, append  in  at the back
+     */
+    uint32_t a = weak & 0xffff, b = weak >> 16;
+    a = (a - out + in) & 0xffff;
+    b = (b - (uint32_t)len * out + a) & 0xffff;
+    return a | b << 16;
+}
+
+//---------------- STRONG HASH (XXH64) -------------
+
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static inline uint64_t xxh_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t in)
+{
+    acc += in * XXH_P2;
+    return xxh_rotl(acc, 31) * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v)
+{
+    acc ^= xxh_round(0, v);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static inline uint64_t rs_strong(const unsigned char *p, size_t len)
+{
+    const unsigned char *end = p + len;
+    uint64_t h;
+    if (len >= 32)
+    {
+        uint64_t v1 = XXH_P1 + XXH_P2, v2 = XXH_P2, v3 = 0, v4 = -XXH_P1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+        }
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    }
+    else
+        h = XXH_P5;
+    h += len;
+    for (; p + 8 <= end; p += 8)
+        h = xxh_rotl(h ^ xxh_round(0, xxh_read64(p)), 27) * XXH_P1 + XXH_P4;
+    if (p + 4 <= end)
+    {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        h = xxh_rotl(h ^ (uint64_t)v * XXH_P1, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = xxh_rotl(h ^ *p * XXH_P5, 11) * XXH_P1;
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline size_t rs_block_size(uint64_t size)
+{
+    /*
+     * About sqrt(size) like rsync, rounded to a power
+     * of two between 1 KB and 64 KB
+     */
+    size_t bs = 1024;
+    while (bs < 65536 && (uint64_t)bs * bs < size)
+        bs <<= 1;
+    return bs;
+}
+
+#endif
@@ -0,0 +1,192 @@
+/**
+ *
+ *       Network Assignment-7
+ *
+ *     *--------------------------------*
+ *     *   Minimal io_uring wrapper     *
+ *     *--------------------------------*
+ *
+ *      @authors:  Debajyoti Dasgupta    (debajyotidasgupta6@gmail.com)
+ *                 Siba Smarak Panigrahi (sibasmarak.p@gmail.com)
+ *      @language: C
+ *      @subject:  Computer Networks Lab
+ *      @topic:    Socket Programming
+ *      @session:  2020-21
+ *
+ *      @file:        uring.h
+ *
+ *      Just enough of io_uring for file_server.c,  on
+ *      top of the raw system calls so that liburing is
+ *      not needed. One ring belongs to one thread:
+ *
+ *          struct io_uring_sqe *sqe = uring_sqe(&r);
+ *          sqe->opcode = IORING_OP_READ; ...
+ *          uring_enter(&r, 1);            // submit, wait
+ *          while ((cqe = uring_cqe(&r)))
+ *              ... uring_cqe_seen(&r);
+ *
+ *      The SQ array is the identity mapping and the SQ
+ *      tail is published as soon as an entry is taken,
+ *      the kernel only looks at it in uring_enter().
+ *      A kernel may have io_uring without the opcodes
+ *      a caller needs, uring_supports() asks it first.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct uring
+{
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned pending;             // entries taken since the last enter
+    void *sq_map, *cq_map;
+    size_t sq_len, cq_len, sqe_len;
+};
+
+static inline int uring_init(struct uring *r, unsigned entries)
+{
+    /*
+     * Returns -1 (errno set) where io_uring is not
+     * available, e.g. old kernels or seccomp
+     */
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_len = r->cq_len = r->sq_len > r->cq_len ? r->sq_len : r->cq_len;
+    r->sq_map = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED)
+        goto fail;
+    r->cq_map = r->sq_map;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        r->cq_map = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED)
+            goto fail;
+    }
+    r->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->entries = p.sq_entries;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    unsigned *array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    close(r->fd);
+    r->fd = -1;
+    return -1;
+}
+
+static inline void uring_exit(struct uring *r)
+{
+    munmap(r->sqes, r->sqe_len);
+    if (r->cq_map != r->sq_map)
+        munmap(r->cq_map, r->cq_len);
+    munmap(r->sq_map, r->sq_len);
+    close(r->fd);
+    r->fd = -1;
+}
+
+static inline int uring_supports(struct uring *r, const unsigned char *ops, int n)
+{
+    /*
+     * 1 if every opcode in ops[] is known to the
+     * kernel. Kernels before 5.6 have no probe,
+     * and none of the socket opcodes either
+     */
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *p = calloc(1, len);
+    int ok = p && syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, p, 256) == 0;
+    for (int i = 0; ok && i < n; i++)
+        ok = ops[i] <= p->last_op && (p->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    free(p);
+    return ok;
+}
+
+static inline int uring_register_buffers(struct uring *r, const struct iovec *iov, unsigned n)
+{
+    return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, n);
+}
+
+static inline int uring_enter(struct uring *r, unsigned wait)
+{
+    /*
+     * Submit everything taken so far and, with wait,
+     * block until at least that many completions
+     */
+    int n;
+    do
+        n = syscall(__NR_io_uring_enter, r->fd, r->pending, wait,
+                    wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    while (n < 0 && errno == EINTR);
+    if (n > 0)
+        r->pending -= (unsigned)n < r->pending ? (unsigned)n : r->pending;
+    return n;
+}
+
+static inline struct io_uring_sqe *uring_sqe(struct uring *r)
+{
+    /*
+     * A cleared submission entry, submitting the
+     * queued ones first if the ring is full
+     */
+    unsigned tail = *r->sq_tail;
+    while (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries)
+        if (uring_enter(r, 0) < 0)
+            return NULL;
+    struct io_uring_sqe *sqe = &r->sqes[tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->pending++;
+    return sqe;
+}
+
+static inline struct io_uring_cqe *uring_cqe(struct uring *r)
+{
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
+
+static inline void uring_cqe_seen(struct uring *r)
+{
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif